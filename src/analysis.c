@@ -0,0 +1,809 @@
+#include "analysis.h"
+#include "error.h"
+#include "codegen.h"
+#include <string.h>
+
+#define FLAGS_READ 1
+#define FLAGS_WRITE 2
+// Writes only some of the flags: the others keep their value, so they are read too.
+#define FLAGS_UPDATE (FLAGS_READ | FLAGS_WRITE)
+// A shift by a count of 0, or by cl which may be 0, leaves the flags alone.
+#define FLAGS_SHIFT 4
+
+typedef enum {
+    DST_NONE,
+    DST_WRITE,
+    DST_UPDATE
+} dst_mode_t;
+
+typedef struct {
+    char *name;
+    dst_mode_t dst;
+    int flags;
+} instr_info_t;
+
+// How ordinary instructions use their operands. Implicit registers are handled in instr_asm_effects.
+static instr_info_t instr_infos[] = {
+        {"mov",     DST_WRITE,  0},
+        {"movabs",  DST_WRITE,  0},
+        {"movzx",   DST_WRITE,  0},
+        {"movsx",   DST_WRITE,  0},
+        {"movsxd",  DST_WRITE,  0},
+        {"lea",     DST_WRITE,  0},
+        {"add",     DST_UPDATE, FLAGS_WRITE},
+        {"sub",     DST_UPDATE, FLAGS_WRITE},
+        {"and",     DST_UPDATE, FLAGS_WRITE},
+        {"or",      DST_UPDATE, FLAGS_WRITE},
+        {"xor",     DST_UPDATE, FLAGS_WRITE},
+        {"adc",     DST_UPDATE, FLAGS_UPDATE},
+        {"sbb",     DST_UPDATE, FLAGS_UPDATE},
+        {"inc",     DST_UPDATE, FLAGS_UPDATE},
+        {"dec",     DST_UPDATE, FLAGS_UPDATE},
+        {"neg",     DST_UPDATE, FLAGS_WRITE},
+        {"not",     DST_UPDATE, 0},
+        {"shl",     DST_UPDATE, FLAGS_WRITE | FLAGS_SHIFT},
+        {"sal",     DST_UPDATE, FLAGS_WRITE | FLAGS_SHIFT},
+        {"shr",     DST_UPDATE, FLAGS_WRITE | FLAGS_SHIFT},
+        {"sar",     DST_UPDATE, FLAGS_WRITE | FLAGS_SHIFT},
+        {"rol",     DST_UPDATE, FLAGS_UPDATE},
+        {"ror",     DST_UPDATE, FLAGS_UPDATE},
+        {"rcl",     DST_UPDATE, FLAGS_UPDATE},
+        {"rcr",     DST_UPDATE, FLAGS_UPDATE},
+        {"bswap",   DST_UPDATE, 0},
+        {"bsf",     DST_WRITE,  FLAGS_WRITE},
+        {"bsr",     DST_WRITE,  FLAGS_WRITE},
+        {"tzcnt",   DST_WRITE,  FLAGS_WRITE},
+        {"lzcnt",   DST_WRITE,  FLAGS_WRITE},
+        {"popcnt",  DST_WRITE,  FLAGS_WRITE},
+        {"cmp",     DST_NONE,   FLAGS_WRITE},
+        {"test",    DST_NONE,   FLAGS_WRITE},
+        {"bt",      DST_NONE,   FLAGS_UPDATE},
+        {"nop",     DST_NONE,   0},
+        {"jmp",     DST_NONE,   0},
+        {"clc",     DST_NONE,   FLAGS_UPDATE},
+        {"stc",     DST_NONE,   FLAGS_UPDATE},
+};
+
+// Virtual registers are in no family until they are allocated.
+regset_t regset_of(register_kind_t reg) {
+    if (reg == NO_REGISTER || is_virtual_register(reg)) {
+        return 0;
+    }
+    return 1u << register_family(reg);
+}
+
+regset_t sysv_caller_saved() {
+    return regset_of(RAX) | regset_of(RCX) | regset_of(RDX) | regset_of(RSI) | regset_of(RDI)
+           | regset_of(R8) | regset_of(R9) | regset_of(R10) | regset_of(R11);
+}
+
+regset_t sysv_callee_saved() {
+    return regset_of(RBX) | regset_of(RBP) | regset_of(RSP)
+           | regset_of(R12) | regset_of(R13) | regset_of(R14) | regset_of(R15);
+}
+
+int regset_count(regset_t set) {
+    int count = 0;
+    for (; set != 0; set &= set - 1) {
+        count++;
+    }
+    return count;
+}
+
+regset_t expr_regs(expr_t *expr) {
+    switch (expr->kind) {
+        case REGISTER:
+            return regset_of(expr->register_);
+        case MEMORY:
+            return regset_of(expr->memory.base) | regset_of(expr->memory.index);
+        default:
+            return 0;
+    }
+}
+
+regset_t expr_list_regs(expr_list_t *list) {
+    regset_t set = 0;
+    for (int i = 0; i < list->len; i++) {
+        set |= expr_regs(get_expr(list, i));
+    }
+    return set;
+}
+
+regset_t cond_regs(cond_t *cond) {
+    if (cond->kind == COND_CMP) {
+        return expr_list_regs(cond->operands);
+    }
+    return cond_regs(cond->lhs) | (cond->rhs != NULL ? cond_regs(cond->rhs) : 0);
+}
+
+static instr_info_t *find_instr_info(char *name) {
+    for (int i = 0; i < (int) (sizeof(instr_infos) / sizeof(instr_infos[0])); i++) {
+        if (strcmp(instr_infos[i].name, name) == 0) {
+            return &instr_infos[i];
+        }
+    }
+    return NULL;
+}
+
+// Whether a shift moves by at least one bit. The count is masked to 5 bits, 6 for 64-bit operands.
+static bool is_nonzero_count(expr_list_t *args) {
+    if (args->len == 1) {
+        return true;
+    }
+    expr_t *count = get_expr(args, 1);
+    return count->kind == IMMEDIATE && (count->immediate & 0x1f) != 0;
+}
+
+static bool is_jcc(char *op) {
+    return op[0] == 'j' && strcmp(op, "jmp") != 0;
+}
+
+bool is_flags_reader(char *op) {
+    instr_info_t *info = find_instr_info(op);
+    if (info != NULL) {
+        return (info->flags & FLAGS_READ) != 0;
+    }
+    return is_jcc(op) || strncmp(op, "cmov", 4) == 0 || strncmp(op, "set", 3) == 0
+           || strcmp(op, "pushf") == 0 || strcmp(op, "pushfq") == 0;
+}
+
+// Labels with the default ABI preserve nothing, so a call may write every register but rsp.
+static regset_t call_defs() {
+    return (REGSET_GPR & ~regset_of(RSP)) | REGSET_FLAGS | REGSET_MEMORY;
+}
+
+static const char *special_instrs[] = {
+        "push", "pop", "xchg", "imul", "mul", "div", "idiv", "cqo", "cdq", "cdqe", "call", "ret", "syscall", "leave"
+};
+
+bool is_known_instr(instr_asm_t *instr) {
+    if (find_instr_info(instr->name) != NULL || is_jcc(instr->name)
+        || strncmp(instr->name, "cmov", 4) == 0 || strncmp(instr->name, "set", 3) == 0) {
+        return true;
+    }
+    for (int i = 0; i < (int) (sizeof(special_instrs) / sizeof(special_instrs[0])); i++) {
+        if (strcmp(instr->name, special_instrs[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads and writes of the operands of a generic instruction. A write narrower than 32 bits keeps the
+// rest of the register, so it also counts as a read, which keeps liveness conservative.
+static void operand_effects(expr_list_t *args, dst_mode_t dst, regset_t *uses, regset_t *defs) {
+    for (int i = 0; i < args->len; i++) {
+        expr_t *expr = get_expr(args, i);
+        if (i > 0 || dst == DST_NONE) {
+            *uses |= expr_regs(expr);
+            if (expr->kind == MEMORY) {
+                *uses |= REGSET_MEMORY;
+            }
+            continue;
+        }
+        if (expr->kind == REGISTER) {
+            *defs |= regset_of(expr->register_);
+            if (dst == DST_UPDATE || register_width(expr->register_) < 32) {
+                *uses |= regset_of(expr->register_);
+            }
+        } else if (expr->kind == MEMORY) {
+            *uses |= expr_regs(expr);
+            *defs |= REGSET_MEMORY;
+            if (dst == DST_UPDATE) {
+                *uses |= REGSET_MEMORY;
+            }
+        }
+    }
+}
+
+#define IMPLICIT(reg) (1u << (reg))
+
+// Instructions outside instr_infos that work on registers they do not name.
+static const struct {
+    char *name;
+    regset_t uses;
+    regset_t defs;
+} implicit_instrs[] = {
+        {"rdtsc",  0,                                                        IMPLICIT(RAX) | IMPLICIT(RDX)},
+        {"rdtscp", 0,                                                        IMPLICIT(RAX) | IMPLICIT(RCX) | IMPLICIT(RDX)},
+        {"cpuid",  IMPLICIT(RAX) | IMPLICIT(RCX),                            IMPLICIT(RAX) | IMPLICIT(RBX) | IMPLICIT(RCX) | IMPLICIT(RDX)},
+        {"cbw",    IMPLICIT(RAX),                                            IMPLICIT(RAX)},
+        {"cwde",   IMPLICIT(RAX),                                            IMPLICIT(RAX)},
+        {"cwd",    IMPLICIT(RAX),                                            IMPLICIT(RDX)},
+        {"xlat",   IMPLICIT(RAX) | IMPLICIT(RBX) | REGSET_MEMORY,            IMPLICIT(RAX)},
+        {"xlatb",  IMPLICIT(RAX) | IMPLICIT(RBX) | REGSET_MEMORY,            IMPLICIT(RAX)},
+        {"pause",  0,                                                        0},
+        {"lfence", REGSET_MEMORY,                                            REGSET_MEMORY},
+        {"sfence", REGSET_MEMORY,                                            REGSET_MEMORY},
+        {"mfence", REGSET_MEMORY,                                            REGSET_MEMORY},
+        {"ud2",    0,                                                        0},
+        {"int3",   0,                                                        0},
+        {"hlt",    0,                                                        0},
+};
+
+// lods, stos, movs, cmps and scas with a b/w/d/q suffix, which step rsi and rdi in the direction flag.
+static bool string_effects(char *op, regset_t *uses, regset_t *defs) {
+    if (strlen(op) != 5 || strchr("bwdq", op[4]) == NULL) {
+        return false;
+    }
+    regset_t rax = IMPLICIT(RAX), rsi = IMPLICIT(RSI), rdi = IMPLICIT(RDI);
+    regset_t read, written;
+    if (strncmp(op, "lods", 4) == 0) {
+        read = rsi;
+        written = rax | rsi;
+    } else if (strncmp(op, "stos", 4) == 0) {
+        read = rax | rdi;
+        written = rdi | REGSET_MEMORY;
+    } else if (strncmp(op, "movs", 4) == 0) {
+        read = rsi | rdi;
+        written = rsi | rdi | REGSET_MEMORY;
+    } else if (strncmp(op, "cmps", 4) == 0) {
+        read = rsi | rdi;
+        written = rsi | rdi | REGSET_FLAGS;
+    } else if (strncmp(op, "scas", 4) == 0) {
+        read = rax | rdi;
+        written = rdi | REGSET_FLAGS;
+    } else {
+        return false;
+    }
+    *uses |= read | REGSET_FLAGS | REGSET_MEMORY;
+    *defs |= written;
+    return true;
+}
+
+// Effects of the instructions with implicit operands that instr_asm_effects does not handle itself, false for
+// an instruction it knows nothing about.
+static bool implicit_effects(char *op, expr_list_t *args, regset_t *uses, regset_t *defs) {
+    regset_t rcx = IMPLICIT(RCX);
+    for (int i = 0; i < (int) (sizeof(implicit_instrs) / sizeof(implicit_instrs[0])); i++) {
+        if (strcmp(op, implicit_instrs[i].name) == 0 && args->len == 0) {
+            *uses |= implicit_instrs[i].uses;
+            *defs |= implicit_instrs[i].defs;
+            return true;
+        }
+    }
+    if (args->len == 0 && string_effects(op, uses, defs)) {
+        return true;
+    }
+    if (strncmp(op, "rep", 3) == 0 && args->len == 1 && get_expr(args, 0)->kind == LABEL) {
+        // rep movsb and the like: the string instruction comes as an operand, rcx counts down.
+        if (!string_effects(get_expr(args, 0)->label, uses, defs)) {
+            return false;
+        }
+        *uses |= rcx;
+        *defs |= rcx | (strcmp(op, "rep") != 0 ? REGSET_FLAGS : 0);
+        return true;
+    }
+    if (strcmp(op, "cmpxchg") == 0 && args->len == 2) {
+        operand_effects(args, DST_UPDATE, uses, defs);
+        *uses |= IMPLICIT(RAX);
+        *defs |= IMPLICIT(RAX) | REGSET_FLAGS;
+        return true;
+    }
+    if ((strcmp(op, "cmpxchg8b") == 0 || strcmp(op, "cmpxchg16b") == 0) && args->len == 1) {
+        operand_effects(args, DST_UPDATE, uses, defs);
+        *uses |= IMPLICIT(RAX) | IMPLICIT(RBX) | rcx | IMPLICIT(RDX);
+        *defs |= IMPLICIT(RAX) | IMPLICIT(RDX) | REGSET_FLAGS;
+        return true;
+    }
+    if (strcmp(op, "xadd") == 0 && args->len == 2) {
+        operand_effects(args, DST_UPDATE, uses, defs);
+        *defs |= expr_regs(get_expr(args, 1)) | REGSET_FLAGS;
+        return true;
+    }
+    if ((strcmp(op, "loop") == 0 || strcmp(op, "loope") == 0 || strcmp(op, "loopne") == 0
+         || strcmp(op, "loopz") == 0 || strcmp(op, "loopnz") == 0) && args->len == 1) {
+        operand_effects(args, DST_NONE, uses, defs);
+        *uses |= rcx | (op[4] != '\0' ? REGSET_FLAGS : 0);
+        *defs |= rcx;
+        return true;
+    }
+    return false;
+}
+
+static void instr_asm_effects(instr_asm_t *instr, regset_t *uses, regset_t *defs) {
+    char *op = instr->name;
+    expr_list_t *args = instr->args;
+    regset_t rax = regset_of(RAX), rdx = regset_of(RDX), rsp = regset_of(RSP);
+
+    if ((strcmp(op, "xor") == 0 || strcmp(op, "sub") == 0) && args->len == 2
+        && get_expr(args, 0)->kind == REGISTER && expr_equal(get_expr(args, 0), get_expr(args, 1))) {
+        // Zeroing idiom: the old value is not read.
+        *defs |= expr_regs(get_expr(args, 0)) | REGSET_FLAGS;
+        return;
+    }
+
+    instr_info_t *info = find_instr_info(op);
+    if (info != NULL) {
+        operand_effects(args, info->dst, uses, defs);
+        if ((info->flags & FLAGS_READ) || ((info->flags & FLAGS_SHIFT) && !is_nonzero_count(args))) {
+            *uses |= REGSET_FLAGS;
+        }
+        if (info->flags & FLAGS_WRITE) {
+            *defs |= REGSET_FLAGS;
+        }
+        return;
+    }
+    if (is_jcc(op)) {
+        operand_effects(args, DST_NONE, uses, defs);
+        *uses |= REGSET_FLAGS;
+    } else if (strncmp(op, "cmov", 4) == 0) {
+        operand_effects(args, DST_UPDATE, uses, defs);
+        *uses |= REGSET_FLAGS;
+    } else if (strncmp(op, "set", 3) == 0) {
+        operand_effects(args, DST_WRITE, uses, defs);
+        *uses |= REGSET_FLAGS;
+    } else if (strcmp(op, "push") == 0) {
+        operand_effects(args, DST_NONE, uses, defs);
+        *uses |= rsp;
+        *defs |= rsp | REGSET_MEMORY;
+    } else if (strcmp(op, "pop") == 0) {
+        operand_effects(args, DST_WRITE, uses, defs);
+        *uses |= rsp | REGSET_MEMORY;
+        *defs |= rsp;
+    } else if (strcmp(op, "xchg") == 0) {
+        operand_effects(args, DST_UPDATE, uses, defs);
+        if (args->len == 2) {
+            *defs |= expr_regs(get_expr(args, 1));
+        }
+    } else if (strcmp(op, "imul") == 0 && args->len == 2) {
+        operand_effects(args, DST_UPDATE, uses, defs);
+        *defs |= REGSET_FLAGS;
+    } else if (strcmp(op, "imul") == 0 && args->len == 3) {
+        operand_effects(args, DST_WRITE, uses, defs);
+        *defs |= REGSET_FLAGS;
+    } else if (strcmp(op, "imul") == 0 || strcmp(op, "mul") == 0) {
+        operand_effects(args, DST_NONE, uses, defs);
+        *uses |= rax;
+        *defs |= rax | rdx | REGSET_FLAGS;
+    } else if (strcmp(op, "div") == 0 || strcmp(op, "idiv") == 0) {
+        operand_effects(args, DST_NONE, uses, defs);
+        *uses |= rax | rdx;
+        *defs |= rax | rdx | REGSET_FLAGS;
+    } else if (strcmp(op, "cqo") == 0 || strcmp(op, "cdq") == 0) {
+        *uses |= rax;
+        *defs |= rdx;
+    } else if (strcmp(op, "cdqe") == 0) {
+        *uses |= rax;
+        *defs |= rax;
+    } else if (strcmp(op, "leave") == 0) {
+        *uses |= regset_of(RBP) | REGSET_MEMORY;
+        *defs |= regset_of(RBP) | rsp;
+    } else if (strcmp(op, "call") == 0) {
+        *uses |= REGSET_GPR | REGSET_MEMORY;
+        *defs |= call_defs();
+    } else if (strcmp(op, "ret") == 0) {
+        *uses |= REGSET_ALL;
+        *defs |= rsp;
+    } else if (strcmp(op, "syscall") == 0) {
+        *uses |= REGSET_GPR | REGSET_MEMORY;
+        *defs |= rax | regset_of(RCX) | regset_of(R11) | REGSET_MEMORY;
+    } else if (!implicit_effects(op, args, uses, defs)) {
+        // Unknown instruction: it may read and write anything it names, and any register it does not.
+        operand_effects(args, DST_UPDATE, uses, defs);
+        for (int i = 1; i < args->len; i++) {
+            *defs |= expr_regs(get_expr(args, i));
+        }
+        *uses |= (REGSET_GPR & ~rsp) | REGSET_FLAGS | REGSET_MEMORY;
+        *defs |= (REGSET_GPR & ~rsp) | REGSET_FLAGS | REGSET_MEMORY;
+    }
+}
+
+// Whether the instruction reads and writes its operand at index, a register or the memory a memory operand
+// names. Registers in a memory operand are only read. Unlike instr_effects this is about the operand, not the
+// whole register: a byte write is a write.
+void operand_access(instr_asm_t *instr, int index, bool *read, bool *write) {
+    char *op = instr->name;
+    expr_list_t *args = instr->args;
+    *read = true;
+    *write = false;
+    expr_kind_t kind = get_expr(args, index)->kind;
+    if (kind != REGISTER && kind != MEMORY) {
+        return;
+    }
+    if ((strcmp(op, "xor") == 0 || strcmp(op, "sub") == 0) && args->len == 2
+        && expr_equal(get_expr(args, 0), get_expr(args, 1))) {
+        *read = false;
+        *write = true;
+        return;
+    }
+    if (!is_known_instr(instr) || strcmp(op, "xchg") == 0) {
+        *write = true;
+        return;
+    }
+    dst_mode_t dst = DST_NONE;
+    instr_info_t *info = find_instr_info(op);
+    if (info != NULL) {
+        dst = info->dst;
+    } else if (strncmp(op, "cmov", 4) == 0 || (strcmp(op, "imul") == 0 && args->len == 2)) {
+        dst = DST_UPDATE;
+    } else if (strncmp(op, "set", 3) == 0 || strcmp(op, "pop") == 0 || (strcmp(op, "imul") == 0 && args->len == 3)) {
+        dst = DST_WRITE;
+    }
+    if (index == 0 && dst != DST_NONE) {
+        *read = dst == DST_UPDATE;
+        *write = true;
+    }
+}
+
+// uses holds everything the instruction may read, defs everything it may write.
+void instr_effects(instr_t *instr, regset_t *uses, regset_t *defs) {
+    *uses = 0;
+    *defs = 0;
+    switch (instr->kind) {
+        case INSTR_ASM:
+            instr_asm_effects(instr->instr_asm, uses, defs);
+            break;
+        case INSTR_CALL:
+            *uses = REGSET_GPR | REGSET_MEMORY;
+            *defs = call_defs();
+            break;
+        case INSTR_IF: {
+            regset_t then_uses, then_defs, else_uses, else_defs;
+            instr_list_t *then_instrs = instr->instr_if->then_instrs;
+            instr_list_t *else_instrs = instr->instr_if->else_instrs;
+            *uses = cond_regs(instr->instr_if->cond);
+            *defs = REGSET_FLAGS | instr_list_defs(then_instrs) | instr_list_defs(else_instrs);
+            for (int i = 0; i < then_instrs->len; i++) {
+                instr_effects(get_instr(then_instrs, i), &then_uses, &then_defs);
+                *uses |= then_uses;
+            }
+            for (int i = 0; i < else_instrs->len; i++) {
+                instr_effects(get_instr(else_instrs, i), &else_uses, &else_defs);
+                *uses |= else_uses;
+            }
+            break;
+        }
+        case INSTR_LOOP: {
+            instr_loop_t *loop = instr->instr_loop;
+            instr_list_t *body = loop->body;
+            *uses = loop->kind == LOOP_WHILE ? cond_regs(loop->cond) : expr_regs(loop->count);
+            *defs = REGSET_FLAGS | instr_list_defs(body);
+            if (loop->kind == LOOP_COUNTED) {
+                *defs |= expr_regs(loop->counter);
+                if (loop->count->kind == MEMORY) {
+                    *uses |= REGSET_MEMORY;
+                }
+            }
+            for (int i = 0; i < body->len; i++) {
+                regset_t body_uses, body_defs;
+                instr_effects(get_instr(body, i), &body_uses, &body_defs);
+                *uses |= body_uses;
+            }
+            break;
+        }
+        case INSTR_SWITCH: {
+            instr_switch_t *instr_switch = instr->instr_switch;
+            // The jump table is read from memory.
+            *uses = expr_regs(instr_switch->value) | REGSET_MEMORY;
+            *defs = REGSET_FLAGS;
+            for (int i = 0; i <= instr_switch->len; i++) {
+                instr_list_t *arm = i < instr_switch->len ? instr_switch->bodies[i] : instr_switch->default_instrs;
+                *defs |= instr_list_defs(arm);
+                for (int j = 0; j < arm->len; j++) {
+                    regset_t arm_uses, arm_defs;
+                    instr_effects(get_instr(arm, j), &arm_uses, &arm_defs);
+                    *uses |= arm_uses;
+                }
+            }
+            break;
+        }
+    }
+}
+
+regset_t instr_list_defs(instr_list_t *list) {
+    regset_t set = 0;
+    for (int i = 0; i < list->len; i++) {
+        regset_t uses, defs;
+        instr_effects(get_instr(list, i), &uses, &defs);
+        set |= defs;
+    }
+    return set;
+}
+
+// Every register named anywhere in the list, read or written.
+regset_t instr_list_regs(instr_list_t *list) {
+    regset_t set = 0;
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_ASM:
+                set |= expr_list_regs(instr->instr_asm->args);
+                break;
+            case INSTR_CALL:
+                set |= expr_list_regs(instr->instr_call->args);
+                break;
+            case INSTR_IF:
+                set |= cond_regs(instr->instr_if->cond);
+                set |= instr_list_regs(instr->instr_if->then_instrs);
+                set |= instr_list_regs(instr->instr_if->else_instrs);
+                break;
+            case INSTR_LOOP:
+                if (instr->instr_loop->kind == LOOP_WHILE) {
+                    set |= cond_regs(instr->instr_loop->cond);
+                } else {
+                    set |= expr_regs(instr->instr_loop->counter) | expr_regs(instr->instr_loop->count);
+                }
+                set |= instr_list_regs(instr->instr_loop->body);
+                break;
+            case INSTR_SWITCH:
+                set |= expr_regs(instr->instr_switch->value);
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    set |= instr_list_regs(instr->instr_switch->bodies[j]);
+                }
+                set |= instr_list_regs(instr->instr_switch->default_instrs);
+                break;
+        }
+    }
+    return set;
+}
+
+int count_instrs(instr_list_t *list) {
+    int count = 0;
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        count++;
+        if (instr->kind == INSTR_IF) {
+            count += count_instrs(instr->instr_if->then_instrs);
+            count += count_instrs(instr->instr_if->else_instrs);
+        } else if (instr->kind == INSTR_LOOP) {
+            count += count_instrs(instr->instr_loop->body);
+        } else if (instr->kind == INSTR_SWITCH) {
+            for (int j = 0; j < instr->instr_switch->len; j++) {
+                count += count_instrs(instr->instr_switch->bodies[j]);
+            }
+            count += count_instrs(instr->instr_switch->default_instrs);
+        }
+    }
+    return count;
+}
+
+// Data marked [volatile] may be read or written behind our back, by hardware or another thread: every
+// access to it has to happen as written.
+bool is_volatile_data(stmt_list_t *stmts, char *name) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_DATA && strcmp(stmt->data->name, name) == 0) {
+            return has_attribute(stmt->data->attributes, "volatile");
+        }
+    }
+    return false;
+}
+
+bool is_volatile_access(stmt_list_t *stmts, instr_t *instr) {
+    if (instr->kind != INSTR_ASM) {
+        return false;
+    }
+    for (int i = 0; i < instr->instr_asm->args->len; i++) {
+        expr_t *expr = get_expr(instr->instr_asm->args, i);
+        if (expr->kind == MEMORY && expr->memory.label != NULL && is_volatile_data(stmts, expr->memory.label)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether the attributes of a label or an extern put it under the C ABI.
+bool has_c_abi(attribute_list_t *attributes) {
+    int index = find_attribute(attributes, "abi");
+    return index != -1 && has_argument(get_attribute(attributes, index), "C") > 0;
+}
+
+static regset_t abi_clobbers(attribute_list_t *attributes) {
+    return has_c_abi(attributes) ? sysv_caller_saved() : REGSET_GPR & ~regset_of(RSP);
+}
+
+// The registers listed by an extern's [clobbers("rax", ...)], as written by --clobber-summary.
+static regset_t declared_clobbers(attribute_t *attribute) {
+    regset_t set = 0;
+    for (int i = 0; attribute->value != NULL && i < attribute->value->len; i++) {
+        int reg = find_register_kind_by_name(get_string(attribute->value, i));
+        if (reg == -1 || !(regset_of(reg) & REGSET_GPR)) {
+            error("clobbers(...) only lists general purpose registers", ERROR_INVALID);
+        }
+        set |= regset_of(reg);
+    }
+    return set;
+}
+
+// What a call to name overwrites: its summary for a summarized label, what an extern declares with
+// [clobbers(...)], and otherwise the caller-saved registers under the C ABI, every register but rsp else.
+regset_t call_clobbers(stmt_list_t *stmts, char *name) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && strcmp(stmt->label->name, name) == 0) {
+            return stmt->label->summarized ? stmt->label->clobbers : abi_clobbers(stmt->label->attributes);
+        }
+        if (stmt->kind == STMT_EXTERN && strcmp(stmt->extern_->name, name) == 0) {
+            int index = find_attribute(stmt->extern_->attributes, "clobbers");
+            if (index != -1) {
+                return declared_clobbers(get_attribute(stmt->extern_->attributes, index));
+            }
+            return abi_clobbers(stmt->extern_->attributes);
+        }
+    }
+    return REGSET_GPR & ~regset_of(RSP);
+}
+
+// The registers a call instruction loads the first argc arguments of name into.
+static regset_t call_arg_regs(stmt_list_t *stmts, char *name, int argc) {
+    call_abi_t *abi = NULL;
+    for (int i = 0; i < stmts->len && abi == NULL; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && strcmp(stmt->label->name, name) == 0) {
+            abi = resolve_call_abi(stmt->label->abi, stmt->label->attributes);
+        } else if (stmt->kind == STMT_EXTERN && strcmp(stmt->extern_->name, name) == 0) {
+            abi = resolve_call_abi(stmt->extern_->abi, stmt->extern_->attributes);
+        }
+    }
+    regset_t set = 0;
+    for (int i = 0; abi != NULL && i < abi->args->len && i < argc; i++) {
+        argument_t *arg = get_argument(abi->args, i);
+        if (arg->kind != ARGUMENT_REGISTER) {
+            break;
+        }
+        set |= regset_of(arg->reg);
+    }
+    return set;
+}
+
+regset_t instr_clobbers(stmt_list_t *stmts, instr_t *instr) {
+    if (instr->kind == INSTR_CALL) {
+        instr_call_t *call = instr->instr_call;
+        return call_clobbers(stmts, call->callee) | call_arg_regs(stmts, call->callee, call->args->len);
+    }
+    if (instr->kind != INSTR_ASM) {
+        return 0;
+    }
+    instr_asm_t *instr_asm = instr->instr_asm;
+    if (strcmp(instr_asm->name, "call") == 0) {
+        expr_t *target = instr_asm->args->len == 1 ? get_expr(instr_asm->args, 0) : NULL;
+        if (target != NULL && target->kind == LABEL) {
+            return call_clobbers(stmts, target->label);
+        }
+        return REGSET_GPR & ~regset_of(RSP);
+    }
+    if (strcmp(instr_asm->name, "syscall") == 0) {
+        return regset_of(RAX) | regset_of(RCX) | regset_of(R11);
+    }
+    return 0;
+}
+
+// Every register the list may write. Unlike instr_list_defs, calls only count for what their callee overwrites.
+regset_t instr_list_writes(stmt_list_t *stmts, instr_list_t *list) {
+    regset_t set = 0;
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_ASM: {
+                regset_t clobbers = instr_clobbers(stmts, instr);
+                if (clobbers != 0 || strcmp(instr->instr_asm->name, "call") == 0) {
+                    set |= clobbers | REGSET_FLAGS | REGSET_MEMORY;
+                    break;
+                }
+                regset_t uses, defs;
+                instr_effects(instr, &uses, &defs);
+                set |= defs;
+                break;
+            }
+            case INSTR_CALL:
+                set |= instr_clobbers(stmts, instr) | REGSET_FLAGS | REGSET_MEMORY;
+                break;
+            case INSTR_IF:
+                set |= REGSET_FLAGS | instr_list_writes(stmts, instr->instr_if->then_instrs)
+                       | instr_list_writes(stmts, instr->instr_if->else_instrs);
+                break;
+            case INSTR_LOOP:
+                set |= REGSET_FLAGS | instr_list_writes(stmts, instr->instr_loop->body);
+                if (instr->instr_loop->kind == LOOP_COUNTED) {
+                    set |= expr_regs(instr->instr_loop->counter);
+                }
+                break;
+            case INSTR_SWITCH:
+                set |= REGSET_FLAGS | instr_list_writes(stmts, instr->instr_switch->default_instrs);
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    set |= instr_list_writes(stmts, instr->instr_switch->bodies[j]);
+                }
+                break;
+        }
+    }
+    return set;
+}
+
+// What is live when a label returns: the C ABI returns in rax/rdx and preserves the callee-saved registers,
+// any other ABI is unknown so everything is assumed live.
+regset_t label_live_out(label_t *label) {
+    if (has_c_abi(label->attributes)) {
+        return regset_of(RAX) | regset_of(RDX) | sysv_callee_saved() | REGSET_MEMORY;
+    }
+    return REGSET_ALL;
+}
+
+typedef struct {
+    instr_t *target;
+    regset_t result;
+    regset_t ret_live;
+} liveness_t;
+
+static regset_t live_in_list(liveness_t *ctx, instr_list_t *list, regset_t live);
+
+// Live sets only grow while iterating, so the loop reaches a fixed point after at most one pass per register.
+static regset_t live_in_loop(liveness_t *ctx, instr_loop_t *loop, regset_t live) {
+    if (loop->kind == LOOP_WHILE) {
+        // The entry jumps to the test at the bottom, which either leaves or goes back to the body.
+        regset_t test = (live & ~REGSET_FLAGS) | cond_regs(loop->cond);
+        for (;;) {
+            regset_t body = live_in_list(ctx, loop->body, test);
+            regset_t next = test | (body & ~REGSET_FLAGS);
+            if (next == test) {
+                return test;
+            }
+            test = next;
+        }
+    }
+    // mov counter, count / test / jz exit / head: body / dec counter / jnz head
+    regset_t counter = expr_regs(loop->counter);
+    regset_t head = 0;
+    for (;;) {
+        regset_t before_dec = ((live | head) & ~REGSET_FLAGS) | counter;
+        regset_t next = live_in_list(ctx, loop->body, before_dec);
+        if (next == head) {
+            break;
+        }
+        head = next;
+    }
+    regset_t after_mov = ((head | live) & ~REGSET_FLAGS) | counter;
+    regset_t uses = expr_regs(loop->count) | (loop->count->kind == MEMORY ? REGSET_MEMORY : 0);
+    return expr_equal(loop->counter, loop->count) ? after_mov : (after_mov & ~counter) | uses;
+}
+
+static regset_t live_in_instr(liveness_t *ctx, instr_t *instr, regset_t live) {
+    if (instr->kind == INSTR_LOOP) {
+        return live_in_loop(ctx, instr->instr_loop, live);
+    }
+    if (instr->kind == INSTR_IF) {
+        regset_t then_live = live_in_list(ctx, instr->instr_if->then_instrs, live);
+        regset_t else_live = live_in_list(ctx, instr->instr_if->else_instrs, live);
+        return ((then_live | else_live) & ~REGSET_FLAGS) | cond_regs(instr->instr_if->cond);
+    }
+    if (instr->kind == INSTR_SWITCH) {
+        instr_switch_t *instr_switch = instr->instr_switch;
+        regset_t arms = live_in_list(ctx, instr_switch->default_instrs, live);
+        for (int i = 0; i < instr_switch->len; i++) {
+            arms |= live_in_list(ctx, instr_switch->bodies[i], live);
+        }
+        return (arms & ~REGSET_FLAGS) | expr_regs(instr_switch->value) | REGSET_MEMORY;
+    }
+    if (instr->kind == INSTR_ASM) {
+        char *op = instr->instr_asm->name;
+        if (strcmp(op, "ret") == 0) {
+            return ctx->ret_live;
+        }
+        if (op[0] == 'j') {
+            // The target is another label, what it needs is unknown.
+            return REGSET_ALL;
+        }
+    }
+    regset_t uses, defs;
+    instr_effects(instr, &uses, &defs);
+    return (live & ~(defs & ~REGSET_MEMORY)) | uses;
+}
+
+static regset_t live_in_list(liveness_t *ctx, instr_list_t *list, regset_t live) {
+    for (int i = list->len - 1; i >= 0; i--) {
+        instr_t *instr = get_instr(list, i);
+        if (instr == ctx->target) {
+            ctx->result = live;
+        }
+        live = live_in_instr(ctx, instr, live);
+    }
+    return live;
+}
+
+// The registers live right after target, which must be an instruction somewhere inside body.
+// live_out is what is live when body returns; falling off the end of body leads to unknown code.
+regset_t live_after(instr_list_t *body, instr_t *target, regset_t live_out) {
+    liveness_t ctx = {.target = target, .result = REGSET_ALL, .ret_live = live_out};
+    live_in_list(&ctx, body, REGSET_ALL);
+    return ctx.result;
+}
@@ -0,0 +1,41 @@
+#ifndef ASMPP_ANALYSIS_H
+#define ASMPP_ANALYSIS_H
+
+#include <stdint.h>
+#include "ast.h"
+
+// One bit per register family (RAX..R15 in register_kind_t order), plus the flags and memory.
+typedef uint32_t regset_t;
+
+#define REGSET_FLAGS (1u << 17)
+#define REGSET_MEMORY (1u << 18)
+#define REGSET_GPR 0xffffu
+#define REGSET_ALL (REGSET_GPR | REGSET_FLAGS | REGSET_MEMORY)
+
+regset_t regset_of(register_kind_t reg);
+regset_t sysv_caller_saved();
+regset_t sysv_callee_saved();
+int regset_count(regset_t set);
+regset_t expr_regs(expr_t *expr);
+regset_t expr_list_regs(expr_list_t *list);
+regset_t cond_regs(cond_t *cond);
+
+bool is_known_instr(instr_asm_t *instr);
+bool is_flags_reader(char *op);
+void instr_effects(instr_t *instr, regset_t *uses, regset_t *defs);
+void operand_access(instr_asm_t *instr, int index, bool *read, bool *write);
+regset_t instr_list_defs(instr_list_t *list);
+regset_t instr_list_regs(instr_list_t *list);
+int count_instrs(instr_list_t *list);
+bool is_volatile_data(stmt_list_t *stmts, char *name);
+bool is_volatile_access(stmt_list_t *stmts, instr_t *instr);
+
+bool has_c_abi(attribute_list_t *attributes);
+regset_t call_clobbers(stmt_list_t *stmts, char *name);
+regset_t instr_clobbers(stmt_list_t *stmts, instr_t *instr);
+regset_t instr_list_writes(stmt_list_t *stmts, instr_list_t *list);
+
+regset_t label_live_out(label_t *label);
+regset_t live_after(instr_list_t *body, instr_t *target, regset_t live_out);
+
+#endif //ASMPP_ANALYSIS_H
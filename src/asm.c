@@ -281,6 +281,21 @@ int section_text_add_instruction(asm_section_text_t *section, asm_instruction_t
     return 0;
 }
 
+// Inserts instruction right before the definition of label.
+int section_text_insert_label_before(asm_section_text_t *section, char *label, asm_instruction_t *instruction) {
+    int index = 0;
+    while (index < section->size && !(section->instructions[index].type == ASM_LABEL
+                                       && strcmp(section->instructions[index].args[0], label) == 0)) {
+        index++;
+    }
+    if (index == section->size || section_text_add_instruction(section, instruction) != 0) {
+        return -1;
+    }
+    memmove(section->instructions + index + 1, section->instructions + index, sizeof(asm_instruction_t) * (section->size - 1 - index));
+    section->instructions[index] = *instruction;
+    return 0;
+}
+
 void section_text_free(asm_section_text_t *section) {
     free(section->instructions);
     free(section);
@@ -289,10 +304,14 @@ void section_text_free(asm_section_text_t *section) {
 asm_t *asm_new() {
     asm_t *asm_ = malloc(sizeof(asm_t));
     asm_->text = section_text_new();
+    asm_->text_hot = section_text_new();
+    asm_->text_unlikely = section_text_new();
     asm_->data = section_data_new();
+    asm_->rodata = section_data_new();
+    asm_->fini_array = section_data_new();
     asm_->bss = section_bss_new();
 
-    if (asm_->text == NULL || asm_->data == NULL || asm_->bss == NULL) {
+    if (asm_->text == NULL || asm_->text_hot == NULL || asm_->text_unlikely == NULL || asm_->data == NULL || asm_->rodata == NULL || asm_->fini_array == NULL || asm_->bss == NULL) {
         free(asm_);
         return NULL;
     }
@@ -359,15 +378,8 @@ int asm_compile(asm_t* asm_, config_t* config, char* output_name) {
     return 0;
 }
 
-char* asm_emit(asm_t* asm_) {
-    asm_section_data_t *data = asm_->data;
-    asm_section_text_t *text = asm_->text;
-    asm_section_bss_t *bss = asm_->bss;
-    string_buffer_t *buffer = new_string_buffer();
-    if (buffer == NULL) {
-        return NULL;
-    }
-    string_buffer_writeln(buffer, "section .data");
+static void emit_data_section(string_buffer_t *buffer, char *name, asm_section_data_t *data) {
+    string_buffer_writeln(buffer, name);
     string_buffer_add_tab(buffer, 1);
 
     for (int i = 0; i < data->size; i++) {
@@ -385,17 +397,26 @@ char* asm_emit(asm_t* asm_) {
     }
 
     string_buffer_remove_tab(buffer, 1);
-    string_buffer_writeln(buffer, "section .bss");
-    string_buffer_add_tab(buffer, 1);
+}
 
-    for (int i = 0; i < bss->size; i++) {
-        asm_bss_t *bss_ = &bss->bss[i];
-        string_buffer_printf_tabbed(buffer, "%s %s\n", bss_->name, bss_size_to_string(bss_->size));
+static void emit_instruction(string_buffer_t *buffer, asm_instruction_t *instr, int tabbed) {
+    if (tabbed) {
+        string_buffer_printf_tabbed(buffer, "%s", instr->args[0]);
+    } else {
+        string_buffer_printf(buffer, "%s", instr->args[0]);
+    }
+    for (int k = 1; k < instr->arg_size; k++) {
+        if (k == 1) {
+            string_buffer_printf(buffer, " %s", instr->args[k]);
+        } else {
+            string_buffer_printf(buffer, ", %s", instr->args[k]);
+        }
     }
+    string_buffer_write(buffer, "\n");
+}
 
-    string_buffer_remove_tab(buffer, 1);
-    string_buffer_writeln(buffer, "section .text");
-
+static void emit_text_section(string_buffer_t *buffer, char *name, asm_section_text_t *text) {
+    string_buffer_printf(buffer, "section %s\n", name);
     for (int i = 0; i < text->size; i++) {
         asm_instruction_t *instruction = &text->instructions[i];
         switch (instruction->type) {
@@ -404,31 +425,51 @@ char* asm_emit(asm_t* asm_) {
                 string_buffer_add_tab(buffer, 1);
                 for (int j = 0; j < instruction->instr_size; j++) {
                     asm_instruction_t *instr = &instruction->list[j];
-                    string_buffer_printf_tabbed(buffer, "%s", instr->args[0]);
-                    for (int k = 1; k < instr->arg_size; k++) {
-                        if (k == 1) {
-                            string_buffer_printf(buffer, " %s", instr->args[k]);
-                        } else {
-                            string_buffer_printf(buffer, ", %s", instr->args[k]);
-                        }
+                    if (instr->type == ASM_LABEL) {
+                        string_buffer_printf(buffer, "%s:\n", instr->args[0]);
+                        continue;
                     }
-                    string_buffer_write(buffer, "\n");
+                    emit_instruction(buffer, instr, 1);
                 }
                 string_buffer_remove_tab(buffer, 1);
                 break;
             case ASM_INSTR:
-                string_buffer_printf(buffer, "%s", instruction->args[0]);
-                for (int j = 1; j < instruction->arg_size; j++) {
-                    if (j == 1) {
-                        string_buffer_printf(buffer, " %s", instruction->args[j]);
-                    } else {
-                        string_buffer_printf(buffer, ", %s", instruction->args[j]);
-                    }
-                }
-                string_buffer_printf(buffer, "\n");
+                emit_instruction(buffer, instruction, 0);
                 break;
         }
     }
+}
+
+char* asm_emit(asm_t* asm_) {
+    asm_section_text_t *text = asm_->text;
+    asm_section_bss_t *bss = asm_->bss;
+    string_buffer_t *buffer = new_string_buffer();
+    if (buffer == NULL) {
+        return NULL;
+    }
+    emit_data_section(buffer, "section .data", asm_->data);
+    if (asm_->rodata->size > 0) {
+        emit_data_section(buffer, "section .rodata", asm_->rodata);
+    }
+    if (asm_->fini_array->size > 0) {
+        emit_data_section(buffer, FINI_ARRAY_SECTION, asm_->fini_array);
+    }
+    string_buffer_writeln(buffer, "section .bss");
+    string_buffer_add_tab(buffer, 1);
+
+    for (int i = 0; i < bss->size; i++) {
+        asm_bss_t *bss_ = &bss->bss[i];
+        string_buffer_printf_tabbed(buffer, "%s %s\n", bss_->name, bss_size_to_string(bss_->size));
+    }
+
+    string_buffer_remove_tab(buffer, 1);
+    emit_text_section(buffer, TEXT_SECTION, text);
+    if (asm_->text_hot->size > 0) {
+        emit_text_section(buffer, TEXT_HOT_SECTION, asm_->text_hot);
+    }
+    if (asm_->text_unlikely->size > 0) {
+        emit_text_section(buffer, TEXT_UNLIKELY_SECTION, asm_->text_unlikely);
+    }
 
     return buffer->data;
 }
@@ -91,9 +91,19 @@ struct asm_section_bss_t {
     int capacity;
 };
 
+// Sections other than .text default to non-executable with NASM, their attributes must be spelled out.
+#define TEXT_SECTION ".text"
+#define TEXT_HOT_SECTION ".text.hot progbits alloc exec nowrite align=16"
+#define TEXT_UNLIKELY_SECTION ".text.unlikely progbits alloc exec nowrite align=16"
+#define FINI_ARRAY_SECTION "section .fini_array progbits alloc noexec write align=8"
+
 typedef struct {
     asm_section_text_t* text;
+    asm_section_text_t* text_hot;
+    asm_section_text_t* text_unlikely;
     asm_section_data_t* data;
+    asm_section_data_t* rodata;
+    asm_section_data_t* fini_array;
     asm_section_bss_t* bss;
 } asm_t;
 
@@ -123,6 +133,7 @@ void instruction_free(asm_instruction_t* instruction);
 
 asm_section_text_t* section_text_new();
 int section_text_add_instruction(asm_section_text_t* text, asm_instruction_t* instruction);
+int section_text_insert_label_before(asm_section_text_t* text, char* label, asm_instruction_t* instruction);
 void section_text_free(asm_section_text_t* text);
 
 asm_section_t* section_new(asm_section_type_t type);
@@ -283,6 +283,7 @@ data_t* new_data(char* name, type_t* type, expr_list_t* value) {
     data->name = name;
     data->type = type;
     data->values = value;
+    data->attributes = new_attribute_list();
     return data;
 }
 
@@ -294,6 +295,7 @@ data_t* new_data_uninitialized(char* name, type_t* type) {
     data->name = name;
     data->type = type;
     data->values = NULL;
+    data->attributes = new_attribute_list();
     return data;
 }
 
@@ -303,6 +305,7 @@ void free_data(data_t* data) {
     if (data->values != NULL) {
         free_expr_list(data->values);
     }
+    free_attribute_list(data->attributes);
     free(data);
 }
 
@@ -332,6 +335,10 @@ label_t *new_label(char *name, call_abi_t *abi, instr_list_t *instrs, attribute_
     label->abi = abi;
     label->instrs = instrs;
     label->attributes = attributes;
+    label->vars = new_var_list();
+    label->locals = new_local_list();
+    label->clobbers = 0;
+    label->summarized = false;
     return label;
 }
 
@@ -339,9 +346,124 @@ void free_label(label_t *label) {
     free(label->name);
     free_instr_list(label->instrs);
     free_call_abi(label->abi);
+    free_var_list(label->vars);
+    free_local_list(label->locals);
     free(label);
 }
 
+var_t *new_var(char *name, int width) {
+    var_t *var = malloc(sizeof(var_t));
+    if (var == NULL) {
+        error("Failed to allocate memory for var", ERROR_ALLOC);
+    }
+    var->name = name;
+    var->width = width;
+    return var;
+}
+
+var_list_t *new_var_list() {
+    var_list_t *list = malloc(sizeof(var_list_t));
+    if (list == NULL) {
+        error("Failed to allocate memory for var list", ERROR_ALLOC);
+    }
+    list->len = 0;
+    list->capacity = 4;
+    list->vars = malloc(sizeof(var_t) * list->capacity);
+    if (list->vars == NULL) {
+        error("Failed to allocate memory for var list", ERROR_ALLOC);
+    }
+    return list;
+}
+
+void append_var(var_list_t *list, var_t *var) {
+    if (list->len == list->capacity) {
+        list->capacity *= 2;
+        list->vars = realloc(list->vars, sizeof(var_t) * list->capacity);
+        if (list->vars == NULL) {
+            error("Failed to reallocate memory for var list", ERROR_ALLOC);
+        }
+    }
+    list->vars[list->len++] = *var;
+}
+
+var_t *get_var(var_list_t *list, int index) {
+    if (index < 0 || index >= list->len) {
+        error("Index out of bounds", ERROR_INVALID);
+    }
+    return &list->vars[index];
+}
+
+int find_var(var_list_t *list, const char *name) {
+    for (int i = 0; i < list->len; i++) {
+        if (strcmp(list->vars[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void free_var_list(var_list_t *list) {
+    free(list->vars);
+    free(list);
+}
+
+local_t *new_local(char *name, int size, int align) {
+    local_t *local = malloc(sizeof(local_t));
+    if (local == NULL) {
+        error("Failed to allocate memory for local", ERROR_ALLOC);
+    }
+    local->name = name;
+    local->size = size;
+    local->align = align;
+    return local;
+}
+
+local_list_t *new_local_list() {
+    local_list_t *list = malloc(sizeof(local_list_t));
+    if (list == NULL) {
+        error("Failed to allocate memory for local list", ERROR_ALLOC);
+    }
+    list->len = 0;
+    list->capacity = 4;
+    list->locals = malloc(sizeof(local_t) * list->capacity);
+    if (list->locals == NULL) {
+        error("Failed to allocate memory for local list", ERROR_ALLOC);
+    }
+    return list;
+}
+
+void append_local(local_list_t *list, local_t *local) {
+    if (list->len == list->capacity) {
+        list->capacity *= 2;
+        list->locals = realloc(list->locals, sizeof(local_t) * list->capacity);
+        if (list->locals == NULL) {
+            error("Failed to reallocate memory for local list", ERROR_ALLOC);
+        }
+    }
+    list->locals[list->len++] = *local;
+}
+
+local_t *get_local(local_list_t *list, int index) {
+    if (index < 0 || index >= list->len) {
+        error("Index out of bounds", ERROR_INVALID);
+    }
+    return &list->locals[index];
+}
+
+int find_local(local_list_t *list, const char *name) {
+    for (int i = 0; i < list->len; i++) {
+        if (strcmp(list->locals[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void free_local_list(local_list_t *list) {
+    free(list->locals);
+    free(list);
+}
+
 instr_list_t * new_instr_list() {
     instr_list_t *list = malloc(sizeof(instr_list_t));
     if (list == NULL) {
@@ -384,6 +506,14 @@ instr_list_t** split_instr_list(instr_list_t *list, int index) {
     return lists;
 }
 
+instr_list_t* copy_instr_list(instr_list_t *list) {
+    instr_list_t *copy = new_instr_list();
+    for (int i = 0; i < list->len; i++) {
+        append_instr(copy, copy_instr(&list->instrs[i]));
+    }
+    return copy;
+}
+
 instr_t *get_instr(instr_list_t *list, int index) {
     if (index < 0 || index >= list->len) {
         error("Index out of bounds", ERROR_INVALID);
@@ -409,6 +539,26 @@ instr_t *new_if_instr(instr_if_t *instr_if) {
     return instr;
 }
 
+instr_t *new_loop_instr(instr_loop_t *instr_loop) {
+    instr_t *instr = malloc(sizeof(instr_t));
+    if (instr == NULL) {
+        error("Failed to allocate memory for loop instruction", ERROR_ALLOC);
+    }
+    instr->kind = INSTR_LOOP;
+    instr->instr_loop = instr_loop;
+    return instr;
+}
+
+instr_t *new_switch_instr(instr_switch_t *instr_switch) {
+    instr_t *instr = malloc(sizeof(instr_t));
+    if (instr == NULL) {
+        error("Failed to allocate memory for switch instruction", ERROR_ALLOC);
+    }
+    instr->kind = INSTR_SWITCH;
+    instr->instr_switch = instr_switch;
+    return instr;
+}
+
 instr_t *new_asm_instr(instr_asm_t *asm_instr) {
     instr_t *instr = malloc(sizeof(instr_t));
     if (instr == NULL) {
@@ -429,9 +579,62 @@ instr_t *new_call_instr(instr_call_t *instr_call) {
     return instr;
 }
 
+instr_t* copy_instr(instr_t *instr) {
+    switch (instr->kind) {
+        case INSTR_IF: {
+            instr_if_t *instr_if = instr->instr_if;
+            instr_if_t *copy = new_instr_if(copy_cond(instr_if->cond), copy_instr_list(instr_if->then_instrs),
+                                            copy_instr_list(instr_if->else_instrs), instr_if->attributes);
+            copy->else_attributes = instr_if->else_attributes;
+            copy->profile_label = instr_if->profile_label;
+            copy->profile_block = instr_if->profile_block;
+            return new_if_instr(copy);
+        }
+        case INSTR_LOOP: {
+            instr_loop_t *loop = instr->instr_loop;
+            if (loop->kind == LOOP_WHILE) {
+                return new_loop_instr(new_instr_while(copy_cond(loop->cond), copy_instr_list(loop->body), loop->attributes));
+            }
+            return new_loop_instr(new_instr_counted_loop(copy_expr(loop->counter), copy_expr(loop->count),
+                                                         copy_instr_list(loop->body), loop->attributes));
+        }
+        case INSTR_SWITCH: {
+            instr_switch_t *instr_switch = instr->instr_switch;
+            instr_switch_t *copy = new_instr_switch(copy_expr(instr_switch->value), instr_switch->attributes);
+            for (int i = 0; i < instr_switch->len; i++) {
+                append_case(copy, instr_switch->cases[i], copy_instr_list(instr_switch->bodies[i]));
+            }
+            copy->default_instrs = copy_instr_list(instr_switch->default_instrs);
+            return new_switch_instr(copy);
+        }
+        case INSTR_ASM:
+            return new_asm_instr(new_instr_asm(instr->instr_asm->name, copy_expr_list(instr->instr_asm->args)));
+        case INSTR_CALL: {
+            instr_call_t *call = new_instr_call(instr->instr_call->callee, copy_expr_list(instr->instr_call->args));
+            call->tail = instr->instr_call->tail;
+            return new_call_instr(call);
+        }
+    }
+    return NULL;
+}
+
+bool is_terminator(instr_t *instr) {
+    if (instr->kind == INSTR_CALL) {
+        return instr->instr_call->tail;
+    }
+    if (instr->kind != INSTR_ASM) {
+        return false;
+    }
+    return strcmp(instr->instr_asm->name, "jmp") == 0 || strcmp(instr->instr_asm->name, "ret") == 0;
+}
+
 void free_instr(instr_t *instr) {
     if (instr->kind == INSTR_IF) {
         free_instr_if(instr->instr_if);
+    } else if (instr->kind == INSTR_LOOP) {
+        free_instr_loop(instr->instr_loop);
+    } else if (instr->kind == INSTR_SWITCH) {
+        free_instr_switch(instr->instr_switch);
     } else {
         free_instr_asm(instr->instr_asm);
     }
@@ -445,6 +648,7 @@ instr_call_t *new_instr_call(char *callee, expr_list_t *args) {
     }
     instr->callee = callee;
     instr->args = args;
+    instr->tail = false;
     return instr;
 }
 
@@ -476,30 +680,198 @@ cmp_kind_t get_cmp_kind_by_name(const char *name) {
         return GT;
     } else if (strcmp(name, "ge") == 0) {
         return GE;
+    } else if (strcmp(name, "ult") == 0) {
+        return ULT;
+    } else if (strcmp(name, "ule") == 0) {
+        return ULE;
+    } else if (strcmp(name, "ugt") == 0) {
+        return UGT;
+    } else if (strcmp(name, "uge") == 0) {
+        return UGE;
     } else {
         error("Invalid comparison kind", ERROR_INVALID);
     }
 }
 
-instr_if_t* new_instr_if(expr_list_t* condition, cmp_kind_t cmp, instr_list_t* then_instrs, instr_list_t* else_instrs) {
+cmp_kind_t invert_cmp_kind(cmp_kind_t kind) {
+    switch (kind) {
+        case EQ:
+            return NE;
+        case NE:
+            return EQ;
+        case LT:
+            return GE;
+        case LE:
+            return GT;
+        case GT:
+            return LE;
+        case GE:
+            return LT;
+        case ULT:
+            return UGE;
+        case ULE:
+            return UGT;
+        case UGT:
+            return ULE;
+        case UGE:
+            return ULT;
+    }
+    error("Invalid comparison kind", ERROR_INVALID);
+    return kind;
+}
+
+cond_t* new_cond_cmp(cmp_kind_t cmp, expr_list_t* operands) {
+    cond_t *cond = malloc(sizeof(cond_t));
+    if (cond == NULL) {
+        error("Failed to allocate memory for condition", ERROR_ALLOC);
+    }
+    cond->kind = COND_CMP;
+    cond->cmp = cmp;
+    cond->operands = operands;
+    cond->lhs = NULL;
+    cond->rhs = NULL;
+    return cond;
+}
+
+cond_t* new_cond_logical(cond_kind_t kind, cond_t* lhs, cond_t* rhs) {
+    cond_t *cond = malloc(sizeof(cond_t));
+    if (cond == NULL) {
+        error("Failed to allocate memory for condition", ERROR_ALLOC);
+    }
+    cond->kind = kind;
+    cond->operands = NULL;
+    cond->lhs = lhs;
+    cond->rhs = rhs;
+    return cond;
+}
+
+cond_t* copy_cond(cond_t* cond) {
+    if (cond->kind == COND_CMP) {
+        return new_cond_cmp(cond->cmp, copy_expr_list(cond->operands));
+    }
+    return new_cond_logical(cond->kind, copy_cond(cond->lhs), cond->rhs != NULL ? copy_cond(cond->rhs) : NULL);
+}
+
+void free_cond(cond_t* cond) {
+    if (cond->kind == COND_CMP) {
+        free_expr_list(cond->operands);
+    } else {
+        free_cond(cond->lhs);
+        if (cond->rhs != NULL) {
+            free_cond(cond->rhs);
+        }
+    }
+    free(cond);
+}
+
+instr_if_t* new_instr_if(cond_t* cond, instr_list_t* then_instrs, instr_list_t* else_instrs, attribute_list_t* attributes) {
     instr_if_t *instr_if = malloc(sizeof(instr_if_t));
     if (instr_if == NULL) {
         error("Failed to allocate memory for if instruction", ERROR_ALLOC);
     }
-    instr_if->condition = condition;
-    instr_if->cmp = cmp;
+    instr_if->cond = cond;
     instr_if->then_instrs = then_instrs;
     instr_if->else_instrs = else_instrs;
+    instr_if->attributes = attributes;
+    instr_if->else_attributes = new_attribute_list();
+    instr_if->profile_label = NULL;
+    instr_if->profile_block = -1;
     return instr_if;
 }
 
 void free_instr_if(instr_if_t *instr_if) {
-    free_expr_list(instr_if->condition);
+    free_cond(instr_if->cond);
     free_instr_list(instr_if->then_instrs);
     free_instr_list(instr_if->else_instrs);
+    free_attribute_list(instr_if->attributes);
+    free_attribute_list(instr_if->else_attributes);
     free(instr_if);
 }
 
+static instr_loop_t *new_instr_loop(loop_kind_t kind, instr_list_t *body, attribute_list_t *attributes) {
+    instr_loop_t *instr_loop = malloc(sizeof(instr_loop_t));
+    if (instr_loop == NULL) {
+        error("Failed to allocate memory for loop instruction", ERROR_ALLOC);
+    }
+    instr_loop->kind = kind;
+    instr_loop->cond = NULL;
+    instr_loop->counter = NULL;
+    instr_loop->count = NULL;
+    instr_loop->body = body;
+    instr_loop->attributes = attributes;
+    return instr_loop;
+}
+
+instr_loop_t *new_instr_while(cond_t *cond, instr_list_t *body, attribute_list_t *attributes) {
+    instr_loop_t *instr_loop = new_instr_loop(LOOP_WHILE, body, attributes);
+    instr_loop->cond = cond;
+    return instr_loop;
+}
+
+instr_loop_t *new_instr_counted_loop(expr_t *counter, expr_t *count, instr_list_t *body, attribute_list_t *attributes) {
+    instr_loop_t *instr_loop = new_instr_loop(LOOP_COUNTED, body, attributes);
+    instr_loop->counter = counter;
+    instr_loop->count = count;
+    return instr_loop;
+}
+
+void free_instr_loop(instr_loop_t *instr_loop) {
+    if (instr_loop->cond != NULL) {
+        free_cond(instr_loop->cond);
+    }
+    if (instr_loop->counter != NULL) {
+        free_expr(instr_loop->counter);
+        free_expr(instr_loop->count);
+    }
+    free_instr_list(instr_loop->body);
+    free_attribute_list(instr_loop->attributes);
+    free(instr_loop);
+}
+
+instr_switch_t *new_instr_switch(expr_t *value, attribute_list_t *attributes) {
+    instr_switch_t *instr_switch = malloc(sizeof(instr_switch_t));
+    if (instr_switch == NULL) {
+        error("Failed to allocate memory for switch instruction", ERROR_ALLOC);
+    }
+    instr_switch->value = value;
+    instr_switch->len = 0;
+    instr_switch->capacity = 4;
+    instr_switch->cases = malloc(sizeof(int64_t) * instr_switch->capacity);
+    instr_switch->bodies = malloc(sizeof(instr_list_t *) * instr_switch->capacity);
+    if (instr_switch->cases == NULL || instr_switch->bodies == NULL) {
+        error("Failed to allocate memory for switch cases", ERROR_ALLOC);
+    }
+    instr_switch->default_instrs = new_instr_list();
+    instr_switch->attributes = attributes;
+    return instr_switch;
+}
+
+void append_case(instr_switch_t *instr_switch, int64_t value, instr_list_t *body) {
+    if (instr_switch->len >= instr_switch->capacity) {
+        instr_switch->capacity *= 2;
+        instr_switch->cases = realloc(instr_switch->cases, sizeof(int64_t) * instr_switch->capacity);
+        instr_switch->bodies = realloc(instr_switch->bodies, sizeof(instr_list_t *) * instr_switch->capacity);
+        if (instr_switch->cases == NULL || instr_switch->bodies == NULL) {
+            error("Failed to reallocate memory for switch cases", ERROR_ALLOC);
+        }
+    }
+    instr_switch->cases[instr_switch->len] = value;
+    instr_switch->bodies[instr_switch->len] = body;
+    instr_switch->len++;
+}
+
+void free_instr_switch(instr_switch_t *instr_switch) {
+    free_expr(instr_switch->value);
+    for (int i = 0; i < instr_switch->len; i++) {
+        free_instr_list(instr_switch->bodies[i]);
+    }
+    free(instr_switch->cases);
+    free(instr_switch->bodies);
+    free_instr_list(instr_switch->default_instrs);
+    free_attribute_list(instr_switch->attributes);
+    free(instr_switch);
+}
+
 void free_instr_asm(instr_asm_t *instr) {
     free_expr_list(instr->args);
     free(instr);
@@ -551,21 +923,26 @@ int find(char** element, int len, char *elem) {
     return -1;
 }
 
-char** registers = (char*[]) {
+char* registers[] = {
         "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rip",
         "eax", "ebx", "ecx", "edx", "esi", "edi", "ebp", "esp", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d", "eip",
         "ax", "bx", "cx", "dx", "si", "di", "bp", "sp", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w", "ip",
-        "al", "bl", "cl", "dl", "sil", "dil", "bpl", "spl", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"
+        "al", "bl", "cl", "dl", "sil", "dil", "bpl", "spl", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+        "ah", "bh", "ch", "dh"
 };
 
 register_kind_t get_register_kind_by_name(char *str) {
-    int index = find(registers, 67, str);
+    int index = find(registers, sizeof(registers) / sizeof(registers[0]), str);
     if (index == -1) {
         error("Invalid register", ERROR_INVALID);
     }
     return index;
 }
 
+int find_register_kind_by_name(char *str) {
+    return find(registers, sizeof(registers) / sizeof(registers[0]), str);
+}
+
 char* register_kind_to_string(register_kind_t kind) {
     return registers[kind];
 }
@@ -586,6 +963,48 @@ bool is_8_bit(register_kind_t register_) {
     return register_ >= AL;
 }
 
+bool is_virtual_register(register_kind_t register_) {
+    return register_ >= VIRTUAL_REGISTER;
+}
+
+int register_width(register_kind_t register_) {
+    if (is_64_bit(register_)) {
+        return 64;
+    } else if (is_32_bit(register_)) {
+        return 32;
+    } else if (is_16_bit(register_)) {
+        return 16;
+    }
+    return 8;
+}
+
+// Every width group follows the order of the 64-bit registers, so the family is the offset in the group.
+register_kind_t register_family(register_kind_t register_) {
+    if (is_64_bit(register_)) {
+        return register_;
+    } else if (is_32_bit(register_)) {
+        return register_ - EAX;
+    } else if (is_16_bit(register_)) {
+        return register_ - AX;
+    } else if (register_ >= AH) {
+        return register_ - AH;
+    }
+    return register_ - AL;
+}
+
+register_kind_t register_with_width(register_kind_t family, int bits) {
+    switch (bits) {
+        case 32:
+            return EAX + family;
+        case 16:
+            return AX + family;
+        case 8:
+            return AL + family;
+        default:
+            return family;
+    }
+}
+
 expr_list_t *new_expr_list() {
     expr_list_t *list = malloc(sizeof(expr_list_t));
     if (list == NULL) {
@@ -618,6 +1037,14 @@ expr_t *get_expr(expr_list_t *list, int index) {
     return &list->exprs[index];
 }
 
+expr_list_t *copy_expr_list(expr_list_t *list) {
+    expr_list_t *copy = new_expr_list();
+    for (int i = 0; i < list->len; i++) {
+        append_expr(copy, copy_expr(&list->exprs[i]));
+    }
+    return copy;
+}
+
 void free_expr_list(expr_list_t *list) {
     for (int i = 0; i < list->len; i++) {
         free_expr(&list->exprs[i]);
@@ -666,6 +1093,8 @@ expr_t* new_expr_memory(register_kind_t base, register_kind_t index, int64_t sca
     expr->memory.index = index;
     expr->memory.scale = scale;
     expr->memory.displacement = displacement;
+    expr->memory.label = NULL;
+    expr->memory.size = 0;
     return expr;
 }
 
@@ -679,6 +1108,38 @@ expr_t* new_expr_label(char* label) {
     return expr;
 }
 
+expr_t* copy_expr(expr_t* expr) {
+    expr_t *copy = malloc(sizeof(expr_t));
+    if (copy == NULL) {
+        error("Failed to allocate memory for expression", ERROR_ALLOC);
+    }
+    *copy = *expr;
+    return copy;
+}
+
+bool expr_equal(expr_t* a, expr_t* b) {
+    if (a->kind != b->kind) {
+        return false;
+    }
+    switch (a->kind) {
+        case IMMEDIATE:
+            return a->immediate == b->immediate;
+        case REGISTER:
+            return a->register_ == b->register_;
+        case MEMORY:
+            return a->memory.base == b->memory.base && a->memory.index == b->memory.index
+                   && a->memory.scale == b->memory.scale && a->memory.displacement == b->memory.displacement
+                   && a->memory.size == b->memory.size
+                   && (a->memory.label == NULL ? b->memory.label == NULL
+                                               : b->memory.label != NULL && strcmp(a->memory.label, b->memory.label) == 0);
+        case LABEL:
+            return strcmp(a->label, b->label) == 0;
+        case STRING:
+            return strcmp(a->string, b->string) == 0;
+    }
+    return false;
+}
+
 int64_t get_immediate(expr_t* expr) {
     if (expr->kind != IMMEDIATE) {
         error("Expression is not an immediate", ERROR_INVALID);
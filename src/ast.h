@@ -3,6 +3,7 @@
 #define ASMPP_AST_H
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include "util.h"
 
@@ -10,6 +11,9 @@ typedef struct expr_t expr_t;
 typedef struct expr_list_t expr_list_t;
 typedef struct instr_t instr_t;
 typedef struct instr_if_t instr_if_t;
+typedef struct instr_loop_t instr_loop_t;
+typedef struct instr_switch_t instr_switch_t;
+typedef struct cond_t cond_t;
 typedef struct instr_call_t instr_call_t;
 typedef struct instr_asm_t instr_asm_t;
 typedef struct instr_list_t instr_list_t;
@@ -24,6 +28,10 @@ typedef struct attribute_list_t attribute_list_t;
 typedef struct data_t data_t;
 typedef struct type_t type_t;
 typedef enum type_kind_t type_kind_t;
+typedef struct var_t var_t;
+typedef struct var_list_t var_list_t;
+typedef struct local_t local_t;
+typedef struct local_list_t local_list_t;
 
 enum register_kind_t {
     RAX,
@@ -64,10 +72,10 @@ enum register_kind_t {
     BX,
     CX,
     DX,
-    SP,
-    BP,
-    DI,
     SI,
+    DI,
+    BP,
+    SP,
     R8W,
     R9W,
     R10W,
@@ -77,18 +85,14 @@ enum register_kind_t {
     R14W,
     R15W,
     IP,
-    AH,
     AL,
-    BH,
     BL,
-    CH,
     CL,
-    SPL,
-    BPL,
-    DIL,
-    SIL,
-    DH,
     DL,
+    SIL,
+    DIL,
+    BPL,
+    SPL,
     R8B,
     R9B,
     R10B,
@@ -97,6 +101,13 @@ enum register_kind_t {
     R13B,
     R14B,
     R15B,
+    AH,
+    BH,
+    CH,
+    DH,
+    NO_REGISTER,
+    // Virtual register n of a label is VIRTUAL_REGISTER + n, until allocate_registers replaces it.
+    VIRTUAL_REGISTER,
 };
 
 typedef enum {
@@ -217,6 +228,7 @@ struct data_t {
     char* name;
     type_t* type;
     expr_list_t* values;
+    attribute_list_t* attributes;
 };
 
 data_t* new_data(char* name, type_t* type, expr_list_t* values);
@@ -231,11 +243,57 @@ struct extern_t {
 extern_t* new_extern(call_abi_t* abi, char* name, attribute_list_t *attributes);
 void free_extern(extern_t* extern_);
 
+// `var name` or `var name: type` in a label: a virtual register of that width, 64 bits by default.
+struct var_t {
+    char* name;
+    int width;
+};
+
+var_t* new_var(char* name, int width);
+
+struct var_list_t {
+    int len;
+    int capacity;
+    var_t* vars;
+};
+
+var_list_t* new_var_list();
+void append_var(var_list_t* list, var_t* var);
+var_t* get_var(var_list_t* list, int index);
+int find_var(var_list_t* list, const char* name);
+void free_var_list(var_list_t* list);
+
+// `local name: type [align(n)]` in a label: size bytes of stack, named in memory operands as [name].
+struct local_t {
+    char* name;
+    int size;
+    int align;
+};
+
+local_t* new_local(char* name, int size, int align);
+
+struct local_list_t {
+    int len;
+    int capacity;
+    local_t* locals;
+};
+
+local_list_t* new_local_list();
+void append_local(local_list_t* list, local_t* local);
+local_t* get_local(local_list_t* list, int index);
+int find_local(local_list_t* list, const char* name);
+void free_local_list(local_list_t* list);
+
 struct label_t {
     char* name;
     call_abi_t *abi;
     instr_list_t *instrs;
     attribute_list_t *attributes;
+    var_list_t *vars;
+    local_list_t *locals;
+    // Registers a call to the label can overwrite, through its callees too, once summarized is set.
+    uint32_t clobbers;
+    bool summarized;
 };
 
 label_t* new_label(char* name, call_abi_t* abi, instr_list_t* instrs, attribute_list_t *attributes);
@@ -251,10 +309,13 @@ instr_list_t* new_instr_list();
 void append_instr(instr_list_t* list, instr_t* instr);
 instr_t* get_instr(instr_list_t* list, int index);
 instr_list_t** split_instr_list(instr_list_t* list, int index);
+instr_list_t* copy_instr_list(instr_list_t* list);
 void free_instr_list(instr_list_t* list);
 
 typedef enum {
     INSTR_IF,
+    INSTR_LOOP,
+    INSTR_SWITCH,
     INSTR_ASM,
     INSTR_CALL
 } instr_kind_t;
@@ -263,14 +324,20 @@ struct instr_t {
     instr_kind_t kind;
     union {
         instr_if_t* instr_if;
+        instr_loop_t* instr_loop;
+        instr_switch_t* instr_switch;
         instr_asm_t* instr_asm;
         instr_call_t* instr_call;
     };
 };
 
 instr_t* new_if_instr(instr_if_t* instr_if);
+instr_t* new_loop_instr(instr_loop_t* instr_loop);
+instr_t* new_switch_instr(instr_switch_t* instr_switch);
 instr_t* new_asm_instr(instr_asm_t* asm_instr);
 instr_t* new_call_instr(instr_call_t* call_instr);
+bool is_terminator(instr_t* instr);
+instr_t* copy_instr(instr_t* instr);
 void free_instr(instr_t* instr);
 
 typedef enum {
@@ -279,24 +346,92 @@ typedef enum {
     LT,
     LE,
     GT,
-    GE
+    GE,
+    ULT,
+    ULE,
+    UGT,
+    UGE
 } cmp_kind_t;
 
 cmp_kind_t get_cmp_kind_by_name(const char* name);
+cmp_kind_t invert_cmp_kind(cmp_kind_t kind);
 
-struct instr_if_t {
-    expr_list_t* condition;
+typedef enum {
+    COND_CMP,
+    COND_AND,
+    COND_OR,
+    COND_NOT
+} cond_kind_t;
+
+// and/or take their operands as a left-nested binary tree, not only uses lhs.
+struct cond_t {
+    cond_kind_t kind;
     cmp_kind_t cmp;
+    expr_list_t* operands;
+    cond_t* lhs;
+    cond_t* rhs;
+};
+
+cond_t* new_cond_cmp(cmp_kind_t cmp, expr_list_t* operands);
+cond_t* new_cond_logical(cond_kind_t kind, cond_t* lhs, cond_t* rhs);
+cond_t* copy_cond(cond_t* cond);
+void free_cond(cond_t* cond);
+
+// attributes follow the condition and apply to the whole if, or to the then arm for [hot]/[cold];
+// else_attributes follow `else`. profile_label and profile_block identify the if in a profile, see profile.h.
+struct instr_if_t {
+    cond_t* cond;
     instr_list_t* then_instrs;
     instr_list_t* else_instrs;
+    attribute_list_t* attributes;
+    attribute_list_t* else_attributes;
+    char* profile_label;
+    int profile_block;
 };
 
-instr_if_t* new_instr_if(expr_list_t* condition, cmp_kind_t cmp, instr_list_t* then_instrs, instr_list_t* else_instrs);
+instr_if_t* new_instr_if(cond_t* cond, instr_list_t* then_instrs, instr_list_t* else_instrs, attribute_list_t* attributes);
 void free_instr_if(instr_if_t* instr_if);
 
+typedef enum {
+    LOOP_WHILE,
+    LOOP_COUNTED
+} loop_kind_t;
+
+// `while cond { body }`, or `loop counter, count { body }` which runs body count times
+// with counter going from count down to 1.
+struct instr_loop_t {
+    loop_kind_t kind;
+    cond_t* cond;
+    expr_t* counter;
+    expr_t* count;
+    instr_list_t* body;
+    attribute_list_t* attributes;
+};
+
+instr_loop_t* new_instr_while(cond_t* cond, instr_list_t* body, attribute_list_t* attributes);
+instr_loop_t* new_instr_counted_loop(expr_t* counter, expr_t* count, instr_list_t* body, attribute_list_t* attributes);
+void free_instr_loop(instr_loop_t* instr_loop);
+
+// `switch value { case v: ... default: ... }`. Cases do not fall through into each other, and
+// default_instrs is empty when there is no default.
+struct instr_switch_t {
+    expr_t* value;
+    int len;
+    int capacity;
+    int64_t* cases;
+    instr_list_t** bodies;
+    instr_list_t* default_instrs;
+    attribute_list_t* attributes;
+};
+
+instr_switch_t* new_instr_switch(expr_t* value, attribute_list_t* attributes);
+void append_case(instr_switch_t* instr_switch, int64_t value, instr_list_t* body);
+void free_instr_switch(instr_switch_t* instr_switch);
+
 struct instr_call_t {
     char* callee;
     expr_list_t* args;
+    bool tail;
 };
 
 instr_call_t* new_instr_call(char* callee, expr_list_t* args);
@@ -324,11 +459,16 @@ void free_register_kind_list(register_kind_list_t* list);
 
 
 register_kind_t get_register_kind_by_name(char* name);
+int find_register_kind_by_name(char* name);
 char* register_kind_to_string(register_kind_t register_);
 bool is_64_bit(register_kind_t register_);
 bool is_32_bit(register_kind_t register_);
 bool is_16_bit(register_kind_t register_);
 bool is_8_bit(register_kind_t register_);
+bool is_virtual_register(register_kind_t register_);
+int register_width(register_kind_t register_);
+register_kind_t register_family(register_kind_t register_);
+register_kind_t register_with_width(register_kind_t family, int bits);
 
 // ASM x86 expr kind
 typedef enum {
@@ -348,6 +488,7 @@ struct expr_list_t {
 expr_list_t* new_expr_list();
 void append_expr(expr_list_t* list, expr_t* expr);
 expr_t* get_expr(expr_list_t* list, int index);
+expr_list_t* copy_expr_list(expr_list_t* list);
 void free_expr_list(expr_list_t* list);
 
 
@@ -363,6 +504,8 @@ struct expr_t {
             register_kind_t index;
             int64_t scale;
             int64_t displacement;
+            char* label;
+            int size;
         } memory;
         char* label;
         char* string;
@@ -375,6 +518,8 @@ expr_t* new_expr_memory(register_kind_t base, register_kind_t index, int64_t sca
 expr_t* new_expr_string(char* string);
 expr_t* new_expr_label(char* label);
 
+expr_t* copy_expr(expr_t* expr);
+bool expr_equal(expr_t* a, expr_t* b);
 int64_t get_immediate(expr_t* expr);
 register_kind_t get_register(expr_t* expr);
 register_kind_t get_base(expr_t* expr);
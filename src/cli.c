@@ -3,6 +3,11 @@
 #include "lexer.h"
 #include "parser.h"
 #include "codegen.h"
+#include "optimize.h"
+#include "encoding.h"
+#include "target.h"
+#include "profile.h"
+#include "summary.h"
 #include "log.h"
 #include <stdlib.h>
 #include <string.h>
@@ -15,8 +20,17 @@ void print_help(char *program_name) {
     printf("  -v           Verbose\n");
     printf("  -d           Debug\n");
     printf("  -a <a>       Assembler\n");
+    printf("  -m <arch>    Target CPU (generic, skylake, icelake, zen, atom)\n");
     printf("  -l           Link with libc\n");
+    printf("  -s           Print optimization stats\n");
     printf("  -h           Print this help\n");
+    printf("  --profile-generate[=<file>]  Count label and branch executions into <file> (default %s)\n", PROFILE_DEFAULT_PATH);
+    printf("  --profile-use=<file>         Optimize with the counts in <file>\n");
+    printf("  --profile-markers            Label profile blocks, so that samples can be mapped back to them\n");
+    printf("  --profile-sample=<file>      Optimize with sampled addresses (perf script output or <address> <count> lines)\n");
+    printf("  --profile-map=<file>         Symbol map (nm output) of the --profile-markers build the samples come from\n");
+    printf("  --frame-pointer              Keep rbp as a frame pointer in C ABI labels, leaf ones included\n");
+    printf("  --clobber-summary=<file>     Write the registers each global label overwrites, as extern declarations\n");
 }
 
 void print_usage(char *program_name) {
@@ -33,7 +47,16 @@ config_t* parse_args(int argc, char** argv) {
     config->verbose = 0;
     config->debug = 0;
     config->as = "nasm";
+    config->arch = "generic";
     config->link_libc = 0;
+    config->stats = 0;
+    config->profile_generate = NULL;
+    config->profile_use = NULL;
+    config->profile_markers = 0;
+    config->profile_sample = NULL;
+    config->profile_map = NULL;
+    config->frame_pointer = 0;
+    config->clobber_summary = NULL;
 
     for (int i = 1; i < argc; i++) {
         if (argv[i][0] == '-') {
@@ -42,6 +65,38 @@ config_t* parse_args(int argc, char** argv) {
                 print_usage(program_name);
                 exit(1);
             }
+            if (strcmp(argv[i], "--profile-generate") == 0) {
+                config->profile_generate = PROFILE_DEFAULT_PATH;
+                continue;
+            }
+            if (strncmp(argv[i], "--profile-generate=", 19) == 0) {
+                config->profile_generate = argv[i] + 19;
+                continue;
+            }
+            if (strncmp(argv[i], "--profile-use=", 14) == 0) {
+                config->profile_use = argv[i] + 14;
+                continue;
+            }
+            if (strcmp(argv[i], "--profile-markers") == 0) {
+                config->profile_markers = 1;
+                continue;
+            }
+            if (strncmp(argv[i], "--profile-sample=", 17) == 0) {
+                config->profile_sample = argv[i] + 17;
+                continue;
+            }
+            if (strncmp(argv[i], "--profile-map=", 14) == 0) {
+                config->profile_map = argv[i] + 14;
+                continue;
+            }
+            if (strcmp(argv[i], "--frame-pointer") == 0) {
+                config->frame_pointer = 1;
+                continue;
+            }
+            if (strncmp(argv[i], "--clobber-summary=", 18) == 0) {
+                config->clobber_summary = argv[i] + 18;
+                continue;
+            }
             switch (argv[i][1]) {
                 case 'o':
                     if (i + 1 >= argc) {
@@ -73,9 +128,25 @@ config_t* parse_args(int argc, char** argv) {
                     }
                     config->as = argv[++i];
                     break;
+                case 'm':
+                    if (i + 1 >= argc) {
+                        fprintf(stderr, "Missing argument for option -m\n");
+                        print_usage(program_name);
+                        exit(1);
+                    }
+                    config->arch = argv[++i];
+                    if (find_target(config->arch) == NULL) {
+                        fprintf(stderr, "Unknown target: %s\n", config->arch);
+                        print_usage(program_name);
+                        exit(1);
+                    }
+                    break;
                 case 'l':
                     config->link_libc = 1;
                     break;
+                case 's':
+                    config->stats = 1;
+                    break;
                 case 'h':
                     print_help(program_name);
                     exit(0);
@@ -89,6 +160,12 @@ config_t* parse_args(int argc, char** argv) {
         }
     }
 
+    if ((config->profile_sample == NULL) != (config->profile_map == NULL)) {
+        fprintf(stderr, "--profile-sample and --profile-map go together\n");
+        print_usage(program_name);
+        exit(1);
+    }
+
     if (config->input == NULL) {
         fprintf(stderr, "No input file\n");
         print_usage(program_name);
@@ -166,15 +243,42 @@ void eval_args(config_t* config) {
         parser_t *parser = new_parser(lexer->tokens);
         parse(parser);
         stmt_list_t *stmts = parser->stmts;
+        if (config->verbose) {
+            printf("Optimizing...\n");
+        }
+        opt_stats_t *stats = new_opt_stats();
+        number_profile_blocks(stmts);
+        if (config->profile_use != NULL) {
+            profile_t *profile = read_profile(config->profile_use);
+            apply_profile(stmts, profile, stats);
+            free_profile(profile);
+        }
+        if (config->profile_sample != NULL) {
+            profile_t *profile = read_sample_profile(config->profile_sample, config->profile_map);
+            apply_profile(stmts, profile, stats);
+            free_profile(profile);
+        }
+        optimize(stmts, config, stats);
+        if (config->clobber_summary != NULL) {
+            write_clobber_summary(stmts, config->clobber_summary);
+        }
+        if (config->profile_generate != NULL) {
+            instrument_profile(stmts, config->profile_generate);
+        }
         if (config->verbose) {
             printf("Codegen...\n");
         }
-        codegen_t *code = new_codegen(stmts);
+        codegen_t *code = new_codegen(stmts, config);
         codegen(code);
         if (config->verbose) {
             printf("Emitting assembly...\n");
         }
         asm_compile(code->asm_, config, output_name);
+        if (config->stats) {
+            stats->code_size = estimate_code_size(code->asm_);
+            stats->labels_folded = code->labels_folded;
+            print_opt_stats(stats);
+        }
 
     }
 
@@ -13,6 +13,14 @@ typedef struct {
     char* arch;
     char* as;
     int link_libc;
+    int stats;
+    char* profile_generate;
+    char* profile_use;
+    int profile_markers;
+    char* profile_sample;
+    char* profile_map;
+    int frame_pointer;
+    char* clobber_summary;
 } config_t;
 
 void print_help(char *program_name);
@@ -8,6 +8,11 @@
 #include <string.h>
 #include <stdio.h>
 #include "string.h"
+#include "error.h"
+#include "narrow.h"
+#include "unroll.h"
+#include "analysis.h"
+#include "profile.h"
 
 call_abi_t *get_c_call_abi() {
     argument_list_t *args = new_argument_list();
@@ -22,17 +27,53 @@ call_abi_t *get_c_call_abi() {
     return new_call_abi("C", args);
 }
 
-char* cmp_kind_to_jmp(cmp_kind_t kind) {
-    char* jmp[] = {
-            "je",
-            "jne",
-            "jl",
-            "jle",
-            "jg",
-            "jge",
+// The ABI selected by an [abi(...)] attribute, the declared one otherwise.
+call_abi_t *resolve_call_abi(call_abi_t *abi, attribute_list_t *attributes) {
+    if (!has_attribute(attributes, "abi")) {
+        return abi;
+    }
+    attribute_t *abi_attr = get_attribute(attributes, find_attribute(attributes, "abi"));
+    if (has_argument(abi_attr, "C") > 0) {
+        return get_c_call_abi();
+    } else if (has_argument(abi_attr, "stack") > 0) {
+        if (abi->args->len > 0 && get_argument(abi->args, abi->args->len - 1)->kind == ARGUMENT_STACK) {
+            return abi;
+        }
+        argument_list_t *args = new_argument_list();
+        for (int i = 0; i < abi->args->len; i++) {
+            append_argument(args, get_argument(abi->args, i));
+        }
+        append_argument(args, new_argument_stack());
+        return new_call_abi("stack", args);
+    }
+    return abi;
+}
+
+char* cmp_kind_to_cc(cmp_kind_t kind) {
+    char* cc[] = {
+            "e",
+            "ne",
+            "l",
+            "le",
+            "g",
+            "ge",
+            "b",
+            "be",
+            "a",
+            "ae",
     };
 
-    return jmp[kind];
+    return cc[kind];
+}
+
+char* cmp_kind_to_op(const char* prefix, cmp_kind_t kind) {
+    char* op = malloc(16);
+    snprintf(op, 16, "%s%s", prefix, cmp_kind_to_cc(kind));
+    return op;
+}
+
+char* cmp_kind_to_jmp(cmp_kind_t kind) {
+    return cmp_kind_to_op("j", kind);
 }
 
 
@@ -80,18 +121,35 @@ void free_label_hashtable(label_hashtable_t *table) {
 }
 
 
-codegen_t *new_codegen(stmt_list_t *stmts) {
+codegen_t *new_codegen(stmt_list_t *stmts, config_t *config) {
     codegen_t *codegen = malloc(sizeof(codegen_t));
     if (codegen == NULL) {
         return NULL;
     }
     codegen->stmts = stmts;
+    codegen->config = config;
+    codegen->target = find_target(config->arch);
     codegen->labels = new_label_hashtable();
     codegen->asm_ = asm_new();
+    codegen->entry_point = CODEGEN_TEXT;
+    codegen->current_label = NULL;
+    codegen->label = NULL;
+    codegen->loop_head = NULL;
+    codegen->deferred = NULL;
+    codegen->deferred_len = 0;
+    codegen->deferred_capacity = 0;
+    codegen->count = 0;
+    codegen->profile_key = 0;
+    codegen->flags.valid = false;
+    codegen->icf = new_icf_table();
+    codegen->labels_folded = 0;
     return codegen;
 }
 
+static void codegen_update_flags(codegen_t *codegen, asm_instruction_t *instruction);
+
 void codegen_insert_instruction(codegen_t *codegen, asm_instruction_t *instruction) {
+    codegen_update_flags(codegen, instruction);
     if (codegen->entry_point == CODEGEN_TEXT) {
         section_text_add_instruction(codegen->asm_->text, instruction);
     } else {
@@ -99,6 +157,22 @@ void codegen_insert_instruction(codegen_t *codegen, asm_instruction_t *instructi
     }
 }
 
+char *codegen_new_label_name(codegen_t *codegen) {
+    char *name = malloc(100);
+    snprintf(name, 100, ".L%d", codegen->count++);
+    return name;
+}
+
+void codegen_insert_label(codegen_t *codegen, char *name) {
+    codegen_insert_instruction(codegen, instruction_new(ASM_LABEL, name));
+}
+
+void codegen_insert_jump(codegen_t *codegen, char *op, char *target) {
+    asm_instruction_t *jmp = instruction_new(ASM_INSTR, op);
+    instruction_add_arg(jmp, target);
+    codegen_insert_instruction(codegen, jmp);
+}
+
 char* codegen_expr(codegen_t *codegen, expr_t *expr) {
     switch (expr->kind) {
         case IMMEDIATE: {
@@ -108,8 +182,39 @@ char* codegen_expr(codegen_t *codegen, expr_t *expr) {
         }
         case REGISTER:
             return register_kind_to_string(expr->register_);
-        case MEMORY:
-            assert(0);
+        case MEMORY: {
+            char *sizes[] = {NULL, "byte ", "word ", NULL, "dword ", NULL, NULL, NULL, "qword "};
+            string_buffer_t *buffer = new_string_buffer();
+            if (expr->memory.size != 0) {
+                string_buffer_printf(buffer, "%s", sizes[expr->memory.size]);
+            }
+            string_buffer_printf(buffer, "[");
+            bool first = true;
+            if (expr->memory.base != NO_REGISTER) {
+                string_buffer_printf(buffer, "%s", register_kind_to_string(expr->memory.base));
+                first = false;
+            }
+            if (expr->memory.label != NULL) {
+                string_buffer_printf(buffer, first ? "%s" : " + %s", expr->memory.label);
+                first = false;
+            }
+            if (expr->memory.index != NO_REGISTER) {
+                string_buffer_printf(buffer, first ? "%s" : " + %s", register_kind_to_string(expr->memory.index));
+                if (expr->memory.scale != 1) {
+                    string_buffer_printf(buffer, "*%lld", expr->memory.scale);
+                }
+                first = false;
+            }
+            if (first) {
+                string_buffer_printf(buffer, "%lld", expr->memory.displacement);
+            } else if (expr->memory.displacement > 0) {
+                string_buffer_printf(buffer, " + %lld", expr->memory.displacement);
+            } else if (expr->memory.displacement < 0) {
+                string_buffer_printf(buffer, " - %llu", -(uint64_t) expr->memory.displacement);
+            }
+            string_buffer_printf(buffer, "]");
+            return buffer->data;
+        }
         case LABEL:
             return expr->label;
         case STRING: {
@@ -131,50 +236,836 @@ char** codegen_list_expr(codegen_t *codegen, expr_list_t *list) {
     return args;
 }
 
+static bool expr_uses_register(expr_t *expr, register_kind_t family) {
+    if (expr->kind == REGISTER) {
+        return register_family(expr->register_) == family;
+    }
+    if (expr->kind == MEMORY) {
+        return (expr->memory.base != NO_REGISTER && register_family(expr->memory.base) == family)
+               || (expr->memory.index != NO_REGISTER && register_family(expr->memory.index) == family);
+    }
+    return false;
+}
+
+static bool is_flags_neutral(char *op) {
+    char *neutral[] = {"mov", "movzx", "movsx", "movsxd", "lea", "push", "pop", "nop"};
+    for (int i = 0; i < (int) (sizeof(neutral) / sizeof(neutral[0])); i++) {
+        if (strcmp(op, neutral[i]) == 0) {
+            return true;
+        }
+    }
+    return op[0] == 'j' || strncmp(op, "cmov", 4) == 0 || strncmp(op, "set", 3) == 0;
+}
+
+// Keeps track of whether the flags still hold the result of the last compare.
+static void codegen_update_flags(codegen_t *codegen, asm_instruction_t *instruction) {
+    if (!codegen->flags.valid) {
+        return;
+    }
+    if (instruction->type == ASM_LABEL || !is_flags_neutral(instruction->args[0])) {
+        codegen->flags.valid = false;
+        return;
+    }
+    if (instruction->arg_size < 2 || instruction->args[0][0] == 'j' || strcmp(instruction->args[0], "push") == 0) {
+        return;
+    }
+    int dst = find_register_kind_by_name(instruction->args[1]);
+    expr_t *operands[] = {codegen->flags.lhs, codegen->flags.rhs};
+    for (int i = 0; i < 2; i++) {
+        if (dst == -1 ? operands[i]->kind == MEMORY : expr_uses_register(operands[i], register_family(dst))) {
+            codegen->flags.valid = false;
+        }
+    }
+}
+
+// Emits the compare of a condition, unless the flags already hold it. A compare against zero becomes a `test`.
+void codegen_compare(codegen_t *codegen, expr_list_t *operands) {
+    expr_t *lhs = get_expr(operands, 0);
+    expr_t *rhs = get_expr(operands, 1);
+    if (codegen->flags.valid && expr_equal(codegen->flags.lhs, lhs) && expr_equal(codegen->flags.rhs, rhs)) {
+        return;
+    }
+    asm_instruction_t *cmp;
+    if (lhs->kind == REGISTER && rhs->kind == IMMEDIATE && rhs->immediate == 0) {
+        cmp = instruction_new(ASM_INSTR, "test");
+        instruction_add_arg(cmp, codegen_expr(codegen, lhs));
+        instruction_add_arg(cmp, codegen_expr(codegen, lhs));
+    } else {
+        cmp = instruction_new(ASM_INSTR, "cmp");
+        instruction_add_arg(cmp, codegen_expr(codegen, lhs));
+        instruction_add_arg(cmp, codegen_expr(codegen, rhs));
+    }
+    codegen_insert_instruction(codegen, cmp);
+    codegen->flags.valid = true;
+    codegen->flags.lhs = lhs;
+    codegen->flags.rhs = rhs;
+}
+
+// Jumps to target when the condition evaluates to jump_if, falls through otherwise. and/or short-circuit.
+void codegen_cond_jump(codegen_t *codegen, cond_t *cond, bool jump_if, char *target) {
+    switch (cond->kind) {
+        case COND_CMP:
+            codegen_compare(codegen, cond->operands);
+            codegen_insert_jump(codegen, cmp_kind_to_jmp(jump_if ? cond->cmp : invert_cmp_kind(cond->cmp)), target);
+            break;
+        case COND_NOT:
+            codegen_cond_jump(codegen, cond->lhs, !jump_if, target);
+            break;
+        case COND_AND:
+        case COND_OR: {
+            // `and` jumping when false and `or` jumping when true can send both operands to the target directly.
+            if ((cond->kind == COND_AND) != jump_if) {
+                codegen_cond_jump(codegen, cond->lhs, jump_if, target);
+                codegen_cond_jump(codegen, cond->rhs, jump_if, target);
+                break;
+            }
+            char *skip = codegen_new_label_name(codegen);
+            codegen_cond_jump(codegen, cond->lhs, !jump_if, skip);
+            codegen_cond_jump(codegen, cond->rhs, jump_if, target);
+            codegen_insert_label(codegen, skip);
+            break;
+        }
+    }
+}
+
+// A `mov reg64, reg64` can be turned into a cmov: it has no side effect besides the write.
+static bool is_cmov_candidate(instr_t *instr) {
+    if (instr->kind != INSTR_ASM || strcmp(instr->instr_asm->name, "mov") != 0 || instr->instr_asm->args->len != 2) {
+        return false;
+    }
+    expr_t *dst = get_expr(instr->instr_asm->args, 0);
+    expr_t *src = get_expr(instr->instr_asm->args, 1);
+    return dst->kind == REGISTER && src->kind == REGISTER
+           && is_64_bit(dst->register_) && is_64_bit(src->register_)
+           && dst->register_ != RSP && dst->register_ != RIP && src->register_ != RIP;
+}
+
+static bool is_cmov_arm(instr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        if (!is_cmov_candidate(get_instr(list, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int get_boolean_mov(instr_list_t *list, register_kind_t *reg) {
+    if (list->len != 1) {
+        return -1;
+    }
+    instr_t *instr = get_instr(list, 0);
+    if (instr->kind != INSTR_ASM || instr->instr_asm->args->len != 2) {
+        return -1;
+    }
+    expr_t *dst = get_expr(instr->instr_asm->args, 0);
+    expr_t *src = get_expr(instr->instr_asm->args, 1);
+    // Every general purpose register has a low byte for setcc, r8b-r15b and sil/dil/bpl with a REX prefix.
+    if (dst->kind != REGISTER || !(is_64_bit(dst->register_) || is_32_bit(dst->register_))
+        || register_family(dst->register_) == RSP || register_family(dst->register_) > R15) {
+        return -1;
+    }
+    *reg = dst->register_;
+    // narrow_instructions turns mov reg, 0 into the xor zeroing idiom.
+    if (strcmp(instr->instr_asm->name, "xor") == 0 && expr_equal(dst, src)) {
+        return 0;
+    }
+    if (strcmp(instr->instr_asm->name, "mov") != 0 || src->kind != IMMEDIATE
+        || (src->immediate != 0 && src->immediate != 1)) {
+        return -1;
+    }
+    return (int) src->immediate;
+}
+
+// Lowers an `if` whose arms only move registers without branching. Returns false when the arms do not allow it.
+static bool codegen_branchless_if(codegen_t *codegen, instr_if_t *instr_if) {
+    if (has_attribute(instr_if->attributes, "branch") || instr_if->cond->kind != COND_CMP) {
+        return false;
+    }
+    cmp_kind_t cmp = instr_if->cond->cmp;
+    instr_list_t *then_instrs = instr_if->then_instrs;
+    instr_list_t *else_instrs = instr_if->else_instrs;
+
+    register_kind_t then_reg, else_reg;
+    int then_value = get_boolean_mov(then_instrs, &then_reg);
+    int else_value = get_boolean_mov(else_instrs, &else_reg);
+    if (then_value != -1 && else_value != -1 && then_value != else_value
+        && register_family(then_reg) == register_family(else_reg)) {
+        // setcc + movzx: the result is the condition itself (or its inverse) as 0/1.
+        codegen_compare(codegen, instr_if->cond->operands);
+        cmp_kind_t kind = then_value ? cmp : invert_cmp_kind(cmp);
+        register_kind_t family = register_family(then_reg);
+        char *low = register_kind_to_string(register_with_width(family, 8));
+        asm_instruction_t *set = instruction_new(ASM_INSTR, cmp_kind_to_op("set", kind));
+        instruction_add_arg(set, low);
+        codegen_insert_instruction(codegen, set);
+        asm_instruction_t *movzx = instruction_new(ASM_INSTR, "movzx");
+        instruction_add_arg(movzx, register_kind_to_string(register_with_width(family, 32)));
+        instruction_add_arg(movzx, low);
+        codegen_insert_instruction(codegen, movzx);
+        return true;
+    }
+
+    if (then_instrs->len + else_instrs->len == 0 || !is_cmov_arm(then_instrs) || !is_cmov_arm(else_instrs)) {
+        return false;
+    }
+    // Both arms are guarded by opposite conditions, so at most one of them takes effect.
+    codegen_compare(codegen, instr_if->cond->operands);
+    instr_list_t *arms[] = {then_instrs, else_instrs};
+    cmp_kind_t kinds[] = {cmp, invert_cmp_kind(cmp)};
+    for (int arm = 0; arm < 2; arm++) {
+        for (int i = 0; i < arms[arm]->len; i++) {
+            instr_asm_t *mov = get_instr(arms[arm], i)->instr_asm;
+            asm_instruction_t *cmov = instruction_new(ASM_INSTR, cmp_kind_to_op("cmov", kinds[arm]));
+            instruction_add_arg(cmov, codegen_expr(codegen, get_expr(mov->args, 0)));
+            instruction_add_arg(cmov, codegen_expr(codegen, get_expr(mov->args, 1)));
+            codegen_insert_instruction(codegen, cmov);
+        }
+    }
+    return true;
+}
+
+static bool move_reads(expr_t *src, register_kind_t family) {
+    return expr_uses_register(src, family);
+}
+
+static register_kind_t swap_family(register_kind_t reg, register_kind_t a, register_kind_t b) {
+    if (reg == NO_REGISTER) {
+        return reg;
+    }
+    if (register_family(reg) == a) {
+        return register_with_width(b, register_width(reg));
+    }
+    if (register_family(reg) == b) {
+        return register_with_width(a, register_width(reg));
+    }
+    return reg;
+}
+
+// src after xchg a, b: whatever it read from one register is now in the other.
+static expr_t *move_swap(expr_t *src, register_kind_t a, register_kind_t b) {
+    if (src->kind == REGISTER) {
+        return new_expr_register(swap_family(src->register_, a, b));
+    }
+    if (src->kind == MEMORY) {
+        expr_t *memory = copy_expr(src);
+        memory->memory.base = swap_family(src->memory.base, a, b);
+        memory->memory.index = swap_family(src->memory.index, a, b);
+        return memory;
+    }
+    return src;
+}
+
+// expr as read once rsp has moved down by bytes.
+static expr_t *shift_rsp(expr_t *expr, int64_t bytes) {
+    if (expr->kind != MEMORY || expr->memory.base != RSP) {
+        return expr;
+    }
+    expr_t *shifted = copy_expr(expr);
+    shifted->memory.displacement += bytes;
+    return shifted;
+}
+
+static instr_t *new_move_instr(char *op, register_kind_t dst, expr_t *src) {
+    expr_list_t *args = new_expr_list();
+    append_expr(args, new_expr_register(dst));
+    append_expr(args, src);
+    instr_asm_t *instr = new_instr_asm(op, args);
+    narrow_instr(instr);
+    return new_asm_instr(instr);
+}
+
+// Performs all moves dsts[i] <- srcs[i] as if simultaneously: moves to the register itself are dropped,
+// a move is only emitted once no pending move still reads its destination, and cycles are broken with xchg.
+// A cycle only closed by memory sources has no register to exchange, its value waits on the stack instead.
+instr_list_t *resolve_parallel_move(register_kind_t *dsts, expr_t **srcs, int len) {
+    instr_list_t *moves = new_instr_list();
+    instr_list_t *pops = new_instr_list();
+    while (len > 0) {
+        bool progress = false;
+        for (int i = 0; i < len; i++) {
+            if (srcs[i]->kind == REGISTER && srcs[i]->register_ == dsts[i]) {
+                dsts[i] = dsts[len - 1];
+                srcs[i] = srcs[--len];
+                progress = true;
+                break;
+            }
+            bool blocked = false;
+            for (int j = 0; j < len && !blocked; j++) {
+                blocked = j != i && move_reads(srcs[j], register_family(dsts[i]));
+            }
+            if (!blocked) {
+                append_instr(moves, new_move_instr("mov", dsts[i], srcs[i]));
+                dsts[i] = dsts[len - 1];
+                srcs[i] = srcs[--len];
+                progress = true;
+                break;
+            }
+        }
+        if (progress) {
+            continue;
+        }
+        // Every destination is still read by another move, so the remaining moves form cycles.
+        int cut = 0;
+        for (int i = 0; i < len; i++) {
+            if (srcs[i]->kind == REGISTER) {
+                cut = i;
+                break;
+            }
+        }
+        if (srcs[cut]->kind == REGISTER) {
+            register_kind_t dst = register_family(dsts[cut]);
+            register_kind_t src = register_family(srcs[cut]->register_);
+            append_instr(moves, new_move_instr("xchg", dst, new_expr_register(src)));
+            dsts[cut] = dsts[len - 1];
+            srcs[cut] = srcs[--len];
+            for (int j = 0; j < len; j++) {
+                srcs[j] = move_swap(srcs[j], dst, src);
+            }
+            continue;
+        }
+        // Only memory sources are left: load one now and park it on the stack, with the old value of its
+        // destination put back for the moves that still read it. The load keeps its own width, and the pop once
+        // the others are done writes the destination as the load would have.
+        register_kind_t family = register_family(dsts[cut]);
+        expr_list_t *args = new_expr_list();
+        append_expr(args, new_expr_register(family));
+        append_instr(moves, new_asm_instr(new_instr_asm("push", args)));
+        append_instr(moves, new_move_instr("mov", dsts[cut], shift_rsp(srcs[cut], 8)));
+        expr_t *slot = new_expr_memory(RSP, NO_REGISTER, 1, 0);
+        slot->memory.size = 8;
+        args = new_expr_list();
+        append_expr(args, slot);
+        append_expr(args, new_expr_register(family));
+        append_instr(moves, new_asm_instr(new_instr_asm("xchg", args)));
+        args = new_expr_list();
+        append_expr(args, new_expr_register(family));
+        append_instr(pops, new_asm_instr(new_instr_asm("pop", args)));
+        dsts[cut] = dsts[len - 1];
+        srcs[cut] = srcs[--len];
+        for (int j = 0; j < len; j++) {
+            srcs[j] = shift_rsp(srcs[j], 8);
+        }
+    }
+    for (int i = pops->len - 1; i >= 0; i--) {
+        append_instr(moves, get_instr(pops, i));
+    }
+    return moves;
+}
+
+// Flags at a join: only a single compare reaches the branch targets, and every incoming path must still hold it.
+static flags_state_t codegen_merge_flags(cond_t *cond, flags_state_t a, flags_state_t b) {
+    flags_state_t merged = a;
+    if (cond->kind != COND_CMP || !a.valid || !b.valid
+        || !expr_equal(a.lhs, b.lhs) || !expr_equal(a.rhs, b.rhs)) {
+        merged.valid = false;
+    }
+    return merged;
+}
+
+static void codegen_insert_align(codegen_t *codegen) {
+    char *bytes = malloc(16);
+    snprintf(bytes, 16, "%d", codegen->target->loop_align);
+    asm_instruction_t *align = instruction_new(ASM_INSTR, "align");
+    instruction_add_arg(align, bytes);
+    codegen_insert_instruction(codegen, align);
+}
+
+// Loops are laid out rotated, with the test at the bottom so each iteration takes a single branch:
+//
+//     jmp test            mov counter, count
+//     align               test counter, counter / jz exit (unless count is a known positive constant)
+//   head:                 align
+//     body              head:
+//   test:                 body
+//     jcc head            dec counter / jnz head
+//                       exit:
+static void codegen_counter_op(codegen_t *codegen, char *op, char *counter, int64_t value) {
+    asm_instruction_t *instruction = instruction_new(ASM_INSTR, op);
+    instruction_add_arg(instruction, counter);
+    if (value != 0) {
+        char *imm = malloc(32);
+        snprintf(imm, 32, "%lld", (long long) value);
+        instruction_add_arg(instruction, imm);
+    }
+    codegen_insert_instruction(codegen, instruction);
+}
+
+// The unroll factor of a loop: its own [unroll(N)], or else the one of the label it is in.
+static int codegen_unroll_factor(codegen_t *codegen, instr_loop_t *loop, bool *inherited) {
+    int factor = unroll_factor(loop->attributes);
+    *inherited = false;
+    if (has_attribute(loop->attributes, "unroll") || codegen->label == NULL) {
+        return factor;
+    }
+    *inherited = true;
+    return unroll_factor(codegen->label->attributes);
+}
+
+static void codegen_while(codegen_t *codegen, instr_loop_t *loop, int factor) {
+    char *head = codegen_new_label_name(codegen);
+    char *test = codegen_new_label_name(codegen);
+    char *exit = factor > 1 ? codegen_new_label_name(codegen) : NULL;
+    codegen_insert_jump(codegen, "jmp", test);
+    codegen_insert_align(codegen);
+    codegen_insert_label(codegen, head);
+    // Unrolled copies leave through the inverted condition, only the last one takes the back-edge.
+    for (int i = 1; i < factor; i++) {
+        codegen_instr_list(codegen, loop->body);
+        codegen_cond_jump(codegen, loop->cond, false, exit);
+    }
+    codegen_instr_list(codegen, loop->body);
+    codegen_insert_label(codegen, test);
+    codegen_cond_jump(codegen, loop->cond, true, head);
+    if (exit != NULL) {
+        codegen_insert_label(codegen, exit);
+    }
+}
+
+// Straight-line code for a loop running count times, with the counter replaced by its value in each copy.
+static void codegen_full_unroll(codegen_t *codegen, instr_t *instr, int64_t count) {
+    instr_loop_t *loop = instr->instr_loop;
+    register_kind_t counter = loop->counter->register_;
+    instr_list_t **copies = malloc(sizeof(instr_list_t *) * count);
+    if (copies == NULL) {
+        error("Failed to allocate memory for unrolled loop", ERROR_ALLOC);
+    }
+    bool substituted = true;
+    for (int64_t i = 0; i < count && substituted; i++) {
+        copies[i] = substitute_counter(loop->body, counter, count - i);
+        substituted = copies[i] != NULL;
+    }
+    if (substituted) {
+        for (int64_t i = 0; i < count; i++) {
+            codegen_instr_list(codegen, copies[i]);
+        }
+        // The counter is left at zero like the loop would leave it, when anything reads it afterwards.
+        if (codegen->label == NULL
+            || (live_after(codegen->label->instrs, instr, label_live_out(codegen->label)) & regset_of(counter))) {
+            codegen_instr(codegen, new_move_instr("mov", counter, new_expr_immediate(0)));
+        }
+    } else {
+        char *name = codegen_expr(codegen, loop->counter);
+        codegen_instr(codegen, new_move_instr("mov", counter, loop->count));
+        for (int64_t i = 0; i < count; i++) {
+            codegen_instr_list(codegen, loop->body);
+            codegen_counter_op(codegen, "dec", name, 0);
+        }
+    }
+    free(copies);
+}
+
+// factor copies of the body per iteration of the loop, which runs while the counter is a non-zero multiple
+// of factor. When every copy can read its own counter value through an address displacement, the counter
+// moves down once per iteration, else each copy decrements it.
+static void codegen_unrolled_body(codegen_t *codegen, instr_loop_t *loop, char *counter, int factor, char *head) {
+    instr_list_t **copies = malloc(sizeof(instr_list_t *) * factor);
+    if (copies == NULL) {
+        error("Failed to allocate memory for unrolled loop", ERROR_ALLOC);
+    }
+    bool rebased = true;
+    for (int i = 0; i < factor && rebased; i++) {
+        copies[i] = rebase_counter(loop->body, loop->counter->register_, -i);
+        rebased = copies[i] != NULL;
+    }
+    codegen_insert_align(codegen);
+    codegen_insert_label(codegen, head);
+    for (int i = 0; i < factor; i++) {
+        codegen_instr_list(codegen, rebased ? copies[i] : loop->body);
+        if (!rebased) {
+            codegen_counter_op(codegen, "dec", counter, 0);
+        }
+    }
+    if (rebased) {
+        codegen_counter_op(codegen, "sub", counter, factor);
+    }
+    codegen_insert_jump(codegen, "jnz", head);
+    free(copies);
+}
+
+// Unrolled counted loops first run count % factor single iterations, so that the rest is a whole number
+// of unrolled iterations:
+//
+//     mov counter, count          mov counter, count (count known)
+//     jmp rest                    body / dec counter (count % factor times)
+//   single:                       align
+//     body / dec counter        head:
+//   rest:                         factor copies of the body
+//     test counter, factor - 1    sub counter, factor / jnz head
+//     jnz single
+//     test counter, counter / jz exit
+//     align
+//   head:
+//     factor copies of the body
+//     sub counter, factor / jnz head
+//   exit:
+static void codegen_counted_loop(codegen_t *codegen, instr_t *instr, int factor) {
+    instr_loop_t *loop = instr->instr_loop;
+    bool known = loop->count->kind == IMMEDIATE && loop->count->immediate > 0;
+    if (factor == UNROLL_FULL || (factor > 1 && known && factor >= loop->count->immediate)) {
+        codegen_full_unroll(codegen, instr, loop->count->immediate);
+        return;
+    }
+
+    char *head = codegen_new_label_name(codegen);
+    char *counter = codegen_expr(codegen, loop->counter);
+    if (!expr_equal(loop->counter, loop->count)) {
+        codegen_instr(codegen, new_move_instr("mov", loop->counter->register_, loop->count));
+    }
+    if (factor > 1 && known) {
+        for (int64_t i = 0; i < loop->count->immediate % factor; i++) {
+            codegen_instr_list(codegen, loop->body);
+            codegen_counter_op(codegen, "dec", counter, 0);
+        }
+        codegen_unrolled_body(codegen, loop, counter, factor, head);
+        return;
+    }
+
+    char *exit = NULL;
+    if (factor > 1) {
+        char *single = codegen_new_label_name(codegen);
+        char *rest = codegen_new_label_name(codegen);
+        codegen_insert_jump(codegen, "jmp", rest);
+        codegen_insert_label(codegen, single);
+        codegen_instr_list(codegen, loop->body);
+        codegen_counter_op(codegen, "dec", counter, 0);
+        codegen_insert_label(codegen, rest);
+        codegen_counter_op(codegen, "test", counter, factor - 1);
+        codegen_insert_jump(codegen, "jnz", single);
+    }
+    if (!known) {
+        exit = codegen_new_label_name(codegen);
+        asm_instruction_t *test = instruction_new(ASM_INSTR, "test");
+        instruction_add_arg(test, counter);
+        instruction_add_arg(test, counter);
+        codegen_insert_instruction(codegen, test);
+        codegen_insert_jump(codegen, "jz", exit);
+    }
+    if (factor > 1) {
+        codegen_unrolled_body(codegen, loop, counter, factor, head);
+    } else {
+        codegen_insert_align(codegen);
+        codegen_insert_label(codegen, head);
+        codegen_instr_list(codegen, loop->body);
+        codegen_counter_op(codegen, "dec", counter, 0);
+        codegen_insert_jump(codegen, "jnz", head);
+    }
+    if (exit != NULL) {
+        codegen_insert_label(codegen, exit);
+    }
+}
+
+void codegen_loop(codegen_t *codegen, instr_t *instr) {
+    instr_loop_t *loop = instr->instr_loop;
+    bool inherited;
+    int factor = codegen_unroll_factor(codegen, loop, &inherited);
+    bool known = loop->kind == LOOP_COUNTED && loop->count->kind == IMMEDIATE && loop->count->immediate > 0;
+    if (factor == UNROLL_FULL && !known) {
+        // A label-wide [unroll] only applies to the loops it can unroll completely.
+        if (!inherited) {
+            error("Only counted loops with a constant count can be fully unrolled", ERROR_INVALID);
+        }
+        factor = 1;
+    }
+    if (loop->kind == LOOP_WHILE) {
+        codegen_while(codegen, loop, factor);
+        return;
+    }
+    if (factor > 1 && !known && (factor & (factor - 1)) != 0) {
+        if (!inherited) {
+            error("Loops with a runtime count can only be unrolled by a power of two", ERROR_INVALID);
+        }
+        factor = 1;
+    }
+    codegen_counted_loop(codegen, instr, factor);
+}
+
+#define SWITCH_TABLE_MIN_CASES 4
+#define SWITCH_TABLE_MAX_ENTRIES 1024
+
+typedef struct {
+    int64_t value;
+    char *target;
+} switch_case_t;
+
+static int compare_switch_cases(const void *a, const void *b) {
+    int64_t x = ((const switch_case_t *) a)->value, y = ((const switch_case_t *) b)->value;
+    return (x > y) - (x < y);
+}
+
+static void codegen_switch_compare(codegen_t *codegen, expr_t *value, int64_t case_value) {
+    expr_list_t *operands = new_expr_list();
+    append_expr(operands, value);
+    append_expr(operands, new_expr_immediate(case_value));
+    codegen_compare(codegen, operands);
+}
+
+// A balanced search over the sorted cases: each compare settles the middle case and halves the rest.
+static void codegen_switch_search(codegen_t *codegen, expr_t *value, switch_case_t *cases, int len, char *default_target) {
+    if (len <= 3) {
+        for (int i = 0; i < len; i++) {
+            codegen_switch_compare(codegen, value, cases[i].value);
+            codegen_insert_jump(codegen, "je", cases[i].target);
+        }
+        codegen_insert_jump(codegen, "jmp", default_target);
+        return;
+    }
+    int mid = len / 2;
+    char *upper = codegen_new_label_name(codegen);
+    codegen_switch_compare(codegen, value, cases[mid].value);
+    codegen_insert_jump(codegen, "je", cases[mid].target);
+    codegen_insert_jump(codegen, "jg", upper);
+    codegen_switch_search(codegen, value, cases, mid, default_target);
+    codegen_insert_label(codegen, upper);
+    codegen_switch_search(codegen, value, cases + mid + 1, len - mid - 1, default_target);
+}
+
+// Jump tables live in .rodata, so their entries name the local labels through the label they belong to.
+static char *codegen_qualified_label(codegen_t *codegen, char *local) {
+    char *name = malloc(strlen(codegen->label->name) + strlen(local) + 1);
+    sprintf(name, "%s%s", codegen->label->name, local);
+    return name;
+}
+
+// Range check then `jmp [table + value*8 - min*8]`, values of the range without a case go to the default.
+static void codegen_switch_table(codegen_t *codegen, expr_t *value, switch_case_t *cases, int len, char *default_target) {
+    int64_t min = cases[0].value, max = cases[len - 1].value;
+    char *reg = codegen_expr(codegen, value);
+    if (min != 0) {
+        codegen_switch_compare(codegen, value, min);
+        codegen_insert_jump(codegen, "jl", default_target);
+    }
+    codegen_switch_compare(codegen, value, max);
+    // Starting at zero, negative values are huge unsigned ones: a single unsigned check covers both ends.
+    codegen_insert_jump(codegen, min == 0 ? "ja" : "jg", default_target);
+
+    char *table = malloc(strlen(codegen->label->name) + 32);
+    sprintf(table, "%s.table%d", codegen->label->name, codegen->count++);
+    string_list_t *entries = new_string_list();
+    char *default_entry = codegen_qualified_label(codegen, default_target);
+    for (int64_t v = min, i = 0; v <= max; v++) {
+        if (cases[i].value == v) {
+            append_string(entries, codegen_qualified_label(codegen, cases[i++].target));
+        } else {
+            append_string(entries, default_entry);
+        }
+    }
+    section_data_add_data(codegen->asm_->rodata, data_new(table, QWORD, entries));
+
+    char *target = malloc(strlen(table) + strlen(reg) + 64);
+    if (min == 0) {
+        sprintf(target, "[%s + %s*8]", table, reg);
+    } else {
+        sprintf(target, "[%s + %s*8 %c %lld]", table, reg, min > 0 ? '-' : '+', (long long) llabs(min * 8));
+    }
+    codegen_insert_jump(codegen, "jmp", target);
+}
+
+static bool fits_imm32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Dense enough cases, at least a third of the range, dispatch through a jump table unless [branch] asks
+// for compares; [table] asks for a table whatever the density.
+static bool codegen_use_switch_table(codegen_t *codegen, instr_switch_t *instr_switch, switch_case_t *cases) {
+    int len = instr_switch->len;
+    if (codegen->label == NULL || len == 0 || register_width(instr_switch->value->register_) != 64
+        || has_attribute(instr_switch->attributes, "branch")) {
+        return false;
+    }
+    uint64_t range = (uint64_t) cases[len - 1].value - (uint64_t) cases[0].value + 1;
+    if (range > SWITCH_TABLE_MAX_ENTRIES || !fits_imm32(cases[0].value * 8)) {
+        return false;
+    }
+    return has_attribute(instr_switch->attributes, "table") || (len >= SWITCH_TABLE_MIN_CASES && range <= 3 * (uint64_t) len);
+}
+
+//     dispatch (jump table or compares)
+//   case_0:
+//     body / jmp end
+//     ...
+//   default:
+//     body
+//   end:
+void codegen_switch(codegen_t *codegen, instr_switch_t *instr_switch) {
+    int len = instr_switch->len;
+    switch_case_t *cases = malloc(sizeof(switch_case_t) * (len + 1));
+    if (cases == NULL) {
+        error("Failed to allocate memory for switch", ERROR_ALLOC);
+    }
+    for (int i = 0; i < len; i++) {
+        if (!fits_imm32(instr_switch->cases[i])) {
+            error("Case values must fit in 32 bits", ERROR_INVALID);
+        }
+        cases[i].value = instr_switch->cases[i];
+        cases[i].target = codegen_new_label_name(codegen);
+    }
+    char **targets = malloc(sizeof(char *) * (len + 1));
+    for (int i = 0; i < len; i++) {
+        targets[i] = cases[i].target;
+    }
+    char *end = codegen_new_label_name(codegen);
+    bool has_default = instr_switch->default_instrs->len > 0;
+    char *default_target = has_default ? codegen_new_label_name(codegen) : end;
+
+    qsort(cases, len, sizeof(switch_case_t), compare_switch_cases);
+    if (codegen_use_switch_table(codegen, instr_switch, cases)) {
+        codegen_switch_table(codegen, instr_switch->value, cases, len, default_target);
+    } else {
+        codegen_switch_search(codegen, instr_switch->value, cases, len, default_target);
+    }
+
+    for (int i = 0; i <= len; i++) {
+        instr_list_t *arm = i < len ? instr_switch->bodies[i] : instr_switch->default_instrs;
+        if (i == len && !has_default) {
+            break;
+        }
+        codegen_insert_label(codegen, i < len ? targets[i] : default_target);
+        codegen_instr_list(codegen, arm);
+        bool last = i == len || (i == len - 1 && !has_default);
+        if (!last && (arm->len == 0 || !is_terminator(get_instr(arm, arm->len - 1)))) {
+            codegen_insert_jump(codegen, "jmp", end);
+        }
+    }
+    codegen_insert_label(codegen, end);
+    free(cases);
+    free(targets);
+}
+
+// Marks where the code of a profile block starts, so that samples of a build made with --profile-markers
+// can be mapped back to blocks. Nothing jumps to a marker, so unlike other labels it keeps the flags.
+static void codegen_profile_marker(codegen_t *codegen, uint64_t key) {
+    codegen->profile_key = key;
+    if (!codegen->config->profile_markers || codegen->label == NULL) {
+        return;
+    }
+    char *name = malloc(64);
+    snprintf(name, 64, ".P%016llx_%d", (unsigned long long) key, codegen->count++);
+    flags_state_t flags = codegen->flags;
+    codegen_insert_label(codegen, name);
+    codegen->flags = flags;
+}
+
+static uint64_t arm_profile_key(instr_if_t *instr_if, bool then) {
+    uint64_t key = profile_key(instr_if->profile_label, instr_if->profile_block + 1);
+    return then ? key : profile_else_key(key);
+}
+
+static void codegen_arm_marker(codegen_t *codegen, instr_if_t *instr_if, bool then) {
+    if (instr_if->profile_label != NULL) {
+        codegen_profile_marker(codegen, arm_profile_key(instr_if, then));
+    }
+}
+
+typedef enum {
+    ARM_INLINE,
+    ARM_UNLIKELY,
+    ARM_COLD
+} arm_placement_t;
+
+// An arm is cold or unlikely when marked so, or when the other arm is marked hot or likely.
+static arm_placement_t arm_placement(attribute_list_t *own, attribute_list_t *other) {
+    if (has_attribute(own, "cold") || (has_attribute(other, "hot") && !has_attribute(own, "hot"))) {
+        return ARM_COLD;
+    }
+    if (has_attribute(own, "unlikely") || (has_attribute(other, "likely") && !has_attribute(own, "likely"))) {
+        return ARM_UNLIKELY;
+    }
+    return ARM_INLINE;
+}
+
+// The less likely arm is moved out of line, after the body of the label, or to .text.unlikely when cold.
+// The other one stays on the fallthrough path and reaches the code after the if without a jump:
+//
+//     jcc sunk                    sunk:
+//     other arm                     sunk arm / jmp after
+//   after:
+static bool codegen_split_if(codegen_t *codegen, instr_if_t *instr_if) {
+    arm_placement_t then_placement = arm_placement(instr_if->attributes, instr_if->else_attributes);
+    arm_placement_t else_placement = arm_placement(instr_if->else_attributes, instr_if->attributes);
+    bool sink_then = then_placement > else_placement;
+    instr_list_t *sunk = sink_then ? instr_if->then_instrs : instr_if->else_instrs;
+    if (codegen->label == NULL || then_placement == else_placement || sunk->len == 0) {
+        return false;
+    }
+    char *label = codegen_new_label_name(codegen);
+    char *after = codegen_new_label_name(codegen);
+    codegen_cond_jump(codegen, instr_if->cond, sink_then, label);
+    codegen_arm_marker(codegen, instr_if, !sink_then);
+    codegen_instr_list(codegen, sink_then ? instr_if->else_instrs : instr_if->then_instrs);
+    codegen_insert_label(codegen, after);
+    codegen_defer_block(codegen, label, sunk, after, (sink_then ? then_placement : else_placement) == ARM_COLD);
+    if (instr_if->profile_label != NULL) {
+        codegen->deferred[codegen->deferred_len - 1].profile_key = arm_profile_key(instr_if, sink_then);
+    }
+    return true;
+}
+
+static void codegen_if(codegen_t *codegen, instr_if_t *instr_if) {
+    if (codegen_split_if(codegen, instr_if) || codegen_branchless_if(codegen, instr_if)) {
+        return;
+    }
+
+    instr_list_t *then_instrs = instr_if->then_instrs;
+    instr_list_t *else_instrs = instr_if->else_instrs;
+    char *label_after_name = codegen_new_label_name(codegen);
+
+    if (then_instrs->len == 0) {
+        // Nothing to do when the condition holds: jump straight over the else block.
+        codegen_cond_jump(codegen, instr_if->cond, true, label_after_name);
+        flags_state_t flags = codegen->flags;
+        codegen_arm_marker(codegen, instr_if, false);
+        codegen_instr_list(codegen, else_instrs);
+        flags_state_t else_flags = codegen->flags;
+        codegen_insert_label(codegen, label_after_name);
+        codegen->flags = codegen_merge_flags(instr_if->cond, flags, else_flags);
+        return;
+    }
+
+    // The then block is laid out on the fallthrough path, the inverted condition skips it.
+    char *label_else_name = else_instrs->len > 0 ? codegen_new_label_name(codegen) : label_after_name;
+    codegen_cond_jump(codegen, instr_if->cond, false, label_else_name);
+    flags_state_t flags = codegen->flags;
+    codegen_arm_marker(codegen, instr_if, true);
+    codegen_instr_list(codegen, then_instrs);
+    flags_state_t then_flags = codegen->flags;
+    if (is_terminator(get_instr(then_instrs, then_instrs->len - 1))) {
+        then_flags = flags;
+    }
+    if (else_instrs->len > 0) {
+        if (!is_terminator(get_instr(then_instrs, then_instrs->len - 1))) {
+            codegen_insert_jump(codegen, "jmp", label_after_name);
+        }
+        codegen_insert_label(codegen, label_else_name);
+        codegen->flags = codegen_merge_flags(instr_if->cond, flags, flags);
+        codegen_arm_marker(codegen, instr_if, false);
+        codegen_instr_list(codegen, else_instrs);
+        flags = codegen->flags;
+    }
+    codegen_insert_label(codegen, label_after_name);
+    codegen->flags = codegen_merge_flags(instr_if->cond, then_flags, flags);
+}
+
 void codegen_instr(codegen_t *codegen, instr_t *instr) {
     switch (instr->kind) {
         case INSTR_IF: {
-            char *arg0 = codegen_expr(codegen, get_expr(instr->instr_if->condition, 0));
-            char *arg1 = codegen_expr(codegen, get_expr(instr->instr_if->condition, 1));
-
-            char *op = cmp_kind_to_jmp(instr->instr_if->cmp);
-            asm_instruction_t *cmp = instruction_new(ASM_INSTR, "cmp");
-            instruction_add_arg(cmp, arg0);
-            instruction_add_arg(cmp, arg1);
-            codegen_insert_instruction(codegen, cmp);
-
-            asm_instruction_t *jmp = instruction_new(ASM_INSTR, op);
-            char* label_then_name = malloc(100);
-            snprintf(label_then_name, 100, ".L%d", codegen->count++);
-            instruction_add_arg(jmp, label_then_name);
-            codegen_insert_instruction(codegen, jmp);
-
-            asm_instruction_t *jmp_else = instruction_new(ASM_INSTR, "jmp");
-            char* label_else_name = malloc(100);
-            snprintf(label_else_name, 100, ".L%d", codegen->count++);
-            instruction_add_arg(jmp_else, label_else_name);
-            codegen_insert_instruction(codegen, jmp_else);
-            instr_list_t* then_instr = instr->instr_if->then_instrs;
-            instr_list_t* else_instr = instr->instr_if->else_instrs;
-            expr_list_t *args = new_expr_list();
-            char* label_after_name = malloc(100);
-            snprintf(label_after_name, 100, ".L%d", codegen->count++);
-            append_expr(args, new_expr_label(label_after_name));
-            instr_t* jmp_instr = new_asm_instr(
-                    new_instr_asm("jmp", args)
-                    );
-            append_instr(then_instr, jmp_instr);
-            append_instr(else_instr, jmp_instr);
-            label_t *label_then = new_label(label_then_name, new_call_abi("default", new_argument_list()), then_instr, new_attribute_list());
-            label_t *label_else = new_label(label_else_name, new_call_abi("default", new_argument_list()), else_instr, new_attribute_list());
-            codegen_label(codegen, label_then);
-            codegen_label(codegen, label_else);
-            asm_instruction_t *lab_after = instruction_new(ASM_LABEL, label_after_name);
-            codegen->current_label = lab_after;
-            codegen->entry_point = CODEGEN_LABEL;
-            codegen->should_add_label = 1;
+            instr_if_t *instr_if = instr->instr_if;
+            if (instr_if->profile_label == NULL) {
+                codegen_if(codegen, instr_if);
+                break;
+            }
+            // The code after the if belongs to the block the if is in.
+            uint64_t outer = codegen->profile_key;
+            codegen_profile_marker(codegen, profile_key(instr_if->profile_label, instr_if->profile_block));
+            codegen_if(codegen, instr_if);
+            codegen_profile_marker(codegen, outer);
             break;
         }
+        case INSTR_LOOP:
+            codegen_loop(codegen, instr);
+            break;
+        case INSTR_SWITCH:
+            codegen_switch(codegen, instr->instr_switch);
+            break;
         case INSTR_ASM: {
             asm_instruction_t *asm_instr = instruction_new(ASM_INSTR, instr->instr_asm->name);
             char **args = codegen_list_expr(codegen, instr->instr_asm->args);
@@ -191,29 +1082,49 @@ void codegen_instr(codegen_t *codegen, instr_t *instr) {
                 assert(0 && "Implement error message");
             }
             argument_list_t *args = callee->abi->args;
-            int arg_count = 0;
-            for (int i = 0; i < instr->instr_call->args->len; i++) {
+            expr_list_t *call_args = instr->instr_call->args;
+            register_kind_t *dsts = malloc(sizeof(register_kind_t) * (call_args->len + 1));
+            expr_t **srcs = malloc(sizeof(expr_t *) * (call_args->len + 1));
+            int move_count = 0;
+            int64_t pushed = 0;
+            for (int i = 0; i < call_args->len; i++) {
+                if (i >= args->len) {
+                    error("Too many arguments in call", ERROR_INVALID);
+                }
                 argument_t* arg = get_argument(args, i);
                 if (arg->kind == ARGUMENT_REGISTER) {
-                    if (arg_count >= callee->abi->args->len) {
-                        assert(0 && "Implement error message");
-                    }
-                    char* expr = codegen_expr(codegen, get_expr(instr->instr_call->args, i));
-                    arg_count++;
-                    asm_instruction_t *mov = instruction_new(ASM_INSTR, "mov");
-                    instruction_add_arg(mov, register_kind_to_string(arg->reg));
-                    instruction_add_arg(mov, expr);
-                    codegen_insert_instruction(codegen, mov);
+                    dsts[move_count] = arg->reg;
+                    srcs[move_count] = get_expr(call_args, i);
+                    move_count++;
                 } else if (arg->kind == ARGUMENT_STACK) {
-                    for (int j = arg_count; j < instr->instr_call->args->len; j++) {
-                        char* expr = codegen_expr(codegen, get_expr(instr->instr_call->args, j));
+                    // Pushes go before the register moves overwrite anything they read. Each one moves rsp, so
+                    // what is read through rsp afterwards is further from it.
+                    for (int j = i; j < call_args->len; j++) {
+                        expr_t *value = shift_rsp(get_expr(call_args, j), pushed);
+                        if (value->kind == MEMORY && value->memory.size == 0) {
+                            value = copy_expr(value);
+                            value->memory.size = 8;
+                        }
                         asm_instruction_t *push = instruction_new(ASM_INSTR, "push");
-                        instruction_add_arg(push, expr);
+                        instruction_add_arg(push, codegen_expr(codegen, value));
                         codegen_insert_instruction(codegen, push);
+                        pushed += 8;
                     }
                     break;
                 }
             }
+            for (int i = 0; i < move_count; i++) {
+                srcs[i] = shift_rsp(srcs[i], pushed);
+            }
+            codegen_instr_list(codegen, resolve_parallel_move(dsts, srcs, move_count));
+            free(dsts);
+            free(srcs);
+            if (instr->instr_call->tail) {
+                // Self tail recursion becomes a loop, other tail calls reuse our return address.
+                bool self = codegen->label != NULL && codegen->label == callee && codegen->loop_head != NULL;
+                codegen_insert_jump(codegen, "jmp", self ? codegen->loop_head : callee->name);
+                break;
+            }
             asm_instruction_t *call = instruction_new(ASM_INSTR, "call");
             instruction_add_arg(call, callee->name);
             codegen_insert_instruction(codegen, call);
@@ -222,66 +1133,184 @@ void codegen_instr(codegen_t *codegen, instr_t *instr) {
     }
 }
 
+void codegen_instr_list(codegen_t *codegen, instr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        codegen_instr(codegen, get_instr(list, i));
+    }
+}
+
+static bool has_self_tail_call(instr_list_t *list, label_t *label) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        if (instr->kind == INSTR_CALL && instr->instr_call->tail && strcmp(instr->instr_call->callee, label->name) == 0) {
+            return true;
+        }
+        if (instr->kind == INSTR_IF
+            && (has_self_tail_call(instr->instr_if->then_instrs, label) || has_self_tail_call(instr->instr_if->else_instrs, label))) {
+            return true;
+        }
+        if (instr->kind == INSTR_LOOP && has_self_tail_call(instr->instr_loop->body, label)) {
+            return true;
+        }
+        if (instr->kind == INSTR_SWITCH) {
+            for (int j = 0; j <= instr->instr_switch->len; j++) {
+                instr_list_t *arm = j < instr->instr_switch->len ? instr->instr_switch->bodies[j] : instr->instr_switch->default_instrs;
+                if (has_self_tail_call(arm, label)) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+void codegen_defer_block(codegen_t *codegen, char *name, instr_list_t *instrs, char *resume, bool cold) {
+    if (codegen->deferred_len >= codegen->deferred_capacity) {
+        codegen->deferred_capacity = codegen->deferred_capacity == 0 ? 4 : codegen->deferred_capacity * 2;
+        codegen->deferred = realloc(codegen->deferred, sizeof(codegen_block_t) * codegen->deferred_capacity);
+        if (codegen->deferred == NULL) {
+            error("Failed to allocate memory for deferred blocks", ERROR_ALLOC);
+        }
+    }
+    codegen_block_t block = {.name = name, .instrs = instrs, .resume = resume, .cold = cold, .emitted = false, .profile_key = 0};
+    codegen->deferred[codegen->deferred_len++] = block;
+}
+
+static void codegen_section_directive(codegen_t *codegen, char *section) {
+    asm_instruction_t *directive = instruction_new(ASM_INSTR, "section");
+    instruction_add_arg(directive, section);
+    codegen_insert_instruction(codegen, directive);
+}
+
+static void codegen_emit_block(codegen_t *codegen, int index) {
+    // Emitting a block may defer more of them and move the array.
+    codegen->deferred[index].emitted = true;
+    codegen_block_t block = codegen->deferred[index];
+    codegen_insert_label(codegen, block.name);
+    codegen_profile_marker(codegen, block.profile_key);
+    codegen_instr_list(codegen, block.instrs);
+    if (block.instrs->len == 0 || !is_terminator(get_instr(block.instrs, block.instrs->len - 1))) {
+        codegen_insert_jump(codegen, "jmp", block.resume);
+    }
+}
+
+// Deferred blocks go after the body of the label, the cold ones in .text.unlikely. NASM scopes local labels
+// by source order rather than by section, so the cold blocks still see the labels of the body.
+static void codegen_emit_deferred(codegen_t *codegen, char *section) {
+    for (int i = 0; i < codegen->deferred_len; i++) {
+        if (!codegen->deferred[i].cold) {
+            codegen_emit_block(codegen, i);
+        }
+    }
+    bool switched = false;
+    for (int i = 0; i < codegen->deferred_len; i++) {
+        if (codegen->deferred[i].emitted) {
+            continue;
+        }
+        if (!switched && strcmp(section, TEXT_UNLIKELY_SECTION) != 0) {
+            codegen_section_directive(codegen, TEXT_UNLIKELY_SECTION);
+            switched = true;
+        }
+        codegen_emit_block(codegen, i);
+    }
+    if (switched) {
+        codegen_section_directive(codegen, section);
+    }
+    codegen->deferred_len = 0;
+}
+
+static bool ends_with_terminator(instr_list_t *instrs) {
+    return instrs->len > 0 && is_terminator(get_instr(instrs, instrs->len - 1));
+}
+
+// Whether the code before label runs into it.
+static bool is_fallen_into(codegen_t *codegen, label_t *label) {
+    stmt_t *previous = NULL;
+    for (int i = 0; i < codegen->stmts->len; i++) {
+        stmt_t *stmt = get_stmt(codegen->stmts, i);
+        if (stmt->kind == STMT_LABEL && stmt->label == label) {
+            break;
+        }
+        if (stmt->kind == STMT_LABEL || stmt->kind == STMT_INSTR) {
+            previous = stmt;
+        }
+    }
+    if (previous == NULL) {
+        return false;
+    }
+    return previous->kind == STMT_INSTR ? !is_terminator(previous->instr) : !ends_with_terminator(previous->label->instrs);
+}
+
+// A label whose lowered body is the same as one emitted before becomes another name for it, placed right
+// before it: the body is emitted once. Both have to leave through a jmp or ret, since they would fall into
+// different code otherwise, and nothing may fall into the folded one. [address_significant] keeps a label
+// at an address of its own.
+static bool codegen_fold_label(codegen_t *codegen, label_t *label, asm_section_text_t *text, asm_instruction_t *l) {
+    if (has_attribute(label->attributes, "address_significant") || !ends_with_terminator(label->instrs)
+        || is_fallen_into(codegen, label)) {
+        return false;
+    }
+    char *body = canonical_body(l);
+    char *canonical = icf_find(codegen->icf, body, text);
+    if (canonical == NULL) {
+        icf_add(codegen->icf, body, label->name, text);
+        return false;
+    }
+    free(body);
+    if (section_text_insert_label_before(text, canonical, instruction_new(ASM_LABEL, label->name)) != 0) {
+        error("Failed to fold label", ERROR_ALLOC);
+    }
+    codegen->labels_folded++;
+    return true;
+}
+
 void codegen_label(codegen_t *codegen, label_t *label) {
     asm_instruction_t *l = instruction_new(ASM_LABEL, label->name);
-    call_abi_t *abi = label->abi;
-    if (has_attribute(label->attributes, "abi")) {
-        int index = find_attribute(label->attributes, "abi");
-        attribute_t *abi_attr = get_attribute(label->attributes, index);
-        if (has_argument(abi_attr, "C") > 0) {
-            abi = get_c_call_abi();
-        } else if (has_argument(abi_attr, "stack") > 0) {
-            abi = new_call_abi("stack", abi->args);
-            append_argument(abi->args, new_argument_stack());
-        }
-    }
-    label->abi = abi;
-    label_hashtable_insert(codegen->labels, label->name, label);
-    codegen_entry_point_t entry_point = codegen->entry_point;
-    asm_instruction_t *saved_label = NULL;
-    if (codegen->entry_point == CODEGEN_LABEL) {
-        saved_label = codegen->current_label;
+    // [hot] and [cold] labels get sections of their own, so they do not share cache lines and pages with the rest.
+    // Only a label that nothing falls into and that leaves through a jmp or ret can be moved away from its
+    // neighbours, the others stay where they are.
+    asm_section_text_t *text = codegen->asm_->text;
+    char *section = TEXT_SECTION;
+    bool movable = ends_with_terminator(label->instrs) && !is_fallen_into(codegen, label);
+    if (movable && has_attribute(label->attributes, "hot")) {
+        text = codegen->asm_->text_hot;
+        section = TEXT_HOT_SECTION;
+    } else if (movable && has_attribute(label->attributes, "cold")) {
+        text = codegen->asm_->text_unlikely;
+        section = TEXT_UNLIKELY_SECTION;
     }
-    if (codegen->should_add_label) {
-        section_text_add_instruction(codegen->asm_->text, codegen->current_label);
-        codegen->should_add_label = 0;
+    if (has_attribute(label->attributes, "global")) {
+        asm_instruction_t *global = instruction_new(ASM_INSTR, "global");
+        instruction_add_arg(global, label->name);
+        section_text_add_instruction(text, global);
     }
+    codegen_entry_point_t entry_point = codegen->entry_point;
+    asm_instruction_t *saved_label = codegen->current_label;
     codegen->entry_point = CODEGEN_LABEL;
     codegen->current_label = l;
-    for (int i = 0; i < label->instrs->len; i++) {
-        instr_t *instr = get_instr(label->instrs, i);
-        codegen_instr(codegen, instr);
-    }
-
-
-    section_text_add_instruction(codegen->asm_->text, l);
-    codegen->entry_point = entry_point;
-    if (codegen->entry_point == CODEGEN_LABEL) {
-        codegen->current_label = saved_label;
+    codegen->label = label;
+    codegen->loop_head = NULL;
+    codegen->flags.valid = false;
+    codegen->profile_key = profile_key(label->name, 0);
+    if (has_self_tail_call(label->instrs, label)) {
+        codegen->loop_head = codegen_new_label_name(codegen);
+        codegen_insert_label(codegen, codegen->loop_head);
     }
+    codegen_instr_list(codegen, label->instrs);
+    codegen_emit_deferred(codegen, section);
 
-    if (codegen->should_add_label) {
-        section_text_add_instruction(codegen->asm_->text, codegen->current_label);
-        codegen->should_add_label = 0;
+    if (!codegen_fold_label(codegen, label, text, l)) {
+        section_text_add_instruction(text, l);
     }
+    codegen->entry_point = entry_point;
+    codegen->current_label = saved_label;
+    codegen->label = NULL;
+    codegen->loop_head = NULL;
 }
 
 void codegen_extern(codegen_t *codegen, extern_t *extern_) {
     asm_instruction_t *extern_instr = instruction_new(ASM_INSTR, "extern");
     instruction_add_arg(extern_instr, extern_->name);
-    call_abi_t *abi = extern_->abi;
-    if (has_attribute(extern_->attributes, "abi")) {
-        int index = find_attribute(extern_->attributes, "abi");
-        attribute_t *abi_attr = get_attribute(extern_->attributes, index);
-        if (has_argument(abi_attr, "C") > 0) {
-            abi = get_c_call_abi();
-        } else if (has_argument(abi_attr, "stack") > 0) {
-            abi = new_call_abi("stack", abi->args);
-            append_argument(abi->args, new_argument_stack());
-        }
-    }
-    label_t* l = new_label(extern_->name, abi, new_instr_list(), extern_->attributes);
-    label_hashtable_insert(codegen->labels, extern_->name, l);
     codegen_insert_instruction(codegen, extern_instr);
 }
 
@@ -317,14 +1346,37 @@ void codegen_data(codegen_t *codegen, data_t *data) {
             append_string(value_list, codegen_expr(codegen, get_expr(data->values, i)));
         }
         asm_data_t *asm_data = data_new(data->name, size, value_list);
-        section_data_add_data(codegen->asm_->data, asm_data);
+        asm_section_data_t *section = codegen->asm_->data;
+        if (has_attribute(data->attributes, "rodata")) {
+            section = codegen->asm_->rodata;
+        } else if (has_attribute(data->attributes, "fini_array")) {
+            // Pointers to functions libc runs at exit.
+            section = codegen->asm_->fini_array;
+        }
+        section_data_add_data(section, asm_data);
     } else {
+        if (has_attribute(data->attributes, "rodata")) {
+            error("Read-only data must be initialized", ERROR_INVALID);
+        }
         asm_bss_t *asm_bss = bss_new(data->name, *bss_size_new(array_size, size));
         section_bss_add_bss(codegen->asm_->bss, asm_bss);
     }
 }
 
 void codegen(codegen_t *codegen) {
+    // Register every label first, so that calls can target labels defined further down.
+    for (int i = 0; i < codegen->stmts->len; i++) {
+        stmt_t *stmt = get_stmt(codegen->stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            stmt->label->abi = resolve_call_abi(stmt->label->abi, stmt->label->attributes);
+            label_hashtable_insert(codegen->labels, stmt->label->name, stmt->label);
+        } else if (stmt->kind == STMT_EXTERN) {
+            extern_t *extern_ = stmt->extern_;
+            extern_->abi = resolve_call_abi(extern_->abi, extern_->attributes);
+            label_t* l = new_label(extern_->name, extern_->abi, new_instr_list(), extern_->attributes);
+            label_hashtable_insert(codegen->labels, extern_->name, l);
+        }
+    }
 
     for (int i = 0; i < codegen->stmts->len; i++) {
         stmt_t *stmt = get_stmt(codegen->stmts, i);
@@ -343,15 +1395,11 @@ void codegen(codegen_t *codegen) {
                 break;
         }
     }
-
-    if (codegen->should_add_label) {
-        section_text_add_instruction(codegen->asm_->text, codegen->current_label);
-        codegen->should_add_label = 0;
-    }
 }
 
 void free_codegen(codegen_t *codegen) {
     free_stmt_list(codegen->stmts);
     asm_free(codegen->asm_);
+    free_icf_table(codegen->icf);
     free(codegen);
 }
@@ -3,6 +3,8 @@
 
 #include "ast.h"
 #include "asm.h"
+#include "target.h"
+#include "icf.h"
 
 
 
@@ -27,26 +29,63 @@ typedef enum {
     CODEGEN_LABEL
 } codegen_entry_point_t;
 
+typedef struct {
+    bool valid;
+    expr_t *lhs;
+    expr_t *rhs;
+} flags_state_t;
+
+// A block laid out after the body of its label, which continues at resume.
+typedef struct {
+    char *name;
+    instr_list_t *instrs;
+    char *resume;
+    bool cold;
+    bool emitted;
+    uint64_t profile_key;
+} codegen_block_t;
+
 typedef struct {
     stmt_list_t *stmts;
+    config_t *config;
+    target_t *target;
     label_hashtable_t *labels;
     asm_t *asm_;
     codegen_entry_point_t entry_point;
     asm_instruction_t *current_label;
-    int should_add_label;
+    label_t *label;
+    char *loop_head;
+    codegen_block_t *deferred;
+    int deferred_len;
+    int deferred_capacity;
     int count;
+    uint64_t profile_key;
+    flags_state_t flags;
+    icf_table_t *icf;
+    int labels_folded;
 } codegen_t;
 
 
-codegen_t *new_codegen(stmt_list_t *stmts);
+codegen_t *new_codegen(stmt_list_t *stmts, config_t *config);
 void codegen_insert_instruction(codegen_t *codegen, asm_instruction_t *instruction);
+char *codegen_new_label_name(codegen_t *codegen);
+void codegen_insert_label(codegen_t *codegen, char *name);
+void codegen_insert_jump(codegen_t *codegen, char *op, char *target);
 void codegen(codegen_t *codegen);
 void codegen_instr(codegen_t *codegen, instr_t *instr);
+void codegen_loop(codegen_t *codegen, instr_t *instr);
+void codegen_switch(codegen_t *codegen, instr_switch_t *instr_switch);
+void codegen_instr_list(codegen_t *codegen, instr_list_t *list);
+void codegen_compare(codegen_t *codegen, expr_list_t *operands);
+void codegen_cond_jump(codegen_t *codegen, cond_t *cond, bool jump_if, char *target);
+instr_list_t *resolve_parallel_move(register_kind_t *dsts, expr_t **srcs, int len);
+void codegen_defer_block(codegen_t *codegen, char *name, instr_list_t *instrs, char *resume, bool cold);
 void codegen_label(codegen_t *codegen, label_t *label);
 void codegen_extern(codegen_t *codegen, extern_t *extern_);
 void codegen_data(codegen_t *codegen, data_t *data);
 
 call_abi_t *get_c_call_abi();
+call_abi_t *resolve_call_abi(call_abi_t *abi, attribute_list_t *attributes);
 void free_codegen(codegen_t *codegen);
 
 #endif //ASMPP_CODEGEN_H
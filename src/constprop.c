@@ -0,0 +1,298 @@
+#include "constprop.h"
+#include "analysis.h"
+#include "codegen.h"
+#include <string.h>
+
+// Known values of the 16 general purpose registers, indexed by register family.
+typedef struct {
+    bool known[16];
+    int64_t values[16];
+} const_state_t;
+
+static const char *imm_source_instrs[] = {
+        "mov", "add", "sub", "and", "or", "xor", "cmp", "test", "adc", "sbb", "imul"
+};
+
+static bool is_gpr(register_kind_t reg) {
+    return reg != NO_REGISTER && reg < AH && register_family(reg) <= R15;
+}
+
+// The low bits of value, sign-extended back to 64 bits.
+static int64_t truncate_value(int64_t value, int bits) {
+    if (bits >= 64) {
+        return value;
+    }
+    uint64_t mask = (1ull << bits) - 1;
+    uint64_t low = (uint64_t) value & mask;
+    return (int64_t) ((low ^ (1ull << (bits - 1))) - (1ull << (bits - 1)));
+}
+
+static bool fits_imm32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static bool get_known(const_state_t *state, expr_t *expr, int64_t *value) {
+    if (expr->kind == IMMEDIATE) {
+        *value = expr->immediate;
+        return true;
+    }
+    if (expr->kind != REGISTER || !is_gpr(expr->register_) || !state->known[register_family(expr->register_)]) {
+        return false;
+    }
+    *value = truncate_value(state->values[register_family(expr->register_)], register_width(expr->register_));
+    return true;
+}
+
+static void kill(const_state_t *state, regset_t set) {
+    for (int i = 0; i <= R15; i++) {
+        if (set & regset_of(i)) {
+            state->known[i] = false;
+        }
+    }
+}
+
+// Writes value to reg with the x86 rules: 32-bit writes zero the upper half, narrower writes are not tracked.
+static void set_known(const_state_t *state, register_kind_t reg, int64_t value) {
+    register_kind_t family = register_family(reg);
+    if (register_width(reg) == 64) {
+        state->known[family] = true;
+        state->values[family] = value;
+    } else if (register_width(reg) == 32) {
+        state->known[family] = true;
+        state->values[family] = (int64_t) (uint32_t) value;
+    } else {
+        state->known[family] = false;
+    }
+}
+
+bool is_imm_source_instr(char *op) {
+    for (int i = 0; i < (int) (sizeof(imm_source_instrs) / sizeof(imm_source_instrs[0])); i++) {
+        if (strcmp(op, imm_source_instrs[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Replaces a known register source operand by its value when the instruction has an immediate form for it.
+static bool substitute_source(const_state_t *state, instr_asm_t *instr) {
+    if (!is_imm_source_instr(instr->name) || instr->args->len != 2) {
+        return false;
+    }
+    expr_t *dst = get_expr(instr->args, 0);
+    expr_t *src = get_expr(instr->args, 1);
+    int64_t value;
+    if (src->kind != REGISTER || expr_equal(dst, src) || !get_known(state, src, &value)) {
+        return false;
+    }
+    int bits = register_width(src->register_);
+    // Only mov r64 takes a full 64-bit immediate, everything else sign-extends an imm32.
+    bool wide = strcmp(instr->name, "mov") == 0 && dst->kind == REGISTER;
+    if (bits == 64 && !wide && !fits_imm32(value)) {
+        return false;
+    }
+    expr_t *imm = new_expr_immediate(value);
+    instr->args->exprs[1] = *imm;
+    if (dst->kind == MEMORY && dst->memory.size == 0) {
+        // The register used to give the store its size.
+        dst->memory.size = bits / 8;
+    }
+    return true;
+}
+
+static bool fold_instr(const_state_t *state, instr_asm_t *instr) {
+    char *op = instr->name;
+    expr_list_t *args = instr->args;
+    if (args->len == 0 || get_expr(args, 0)->kind != REGISTER || !is_gpr(get_expr(args, 0)->register_)) {
+        return false;
+    }
+    register_kind_t dst = get_expr(args, 0)->register_;
+    int bits = register_width(dst);
+    if (bits < 32) {
+        return false;
+    }
+    int64_t value, rhs = 0;
+    if (args->len == 2 && strcmp(op, "mov") == 0) {
+        if (!get_known(state, get_expr(args, 1), &value)) {
+            return false;
+        }
+        set_known(state, dst, value);
+        return true;
+    }
+    if (args->len == 2 && (strcmp(op, "xor") == 0 || strcmp(op, "sub") == 0)
+        && expr_equal(get_expr(args, 0), get_expr(args, 1))) {
+        set_known(state, dst, 0);
+        return true;
+    }
+    if (!get_known(state, get_expr(args, 0), &value)) {
+        return false;
+    }
+    if (args->len == 2 && !get_known(state, get_expr(args, 1), &rhs)) {
+        return false;
+    }
+    uint64_t a = (uint64_t) value, b = (uint64_t) rhs;
+    int shift = (int) (b & (bits == 64 ? 63 : 31));
+    if (args->len == 1 && strcmp(op, "inc") == 0) {
+        value = (int64_t) (a + 1);
+    } else if (args->len == 1 && strcmp(op, "dec") == 0) {
+        value = (int64_t) (a - 1);
+    } else if (args->len == 1 && strcmp(op, "neg") == 0) {
+        value = (int64_t) -a;
+    } else if (args->len == 1 && strcmp(op, "not") == 0) {
+        value = (int64_t) ~a;
+    } else if (args->len == 2 && strcmp(op, "add") == 0) {
+        value = (int64_t) (a + b);
+    } else if (args->len == 2 && strcmp(op, "sub") == 0) {
+        value = (int64_t) (a - b);
+    } else if (args->len == 2 && strcmp(op, "and") == 0) {
+        value = (int64_t) (a & b);
+    } else if (args->len == 2 && strcmp(op, "or") == 0) {
+        value = (int64_t) (a | b);
+    } else if (args->len == 2 && strcmp(op, "xor") == 0) {
+        value = (int64_t) (a ^ b);
+    } else if (args->len == 2 && strcmp(op, "imul") == 0) {
+        value = (int64_t) (a * b);
+    } else if (args->len == 2 && strcmp(op, "shl") == 0) {
+        value = (int64_t) (a << shift);
+    } else if (args->len == 2 && strcmp(op, "shr") == 0) {
+        value = (int64_t) ((bits == 64 ? a : (uint32_t) a) >> shift);
+    } else if (args->len == 2 && strcmp(op, "sar") == 0) {
+        value = bits == 64 ? value >> shift : (int64_t) ((int32_t) a >> shift);
+    } else {
+        return false;
+    }
+    set_known(state, dst, value);
+    return true;
+}
+
+// The register a call to name loads its argument at index into, NO_REGISTER when the argument is pushed.
+static register_kind_t call_arg_register(stmt_list_t *stmts, char *name, int index) {
+    call_abi_t *abi = NULL;
+    for (int i = 0; i < stmts->len && abi == NULL; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && strcmp(stmt->label->name, name) == 0) {
+            abi = resolve_call_abi(stmt->label->abi, stmt->label->attributes);
+        } else if (stmt->kind == STMT_EXTERN && strcmp(stmt->extern_->name, name) == 0) {
+            abi = resolve_call_abi(stmt->extern_->abi, stmt->extern_->attributes);
+        }
+    }
+    if (abi == NULL || index >= abi->args->len || get_argument(abi->args, index)->kind != ARGUMENT_REGISTER) {
+        return NO_REGISTER;
+    }
+    return get_argument(abi->args, index)->reg;
+}
+
+static void substitute_cond(const_state_t *state, cond_t *cond, opt_stats_t *stats) {
+    if (cond->kind != COND_CMP) {
+        substitute_cond(state, cond->lhs, stats);
+        if (cond->rhs != NULL) {
+            substitute_cond(state, cond->rhs, stats);
+        }
+        return;
+    }
+    // Only the right operand of cmp can be an immediate.
+    expr_t *lhs = get_expr(cond->operands, 0);
+    expr_t *rhs = get_expr(cond->operands, 1);
+    int64_t value;
+    if (rhs->kind == REGISTER && !expr_equal(lhs, rhs) && get_known(state, rhs, &value)
+        && (register_width(rhs->register_) < 64 || fits_imm32(value))) {
+        if (lhs->kind == MEMORY && lhs->memory.size == 0) {
+            // The register used to give the compare its size.
+            lhs->memory.size = register_width(rhs->register_) / 8;
+        }
+        cond->operands->exprs[1] = *new_expr_immediate(value);
+        stats->consts_propagated++;
+    }
+}
+
+static void propagate_list(stmt_list_t *stmts, const_state_t *state, instr_list_t *list, opt_stats_t *stats);
+
+static void propagate_instr(stmt_list_t *stmts, const_state_t *state, instr_t *instr, opt_stats_t *stats) {
+    regset_t uses, defs;
+    switch (instr->kind) {
+        case INSTR_IF: {
+            substitute_cond(state, instr->instr_if->cond, stats);
+            // Both arms start with what is known at the condition, after the join only what neither arm wrote.
+            const_state_t then_state = *state, else_state = *state;
+            propagate_list(stmts, &then_state, instr->instr_if->then_instrs, stats);
+            propagate_list(stmts, &else_state, instr->instr_if->else_instrs, stats);
+            instr_effects(instr, &uses, &defs);
+            kill(state, defs);
+            break;
+        }
+        case INSTR_LOOP: {
+            // The body is also entered from its own end: only what the loop never writes is still known.
+            instr_loop_t *loop = instr->instr_loop;
+            instr_effects(instr, &uses, &defs);
+            int64_t value;
+            if (loop->kind == LOOP_COUNTED && loop->count->kind == REGISTER && get_known(state, loop->count, &value)
+                && fits_imm32(value)) {
+                loop->count = new_expr_immediate(value);
+                stats->consts_propagated++;
+            }
+            kill(state, defs);
+            const_state_t body_state = *state;
+            propagate_list(stmts, &body_state, loop->body, stats);
+            if (loop->kind == LOOP_WHILE) {
+                substitute_cond(state, loop->cond, stats);
+            }
+            break;
+        }
+        case INSTR_SWITCH: {
+            instr_switch_t *instr_switch = instr->instr_switch;
+            for (int i = 0; i <= instr_switch->len; i++) {
+                const_state_t arm_state = *state;
+                propagate_list(stmts, &arm_state, i < instr_switch->len ? instr_switch->bodies[i] : instr_switch->default_instrs, stats);
+            }
+            instr_effects(instr, &uses, &defs);
+            kill(state, defs);
+            break;
+        }
+        case INSTR_CALL: {
+            expr_list_t *args = instr->instr_call->args;
+            for (int i = 0; i < args->len; i++) {
+                int64_t value;
+                expr_t *arg = get_expr(args, i);
+                register_kind_t param = call_arg_register(stmts, instr->instr_call->callee, i);
+                // An argument already in its register needs no move, an immediate would add one. Stack arguments
+                // are pushed, which only takes an imm32.
+                bool in_place = param != NO_REGISTER && arg->kind == REGISTER
+                                && register_family(arg->register_) == register_family(param);
+                if (arg->kind == REGISTER && !in_place && get_known(state, arg, &value) && fits_imm32(value)) {
+                    args->exprs[i] = *new_expr_immediate(value);
+                    stats->consts_propagated++;
+                }
+            }
+            instr_effects(instr, &uses, &defs);
+            kill(state, defs);
+            break;
+        }
+        case INSTR_ASM:
+            if (substitute_source(state, instr->instr_asm)) {
+                stats->consts_propagated++;
+            }
+            if (!fold_instr(state, instr->instr_asm)) {
+                instr_effects(instr, &uses, &defs);
+                kill(state, defs);
+            }
+            break;
+    }
+}
+
+static void propagate_list(stmt_list_t *stmts, const_state_t *state, instr_list_t *list, opt_stats_t *stats) {
+    for (int i = 0; i < list->len; i++) {
+        propagate_instr(stmts, state, get_instr(list, i), stats);
+    }
+}
+
+void propagate_constants(stmt_list_t *stmts, opt_stats_t *stats) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            // Labels can be entered from anywhere, nothing is known at their start.
+            const_state_t state;
+            memset(&state, 0, sizeof(state));
+            propagate_list(stmts, &state, stmt->label->instrs, stats);
+        }
+    }
+}
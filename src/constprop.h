@@ -0,0 +1,10 @@
+#ifndef ASMPP_CONSTPROP_H
+#define ASMPP_CONSTPROP_H
+
+#include "ast.h"
+#include "optimize.h"
+
+bool is_imm_source_instr(char *op);
+void propagate_constants(stmt_list_t *stmts, opt_stats_t *stats);
+
+#endif //ASMPP_CONSTPROP_H
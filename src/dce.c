@@ -0,0 +1,217 @@
+#include "dce.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    stmt_list_t *stmts;
+    bool *reachable;
+    int *worklist;
+    int worklist_len;
+} dce_t;
+
+static int dce_find_label(stmt_list_t *stmts, char *name) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && strcmp(stmt->label->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void dce_mark_index(dce_t *dce, int index) {
+    if (index == -1 || dce->reachable[index]) {
+        return;
+    }
+    dce->reachable[index] = true;
+    dce->worklist[dce->worklist_len++] = index;
+}
+
+static void dce_mark(dce_t *dce, char *name) {
+    dce_mark_index(dce, dce_find_label(dce->stmts, name));
+}
+
+// The label a piece of code at index falls into when it does not end with a jmp or ret.
+static int dce_next_label(stmt_list_t *stmts, int index) {
+    for (int i = index + 1; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            return i;
+        }
+        if (stmt->kind == STMT_INSTR) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static void dce_scan_exprs_of(dce_t *dce, expr_t *expr) {
+    if (expr->kind == LABEL) {
+        dce_mark(dce, expr->label);
+    } else if (expr->kind == MEMORY && expr->memory.label != NULL) {
+        dce_mark(dce, expr->memory.label);
+    }
+}
+
+static void dce_scan_exprs(dce_t *dce, expr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        dce_scan_exprs_of(dce, get_expr(list, i));
+    }
+}
+
+static void dce_scan_cond(dce_t *dce, cond_t *cond) {
+    if (cond->kind == COND_CMP) {
+        dce_scan_exprs(dce, cond->operands);
+        return;
+    }
+    dce_scan_cond(dce, cond->lhs);
+    if (cond->rhs != NULL) {
+        dce_scan_cond(dce, cond->rhs);
+    }
+}
+
+static void dce_scan_instrs(dce_t *dce, instr_list_t *list);
+
+// Every label referenced from reachable code is reachable: jump and call targets as well as taken addresses.
+static void dce_scan_instr(dce_t *dce, instr_t *instr) {
+    switch (instr->kind) {
+        case INSTR_IF:
+            dce_scan_cond(dce, instr->instr_if->cond);
+            dce_scan_instrs(dce, instr->instr_if->then_instrs);
+            dce_scan_instrs(dce, instr->instr_if->else_instrs);
+            break;
+        case INSTR_LOOP:
+            if (instr->instr_loop->kind == LOOP_WHILE) {
+                dce_scan_cond(dce, instr->instr_loop->cond);
+            } else {
+                dce_scan_exprs_of(dce, instr->instr_loop->count);
+            }
+            dce_scan_instrs(dce, instr->instr_loop->body);
+            break;
+        case INSTR_SWITCH:
+            for (int i = 0; i < instr->instr_switch->len; i++) {
+                dce_scan_instrs(dce, instr->instr_switch->bodies[i]);
+            }
+            dce_scan_instrs(dce, instr->instr_switch->default_instrs);
+            break;
+        case INSTR_ASM:
+            dce_scan_exprs(dce, instr->instr_asm->args);
+            break;
+        case INSTR_CALL:
+            dce_mark(dce, instr->instr_call->callee);
+            dce_scan_exprs(dce, instr->instr_call->args);
+            break;
+    }
+}
+
+static void dce_scan_instrs(dce_t *dce, instr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        dce_scan_instr(dce, get_instr(list, i));
+    }
+}
+
+static bool is_root_label(label_t *label) {
+    return has_attribute(label->attributes, "global")
+           || strcmp(label->name, "main") == 0
+           || strcmp(label->name, "_start") == 0;
+}
+
+void remove_unreachable_instrs(instr_list_t *list, opt_stats_t *stats) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        if (instr->kind == INSTR_IF) {
+            remove_unreachable_instrs(instr->instr_if->then_instrs, stats);
+            remove_unreachable_instrs(instr->instr_if->else_instrs, stats);
+        } else if (instr->kind == INSTR_LOOP) {
+            remove_unreachable_instrs(instr->instr_loop->body, stats);
+        } else if (instr->kind == INSTR_SWITCH) {
+            for (int j = 0; j < instr->instr_switch->len; j++) {
+                remove_unreachable_instrs(instr->instr_switch->bodies[j], stats);
+            }
+            remove_unreachable_instrs(instr->instr_switch->default_instrs, stats);
+        }
+        if (is_terminator(instr) && i + 1 < list->len) {
+            stats->instrs_removed += list->len - i - 1;
+            list->len = i + 1;
+            return;
+        }
+    }
+}
+
+void eliminate_dead_code(stmt_list_t *stmts, opt_stats_t *stats) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            remove_unreachable_instrs(stmt->label->instrs, stats);
+        }
+    }
+
+    dce_t dce = {
+            .stmts = stmts,
+            .reachable = calloc(stmts->len, sizeof(bool)),
+            .worklist = malloc(sizeof(int) * (stmts->len + 1)),
+            .worklist_len = 0
+    };
+    if (dce.reachable == NULL || dce.worklist == NULL) {
+        error("Failed to allocate memory for dead code elimination", ERROR_ALLOC);
+    }
+
+    bool has_root = false;
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        switch (stmt->kind) {
+            case STMT_LABEL:
+                if (is_root_label(stmt->label)) {
+                    dce_mark_index(&dce, i);
+                    has_root = true;
+                }
+                break;
+            case STMT_INSTR:
+                // Top-level code is always emitted, it may reference labels and fall into the next one.
+                dce_scan_instr(&dce, stmt->instr);
+                if (!is_terminator(stmt->instr)) {
+                    dce_mark_index(&dce, dce_next_label(stmts, i));
+                }
+                has_root = true;
+                break;
+            case STMT_DATA:
+                if (stmt->data->values != NULL) {
+                    dce_scan_exprs(&dce, stmt->data->values);
+                }
+                break;
+            case STMT_EXTERN:
+                break;
+        }
+    }
+
+    // Without an entry point or an exported label, every label may be used from outside: keep them all.
+    if (!has_root) {
+        free(dce.reachable);
+        free(dce.worklist);
+        return;
+    }
+
+    while (dce.worklist_len > 0) {
+        int index = dce.worklist[--dce.worklist_len];
+        label_t *label = get_stmt(stmts, index)->label;
+        dce_scan_instrs(&dce, label->instrs);
+        if (label->instrs->len == 0 || !is_terminator(get_instr(label->instrs, label->instrs->len - 1))) {
+            dce_mark_index(&dce, dce_next_label(stmts, index));
+        }
+    }
+
+    int len = 0;
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && !dce.reachable[i]) {
+            stats->labels_removed++;
+            stats->instrs_removed += stmt->label->instrs->len;
+            continue;
+        }
+        stmts->stmts[len++] = *stmt;
+    }
+    stmts->len = len;
+    free(dce.reachable);
+    free(dce.worklist);
+}
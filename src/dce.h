@@ -0,0 +1,10 @@
+#ifndef ASMPP_DCE_H
+#define ASMPP_DCE_H
+
+#include "ast.h"
+#include "optimize.h"
+
+void remove_unreachable_instrs(instr_list_t *list, opt_stats_t *stats);
+void eliminate_dead_code(stmt_list_t *stmts, opt_stats_t *stats);
+
+#endif //ASMPP_DCE_H
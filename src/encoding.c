@@ -0,0 +1,280 @@
+#include "encoding.h"
+#include "ast.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+typedef enum {
+    OPERAND_REGISTER,
+    OPERAND_MEMORY,
+    OPERAND_IMMEDIATE,
+    OPERAND_SYMBOL
+} operand_kind_t;
+
+typedef struct {
+    operand_kind_t kind;
+    register_kind_t reg;
+    int64_t immediate;
+    // Memory operands.
+    int size;
+    register_kind_t base;
+    register_kind_t index;
+    int64_t displacement;
+    bool has_label;
+} operand_t;
+
+static const char *directives[] = {"global", "extern", "section", "align", "default", "equ"};
+
+static const char *alu_ops[] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"};
+
+static const char *shift_ops[] = {"shl", "shr", "sar", "sal", "rol", "ror", "rcl", "rcr"};
+
+static const char *two_byte_ops[] = {
+        "movzx", "movsx", "bt", "bts", "btr", "btc", "bsf", "bsr", "popcnt", "lzcnt", "tzcnt", "xadd", "cmpxchg"
+};
+
+// Instructions that default to a 64-bit operand size, so they need no REX.W.
+static const char *default64_ops[] = {"push", "pop", "call", "jmp", "ret"};
+
+static bool in(const char **list, int len, char *op) {
+    for (int i = 0; i < len; i++) {
+        if (strcmp(list[i], op) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#define IN(list, op) in(list, sizeof(list) / sizeof(list[0]), op)
+
+static bool is_number(char *str) {
+    if (*str == '-') {
+        str++;
+    }
+    return isdigit(*str);
+}
+
+static bool needs_rex(register_kind_t reg) {
+    return reg != NO_REGISTER && ((register_family(reg) >= R8 && register_family(reg) <= R15)
+                                  || reg == SIL || reg == DIL || reg == BPL || reg == SPL);
+}
+
+// Reads back a memory operand printed by codegen_expr: [base + index*scale + label + disp].
+static void parse_memory_operand(char *str, operand_t *operand) {
+    char *sizes[] = {"byte ", "word ", "dword ", "qword "};
+    for (int i = 0; i < 4; i++) {
+        if (strncmp(str, sizes[i], strlen(sizes[i])) == 0) {
+            operand->size = 1 << i;
+        }
+    }
+    char *p = strchr(str, '[') + 1;
+    bool negative = false;
+    while (*p != '\0' && *p != ']') {
+        if (*p == ' ' || *p == '+') {
+            p++;
+            continue;
+        }
+        if (*p == '-') {
+            negative = true;
+            p++;
+            continue;
+        }
+        char term[64];
+        int len = 0;
+        while (*p != '\0' && *p != ']' && *p != ' ' && *p != '+' && *p != '-' && len < 63) {
+            term[len++] = *p++;
+        }
+        term[len] = '\0';
+        char *star = strchr(term, '*');
+        if (star != NULL) {
+            *star = '\0';
+        }
+        int reg = find_register_kind_by_name(term);
+        if (reg != -1 && star == NULL && operand->base == NO_REGISTER) {
+            operand->base = reg;
+        } else if (reg != -1) {
+            operand->index = reg;
+        } else if (is_number(term)) {
+            int64_t value = strtoll(term, NULL, 0);
+            operand->displacement += negative ? -value : value;
+        } else {
+            operand->has_label = true;
+        }
+        negative = false;
+    }
+}
+
+static operand_t parse_operand(char *str) {
+    operand_t operand = {.reg = NO_REGISTER, .base = NO_REGISTER, .index = NO_REGISTER};
+    int reg = find_register_kind_by_name(str);
+    if (reg != -1) {
+        operand.kind = OPERAND_REGISTER;
+        operand.reg = reg;
+    } else if (strchr(str, '[') != NULL) {
+        operand.kind = OPERAND_MEMORY;
+        parse_memory_operand(str, &operand);
+    } else if (is_number(str)) {
+        operand.kind = OPERAND_IMMEDIATE;
+        operand.immediate = strtoll(str, NULL, 0);
+    } else {
+        operand.kind = OPERAND_SYMBOL;
+    }
+    return operand;
+}
+
+static int memory_size(operand_t *operand) {
+    int size = 1;
+    register_kind_t base = operand->base == NO_REGISTER ? NO_REGISTER : register_family(operand->base);
+    if (operand->index != NO_REGISTER || base == RSP || base == R12
+        || (base == NO_REGISTER && !operand->has_label)) {
+        size++;
+    }
+    if (operand->has_label || base == NO_REGISTER) {
+        size += 4;
+    } else if (operand->displacement == 0 && base != RBP && base != R13) {
+        size += 0;
+    } else if (operand->displacement >= INT8_MIN && operand->displacement <= INT8_MAX) {
+        size += 1;
+    } else {
+        size += 4;
+    }
+    return size;
+}
+
+static bool fits_imm8(int64_t value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static int immediate_size(int width) {
+    return width >= 32 ? 4 : width / 8;
+}
+
+static int branch_size(char *op, operand_t *target, char *name) {
+    bool jcc = op[0] == 'j' && strcmp(op, "jmp") != 0;
+    if (target->kind == OPERAND_SYMBOL) {
+        // Local labels are usually close enough for a rel8.
+        if (name[0] == '.' && strcmp(op, "call") != 0) {
+            return 2;
+        }
+        return jcc ? 6 : 5;
+    }
+    int size = 2 + (needs_rex(target->reg) ? 1 : 0);
+    return target->kind == OPERAND_MEMORY ? size - 1 + memory_size(target) : size;
+}
+
+// An estimate of the encoded length of one instruction, following the usual x86-64 encoding rules:
+// prefixes, REX, opcode, ModRM/SIB, displacement and the shortest immediate.
+int estimate_instruction_size(asm_instruction_t *instruction) {
+    if (instruction->type == ASM_LABEL) {
+        return 0;
+    }
+    char *op = instruction->args[0];
+    int argc = instruction->arg_size - 1;
+    if (IN(directives, op)) {
+        return 0;
+    }
+    operand_t operands[3];
+    for (int i = 0; i < argc && i < 3; i++) {
+        operands[i] = parse_operand(instruction->args[i + 1]);
+    }
+    if (argc == 0) {
+        if (strcmp(op, "cqo") == 0 || strcmp(op, "cdqe") == 0 || strcmp(op, "syscall") == 0) {
+            return 2;
+        }
+        return 1;
+    }
+    if (op[0] == 'j' || strcmp(op, "call") == 0) {
+        return branch_size(op, &operands[0], instruction->args[1]);
+    }
+
+    int width = 0;
+    bool rex = false;
+    for (int i = 0; i < argc && i < 3; i++) {
+        if (operands[i].kind == OPERAND_REGISTER) {
+            if (width == 0 && register_width(operands[i].reg) > 0) {
+                width = register_width(operands[i].reg);
+            }
+            rex |= needs_rex(operands[i].reg);
+        } else if (operands[i].kind == OPERAND_MEMORY) {
+            if (width == 0 && operands[i].size != 0) {
+                width = operands[i].size * 8;
+            }
+            rex |= needs_rex(operands[i].base) || needs_rex(operands[i].index);
+        }
+    }
+    // movzx/movsx take their width from the destination only.
+    if (argc > 0 && operands[0].kind == OPERAND_REGISTER) {
+        width = register_width(operands[0].reg);
+    }
+    if (width == 0) {
+        width = 64;
+    }
+    rex |= width == 64 && !IN(default64_ops, op);
+
+    int size = (width == 16 ? 1 : 0) + (rex ? 1 : 0);
+    if (strcmp(op, "push") == 0 || strcmp(op, "pop") == 0) {
+        if (operands[0].kind == OPERAND_REGISTER) {
+            return size + 1;
+        }
+        if (operands[0].kind == OPERAND_IMMEDIATE) {
+            return fits_imm8(operands[0].immediate) ? 2 : 5;
+        }
+        return size + 1 + (operands[0].kind == OPERAND_MEMORY ? memory_size(&operands[0]) : 4);
+    }
+    if (strcmp(op, "mov") == 0 && argc == 2 && operands[0].kind == OPERAND_REGISTER
+        && (operands[1].kind == OPERAND_IMMEDIATE || operands[1].kind == OPERAND_SYMBOL)) {
+        // B8+r takes a full-width immediate, C7 /0 a sign-extended imm32 for 64-bit registers.
+        if (width == 64) {
+            bool imm32 = operands[1].kind == OPERAND_IMMEDIATE
+                         && operands[1].immediate >= INT32_MIN && operands[1].immediate <= INT32_MAX;
+            return imm32 ? size + 6 : size + 9;
+        }
+        return size + 1 + width / 8;
+    }
+
+    bool two_byte = IN(two_byte_ops, op) || strncmp(op, "set", 3) == 0 || strncmp(op, "cmov", 4) == 0
+                    || (strcmp(op, "imul") == 0 && argc == 2);
+    size += two_byte ? 2 : 1;
+    size += 1;
+    for (int i = 0; i < argc && i < 3; i++) {
+        if (operands[i].kind == OPERAND_MEMORY) {
+            size += memory_size(&operands[i]) - 1;
+        }
+    }
+
+    operand_t *last = &operands[argc < 3 ? argc - 1 : 2];
+    if (argc < 2 || (last->kind != OPERAND_IMMEDIATE && last->kind != OPERAND_SYMBOL)) {
+        return size;
+    }
+    if (last->kind == OPERAND_SYMBOL) {
+        return size + 4;
+    }
+    if (IN(shift_ops, op)) {
+        return last->immediate == 1 ? size : size + 1;
+    }
+    if ((IN(alu_ops, op) || strcmp(op, "imul") == 0) && fits_imm8(last->immediate)) {
+        return size + 1;
+    }
+    return size + immediate_size(width);
+}
+
+static int estimate_section_size(asm_section_text_t *text) {
+    int size = 0;
+    for (int i = 0; i < text->size; i++) {
+        asm_instruction_t *instruction = &text->instructions[i];
+        if (instruction->type == ASM_LABEL) {
+            for (int j = 0; j < instruction->instr_size; j++) {
+                size += estimate_instruction_size(&instruction->list[j]);
+            }
+        } else {
+            size += estimate_instruction_size(instruction);
+        }
+    }
+    return size;
+}
+
+int estimate_code_size(asm_t *asm_) {
+    return estimate_section_size(asm_->text) + estimate_section_size(asm_->text_hot)
+           + estimate_section_size(asm_->text_unlikely);
+}
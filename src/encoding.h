@@ -0,0 +1,9 @@
+#ifndef ASMPP_ENCODING_H
+#define ASMPP_ENCODING_H
+
+#include "asm.h"
+
+int estimate_instruction_size(asm_instruction_t *instruction);
+int estimate_code_size(asm_t *asm_);
+
+#endif //ASMPP_ENCODING_H
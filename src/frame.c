@@ -0,0 +1,596 @@
+#include "frame.h"
+#include "analysis.h"
+#include "lifetime.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// Locals are placed by depth: a local at depth k starts k bytes below the 16-byte aligned address right above
+// the return address, or below rsp once realigned, and ends size bytes after that.
+typedef struct {
+    stmt_list_t *stmts;
+    label_t *label;
+    opt_stats_t *stats;
+    lifetime_t *lifetimes;
+    // Locals whose address is taken, they may be used anywhere in the label.
+    bool *escaped;
+    int *depths;
+    // Where each local is from rsp once the frame is set up.
+    int64_t *offsets;
+    // Callee-saved registers the prologue pushes, after rbp when it sets up a frame pointer.
+    regset_t saved;
+    bool frame_pointer;
+    bool realign;
+    int align;
+    // Depths taken by the return address and the pushes of the prologue.
+    int reserved;
+    int pushed;
+    // Whether rsp-based operands of the instruction being rewritten are rebased over the prologue.
+    bool rebase;
+    // What the prologue takes from rsp, 0 when the locals sit in the red zone.
+    int frame_size;
+    // Bytes pushed since the frame was set up, -1 once rsp moves in a way we cannot follow.
+    int depth;
+} frame_t;
+
+// Callee-saved registers pushed at the very top of the label, which it saves by itself.
+static regset_t hand_saved(instr_list_t *list) {
+    regset_t set = 0;
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        if (instr->kind != INSTR_ASM || instr->instr_asm->args->len < 1) {
+            break;
+        }
+        char *op = instr->instr_asm->name;
+        expr_t *dst = get_expr(instr->instr_asm->args, 0);
+        if (strcmp(op, "push") == 0 && dst->kind == REGISTER && (regset_of(dst->register_) & sysv_callee_saved())) {
+            set |= regset_of(dst->register_);
+        } else if (strcmp(op, "mov") != 0 || !(set & regset_of(RBP)) || dst->kind != REGISTER || dst->register_ != RBP
+                   || get_expr(instr->instr_asm->args, 1)->kind != REGISTER
+                   || get_expr(instr->instr_asm->args, 1)->register_ != RSP) {
+            break;
+        }
+    }
+    return set;
+}
+
+// Whether the list leaves the label through a conditional jump, where no epilogue can go.
+static bool has_conditional_exit(instr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_ASM:
+                if (instr->instr_asm->name[0] == 'j' && strcmp(instr->instr_asm->name, "jmp") != 0) {
+                    return true;
+                }
+                break;
+            case INSTR_CALL:
+                break;
+            case INSTR_IF:
+                if (has_conditional_exit(instr->instr_if->then_instrs) || has_conditional_exit(instr->instr_if->else_instrs)) {
+                    return true;
+                }
+                break;
+            case INSTR_LOOP:
+                if (has_conditional_exit(instr->instr_loop->body)) {
+                    return true;
+                }
+                break;
+            case INSTR_SWITCH:
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    if (has_conditional_exit(instr->instr_switch->bodies[j])) {
+                        return true;
+                    }
+                }
+                if (has_conditional_exit(instr->instr_switch->default_instrs)) {
+                    return true;
+                }
+                break;
+        }
+    }
+    return false;
+}
+
+static int saved_count(frame_t *frame) {
+    return regset_count(frame->saved);
+}
+
+static bool has_frame(frame_t *frame) {
+    return frame->frame_size > 0 || frame->frame_pointer || frame->saved != 0;
+}
+
+static void frame_error(frame_t *frame, const char *message) {
+    char *error_message = malloc(strlen(message) + strlen(frame->label->name) + 16);
+    sprintf(error_message, "%s in label %s", message, frame->label->name);
+    error(error_message, ERROR_INVALID);
+}
+
+static int find_frame_local(frame_t *frame, expr_t *expr) {
+    if (expr->kind != MEMORY || expr->memory.label == NULL) {
+        return -1;
+    }
+    return find_local(frame->label->locals, expr->memory.label);
+}
+
+static void frame_visit(lifetime_scan_t *scan, instr_t *instr, expr_t *expr, int pos, bool read, bool write, bool fixed) {
+    frame_t *frame = scan->data;
+    int id = find_frame_local(frame, expr);
+    if (id == -1) {
+        return;
+    }
+    if (instr != NULL && instr->kind == INSTR_ASM && strcmp(instr->instr_asm->name, "lea") == 0) {
+        frame->escaped[id] = true;
+    }
+    lifetime_add_use(scan, id, pos, read, write, fixed);
+}
+
+// Whether nothing in the list calls or moves rsp, so that the red zone is left alone.
+static bool is_leaf(instr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_ASM: {
+                char *op = instr->instr_asm->name;
+                if (strcmp(op, "call") == 0) {
+                    return false;
+                }
+                regset_t uses, defs;
+                instr_effects(instr, &uses, &defs);
+                if ((defs & regset_of(RSP)) && strcmp(op, "ret") != 0) {
+                    return false;
+                }
+                break;
+            }
+            case INSTR_CALL:
+                return false;
+            case INSTR_IF:
+                if (!is_leaf(instr->instr_if->then_instrs) || !is_leaf(instr->instr_if->else_instrs)) {
+                    return false;
+                }
+                break;
+            case INSTR_LOOP:
+                if (!is_leaf(instr->instr_loop->body)) {
+                    return false;
+                }
+                break;
+            case INSTR_SWITCH:
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    if (!is_leaf(instr->instr_switch->bodies[j])) {
+                        return false;
+                    }
+                }
+                if (!is_leaf(instr->instr_switch->default_instrs)) {
+                    return false;
+                }
+                break;
+        }
+    }
+    return true;
+}
+
+static int round_up(int value, int align) {
+    return (value + align - 1) / align * align;
+}
+
+// Larger alignments first, then larger locals, so that padding is only needed between alignment classes.
+static int *placement_order(frame_t *frame, int *len) {
+    local_list_t *locals = frame->label->locals;
+    int *order = malloc(sizeof(int) * (locals->len + 1));
+    if (order == NULL) {
+        error("Failed to allocate memory for frame layout", ERROR_ALLOC);
+    }
+    *len = 0;
+    for (int i = 0; i < locals->len; i++) {
+        if (!frame->lifetimes[i].used) {
+            continue;
+        }
+        local_t *local = get_local(locals, i);
+        int j = *len;
+        while (j > 0) {
+            local_t *other = get_local(locals, order[j - 1]);
+            if (other->align > local->align || (other->align == local->align && other->size >= local->size)) {
+                break;
+            }
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+        (*len)++;
+    }
+    return order;
+}
+
+// First fit: each local goes as high as its alignment allows without sharing bytes with a local placed before
+// that is live at the same time. Returns the depth of the frame.
+static int place_locals(frame_t *frame, int *order, int len) {
+    local_list_t *locals = frame->label->locals;
+    int reserved = frame->reserved;
+    int frame_depth = reserved;
+    for (int i = 0; i < len; i++) {
+        local_t *local = get_local(locals, order[i]);
+        int depth = round_up(local->size + reserved, local->align);
+        bool shared = false;
+        for (int j = 0; j < i;) {
+            local_t *other = get_local(locals, order[j]);
+            int other_depth = frame->depths[order[j]];
+            bool overlap = other_depth - other->size < depth && depth - local->size < other_depth;
+            if (overlap && lifetimes_overlap(&frame->lifetimes[order[i]], &frame->lifetimes[order[j]])) {
+                depth = round_up(other_depth + local->size, local->align);
+                shared = false;
+                j = 0;
+                continue;
+            }
+            shared |= overlap;
+            j++;
+        }
+        frame->depths[order[i]] = depth;
+        frame_depth = depth > frame_depth ? depth : frame_depth;
+        if (shared) {
+            frame->stats->slots_shared++;
+        }
+    }
+    return frame_depth;
+}
+
+static instr_t *new_frame_instr(char *name, expr_t *dst, expr_t *src) {
+    expr_list_t *args = new_expr_list();
+    if (dst != NULL) {
+        append_expr(args, dst);
+    }
+    if (src != NULL) {
+        append_expr(args, src);
+    }
+    return new_asm_instr(new_instr_asm(name, args));
+}
+
+static instr_t *new_rsp_lea(int64_t offset) {
+    return new_frame_instr("lea", new_expr_register(RSP), new_expr_memory(RSP, NO_REGISTER, 1, offset));
+}
+
+static void append_prologue(frame_t *frame, instr_list_t *out) {
+    if (frame->frame_pointer) {
+        append_instr(out, new_frame_instr("push", new_expr_register(RBP), NULL));
+        append_instr(out, new_frame_instr("mov", new_expr_register(RBP), new_expr_register(RSP)));
+    }
+    for (int reg = RAX; reg <= R15; reg++) {
+        if (frame->saved & regset_of(reg)) {
+            append_instr(out, new_frame_instr("push", new_expr_register(reg), NULL));
+        }
+    }
+    if (frame->realign) {
+        append_instr(out, new_frame_instr("and", new_expr_register(RSP), new_expr_immediate(-frame->align)));
+    }
+    // lea leaves the flags alone, they may be live into or out of the label.
+    if (frame->frame_size > 0) {
+        append_instr(out, new_rsp_lea(-frame->frame_size));
+    }
+}
+
+static void append_epilogue(frame_t *frame, instr_list_t *out) {
+    if (frame->realign && frame->saved == 0) {
+        append_instr(out, new_frame_instr("leave", NULL, NULL));
+        return;
+    }
+    if (frame->realign) {
+        append_instr(out, new_frame_instr("lea", new_expr_register(RSP),
+                                          new_expr_memory(RBP, NO_REGISTER, 1, -8 * (int64_t) saved_count(frame))));
+    } else if (frame->frame_size > 0) {
+        append_instr(out, new_rsp_lea(frame->frame_size));
+    }
+    for (int reg = R15; reg >= RAX; reg--) {
+        if (frame->saved & regset_of(reg)) {
+            append_instr(out, new_frame_instr("pop", new_expr_register(reg), NULL));
+        }
+    }
+    if (frame->frame_pointer) {
+        append_instr(out, new_frame_instr("pop", new_expr_register(RBP), NULL));
+    }
+}
+
+// Operands the label addresses from rsp by itself, stack arguments say, are written as if there were no
+// prologue.
+static void rebase_rsp_operand(frame_t *frame, expr_t *expr) {
+    if (!frame->realign) {
+        expr->memory.displacement += frame->pushed + frame->frame_size;
+        return;
+    }
+    if (frame->depth < 0) {
+        frame_error(frame, "Stack arguments cannot be found once rsp is moved");
+    }
+    expr->memory.base = RBP;
+    expr->memory.displacement += 8 - frame->depth;
+}
+
+static void frame_rewrite_expr(frame_t *frame, expr_t *expr) {
+    int id = find_frame_local(frame, expr);
+    if (id == -1) {
+        if (frame->rebase && expr->kind == MEMORY && expr->memory.base == RSP && expr->memory.label == NULL) {
+            rebase_rsp_operand(frame, expr);
+        }
+        return;
+    }
+    if (frame->depth < 0) {
+        frame_error(frame, "Locals cannot be found once rsp is moved");
+    }
+    if (expr->memory.base != NO_REGISTER) {
+        if (expr->memory.index != NO_REGISTER || expr->memory.base == RSP) {
+            frame_error(frame, "Too many registers in a memory operand naming a local");
+        }
+        expr->memory.index = expr->memory.base;
+        expr->memory.scale = 1;
+    }
+    expr->memory.base = RSP;
+    expr->memory.label = NULL;
+    expr->memory.displacement += frame->offsets[id] + frame->depth;
+}
+
+static void frame_rewrite_exprs(frame_t *frame, expr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        frame_rewrite_expr(frame, get_expr(list, i));
+    }
+}
+
+static void frame_rewrite_cond(frame_t *frame, cond_t *cond) {
+    if (cond->kind == COND_CMP) {
+        frame_rewrite_exprs(frame, cond->operands);
+        return;
+    }
+    frame_rewrite_cond(frame, cond->lhs);
+    if (cond->rhs != NULL) {
+        frame_rewrite_cond(frame, cond->rhs);
+    }
+}
+
+// Follows the bytes pushed on top of the frame, so that locals stay addressable from rsp.
+static void track_depth(frame_t *frame, instr_t *instr) {
+    if (frame->depth < 0 || instr->kind != INSTR_ASM) {
+        return;
+    }
+    char *op = instr->instr_asm->name;
+    expr_list_t *args = instr->instr_asm->args;
+    if (strcmp(op, "push") == 0 || strcmp(op, "pop") == 0) {
+        frame->depth += op[1] == 'u' ? 8 : -8;
+        return;
+    }
+    if (args->len == 2 && get_expr(args, 0)->kind == REGISTER && get_expr(args, 0)->register_ == RSP) {
+        expr_t *src = get_expr(args, 1);
+        if ((strcmp(op, "sub") == 0 || strcmp(op, "add") == 0) && src->kind == IMMEDIATE) {
+            frame->depth += (int) (op[0] == 's' ? src->immediate : -src->immediate);
+            return;
+        }
+        if (strcmp(op, "lea") == 0 && src->kind == MEMORY && src->memory.base == RSP
+            && src->memory.index == NO_REGISTER && src->memory.label == NULL) {
+            frame->depth -= (int) src->memory.displacement;
+            return;
+        }
+    }
+    regset_t uses, defs;
+    instr_effects(instr, &uses, &defs);
+    if ((defs & regset_of(RSP)) && strcmp(op, "ret") != 0) {
+        frame->depth = -1;
+    }
+}
+
+static bool is_exit(instr_t *instr) {
+    return instr->kind == INSTR_ASM && (strcmp(instr->instr_asm->name, "ret") == 0 || instr->instr_asm->name[0] == 'j');
+}
+
+static void frame_rewrite_list(frame_t *frame, instr_list_t *list);
+
+// The depth after an arm, or -2 when it ends the label and does not count.
+static int frame_rewrite_arm(frame_t *frame, instr_list_t *arm, int depth) {
+    frame->depth = depth;
+    frame_rewrite_list(frame, arm);
+    return arm->len > 0 && is_terminator(get_instr(arm, arm->len - 1)) ? -2 : frame->depth;
+}
+
+// Arms that fall through must agree on the depth, or it is unknown after them.
+static int merge_depth(int a, int b) {
+    if (a == -2 || b == -2) {
+        return a == -2 ? b : a;
+    }
+    return a == b ? a : -1;
+}
+
+// A tail jump runs after the epilogue, so the label it goes to cannot take arguments in restored registers.
+static void check_tail_jump(frame_t *frame, instr_t *instr) {
+    expr_list_t *args = instr->instr_asm->args;
+    if (strcmp(instr->instr_asm->name, "jmp") != 0 || args->len != 1 || get_expr(args, 0)->kind != LABEL) {
+        return;
+    }
+    regset_t restored = frame->saved | (frame->frame_pointer ? regset_of(RBP) : 0);
+    for (int i = 0; i < frame->stmts->len; i++) {
+        stmt_t *stmt = get_stmt(frame->stmts, i);
+        if (stmt->kind != STMT_LABEL || strcmp(stmt->label->name, get_expr(args, 0)->label) != 0) {
+            continue;
+        }
+        argument_list_t *abi_args = stmt->label->abi->args;
+        for (int j = 0; j < abi_args->len; j++) {
+            argument_t *arg = get_argument(abi_args, j);
+            if (arg->kind == ARGUMENT_REGISTER && (regset_of(arg->reg) & restored)) {
+                frame_error(frame, "Tail jump passes an argument in a register the epilogue restores");
+            }
+        }
+    }
+}
+
+static void frame_rewrite_instr(frame_t *frame, instr_t *instr, instr_list_t *out) {
+    int depth = frame->depth;
+    switch (instr->kind) {
+        case INSTR_ASM: {
+            expr_list_t *args = instr->instr_asm->args;
+            // lea rsp, [rsp - n] and the like move rsp relative to itself.
+            frame->rebase = args->len == 0 || get_expr(args, 0)->kind != REGISTER || get_expr(args, 0)->register_ != RSP;
+            frame_rewrite_exprs(frame, args);
+            frame->rebase = true;
+            if (has_frame(frame) && is_exit(instr)) {
+                if (instr->instr_asm->name[0] == 'j' && strcmp(instr->instr_asm->name, "jmp") != 0) {
+                    frame_error(frame, "Conditional jump out of a label with a stack frame");
+                }
+                check_tail_jump(frame, instr);
+                if (frame->depth != 0) {
+                    frame_error(frame, "Unbalanced stack when leaving a label with a stack frame");
+                }
+                append_epilogue(frame, out);
+            }
+            append_instr(out, instr);
+            track_depth(frame, instr);
+            return;
+        }
+        case INSTR_CALL:
+            frame_rewrite_exprs(frame, instr->instr_call->args);
+            if (instr->instr_call->tail && has_frame(frame)) {
+                // The epilogue has to run after the call, which goes back to being a call and a ret.
+                instr->instr_call->tail = false;
+                frame->stats->tail_calls--;
+                append_instr(out, instr);
+                frame_rewrite_instr(frame, new_asm_instr(new_instr_asm("ret", new_expr_list())), out);
+                return;
+            }
+            break;
+        case INSTR_IF: {
+            frame_rewrite_cond(frame, instr->instr_if->cond);
+            int then_depth = frame_rewrite_arm(frame, instr->instr_if->then_instrs, depth);
+            int else_depth = frame_rewrite_arm(frame, instr->instr_if->else_instrs, depth);
+            frame->depth = merge_depth(then_depth, else_depth);
+            break;
+        }
+        case INSTR_LOOP: {
+            instr_loop_t *loop = instr->instr_loop;
+            if (loop->kind == LOOP_WHILE) {
+                frame_rewrite_cond(frame, loop->cond);
+            } else {
+                frame_rewrite_expr(frame, loop->counter);
+                if (loop->count != loop->counter) {
+                    frame_rewrite_expr(frame, loop->count);
+                }
+            }
+            int body_depth = frame_rewrite_arm(frame, loop->body, depth);
+            frame->depth = body_depth == depth || body_depth == -2 ? depth : -1;
+            break;
+        }
+        case INSTR_SWITCH: {
+            instr_switch_t *instr_switch = instr->instr_switch;
+            frame_rewrite_expr(frame, instr_switch->value);
+            int arms_depth = frame_rewrite_arm(frame, instr_switch->default_instrs, depth);
+            for (int i = 0; i < instr_switch->len; i++) {
+                arms_depth = merge_depth(arms_depth, frame_rewrite_arm(frame, instr_switch->bodies[i], depth));
+            }
+            frame->depth = arms_depth;
+            break;
+        }
+    }
+    // Every arm ends the label.
+    if (frame->depth == -2) {
+        frame->depth = depth;
+    }
+    append_instr(out, instr);
+}
+
+static void frame_rewrite_list(frame_t *frame, instr_list_t *list) {
+    instr_list_t *out = new_instr_list();
+    for (int i = 0; i < list->len; i++) {
+        frame_rewrite_instr(frame, get_instr(list, i), out);
+    }
+    list->len = out->len;
+    list->capacity = out->capacity;
+    list->instrs = out->instrs;
+}
+
+// Under the C ABI, the prologue saves the callee-saved registers the label overwrites, unless it pushes them
+// itself first thing, and sets up a frame pointer when asked to. Leaf labels whose locals fit in the red zone
+// address them below rsp. Otherwise the prologue moves rsp by a multiple of 16 bytes in all, so that calls stay
+// aligned as written, and locals aligned past 16 bytes have the frame realigned through rbp.
+static void layout_label(stmt_list_t *stmts, label_t *label, config_t *config, opt_stats_t *stats) {
+    int len = label->locals->len;
+    frame_t frame = {.stmts = stmts, .label = label, .stats = stats};
+    frame.escaped = calloc(len + 1, sizeof(bool));
+    frame.depths = calloc(len + 1, sizeof(int));
+    frame.offsets = calloc(len + 1, sizeof(int64_t));
+    if (frame.escaped == NULL || frame.depths == NULL || frame.offsets == NULL) {
+        error("Failed to allocate memory for frame layout", ERROR_ALLOC);
+    }
+    lifetime_scan_t *scan = new_lifetime_scan(frame_visit, &frame);
+    scan_lifetimes(scan, label->instrs);
+    frame.lifetimes = build_lifetimes(scan, len);
+    for (int i = 0; i < len; i++) {
+        if (frame.escaped[i]) {
+            frame.lifetimes[i].start = 0;
+            frame.lifetimes[i].end = scan->pos;
+        }
+    }
+
+    int order_len;
+    int *order = placement_order(&frame, &order_len);
+    frame.align = order_len > 0 ? get_local(label->locals, order[0])->align : 1;
+    frame.realign = frame.align > 16;
+    // A conditional jump out leaves no room for restoring saved registers, such labels are left as written.
+    if (has_c_abi(label->attributes) && !has_conditional_exit(label->instrs)) {
+        regset_t hand = hand_saved(label->instrs);
+        frame.saved = instr_list_writes(stmts, label->instrs) & sysv_callee_saved() & ~regset_of(RSP) & ~hand;
+        frame.frame_pointer = config->frame_pointer && !(hand & regset_of(RBP));
+    }
+    if (frame.realign) {
+        if (instr_list_regs(label->instrs) & regset_of(RBP)) {
+            frame_error(&frame, "Locals aligned past 16 bytes need rbp, which the label uses");
+        }
+        frame.frame_pointer = true;
+    }
+    if (frame.frame_pointer) {
+        frame.saved &= ~regset_of(RBP);
+    }
+    int pushed = 8 * (frame.frame_pointer + saved_count(&frame));
+    frame.pushed = pushed;
+    frame.rebase = true;
+    if (order_len > 0 || pushed > 0) {
+        stats->regs_saved += saved_count(&frame);
+        frame.reserved = frame.realign ? 0 : 8 + pushed;
+        int frame_depth = place_locals(&frame, order, order_len);
+        int base;
+        if (frame.realign) {
+            frame.frame_size = round_up(frame_depth, 16) + 8;
+            base = frame.frame_size;
+        } else if (frame_depth - frame.reserved <= FRAME_RED_ZONE && is_leaf(label->instrs)
+                   && !(instr_list_regs(label->instrs) & regset_of(RSP))) {
+            base = 8 + pushed;
+        } else {
+            int total = round_up(frame_depth - 8 > pushed ? frame_depth - 8 : pushed, 16);
+            frame.frame_size = total - pushed;
+            base = 8 + total;
+        }
+        for (int i = 0; i < len; i++) {
+            frame.offsets[i] = base - frame.depths[i];
+        }
+        frame.depth = 0;
+        frame_rewrite_list(&frame, label->instrs);
+        if (has_frame(&frame)) {
+            instr_list_t *body = new_instr_list();
+            append_prologue(&frame, body);
+            for (int i = 0; i < label->instrs->len; i++) {
+                append_instr(body, get_instr(label->instrs, i));
+            }
+            if (label->instrs->len == 0 || !is_terminator(get_instr(label->instrs, label->instrs->len - 1))) {
+                append_epilogue(&frame, body);
+            }
+            label->instrs = body;
+        }
+    }
+    free(order);
+    free_lifetime_scan(scan);
+    free(frame.lifetimes);
+    free(frame.escaped);
+    free(frame.depths);
+    free(frame.offsets);
+}
+
+// Runs once the other passes are done with the bodies, so that only what is left of them needs saving. Until
+// then, locals are memory operands like any named one.
+void layout_frames(stmt_list_t *stmts, config_t *config, opt_stats_t *stats) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && (stmt->label->locals->len > 0 || has_c_abi(stmt->label->attributes))) {
+            layout_label(stmts, stmt->label, config, stats);
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef ASMPP_FRAME_H
+#define ASMPP_FRAME_H
+
+#include "ast.h"
+#include "cli.h"
+#include "optimize.h"
+
+// Bytes below rsp that SysV leaves alone for leaf functions.
+#define FRAME_RED_ZONE 128
+
+void layout_frames(stmt_list_t *stmts, config_t *config, opt_stats_t *stats);
+
+#endif //ASMPP_FRAME_H
@@ -0,0 +1,129 @@
+#include "icf.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+icf_table_t *new_icf_table() {
+    icf_table_t *table = malloc(sizeof(icf_table_t));
+    if (table == NULL) {
+        error("Failed to allocate memory for code folding", ERROR_ALLOC);
+    }
+    table->len = 0;
+    table->capacity = 16;
+    table->entries = malloc(sizeof(icf_entry_t) * table->capacity);
+    if (table->entries == NULL) {
+        error("Failed to allocate memory for code folding", ERROR_ALLOC);
+    }
+    return table;
+}
+
+typedef struct {
+    char **names;
+    int len;
+    int capacity;
+} local_names_t;
+
+// Local labels are numbered across the whole file, so they are renamed by order of first use.
+static int local_index(local_names_t *locals, char *name) {
+    for (int i = 0; i < locals->len; i++) {
+        if (strcmp(locals->names[i], name) == 0) {
+            return i;
+        }
+    }
+    if (locals->len >= locals->capacity) {
+        locals->capacity = locals->capacity == 0 ? 8 : locals->capacity * 2;
+        locals->names = realloc(locals->names, sizeof(char *) * locals->capacity);
+        if (locals->names == NULL) {
+            error("Failed to allocate memory for code folding", ERROR_ALLOC);
+        }
+    }
+    locals->names[locals->len] = malloc(strlen(name) + 1);
+    if (locals->names[locals->len] == NULL) {
+        error("Failed to allocate memory for code folding", ERROR_ALLOC);
+    }
+    strcpy(locals->names[locals->len], name);
+    return locals->len++;
+}
+
+static void canonical_text(string_buffer_t *buffer, local_names_t *locals, char *text) {
+    for (char *c = text; *c != '\0';) {
+        bool local = c[0] == '.' && c[1] == 'L' && isdigit((unsigned char) c[2])
+                     && (c == text || !(isalnum((unsigned char) c[-1]) || c[-1] == '_'));
+        if (!local) {
+            char one[2] = {*c++, '\0'};
+            string_buffer_write(buffer, one);
+            continue;
+        }
+        char name[32];
+        int len = 2;
+        while (isdigit((unsigned char) c[len]) && len < (int) sizeof(name) - 1) {
+            len++;
+        }
+        memcpy(name, c, len);
+        name[len] = '\0';
+        string_buffer_printf(buffer, ".L#%d", local_index(locals, name));
+        c += len;
+    }
+}
+
+// The instructions of label, one per line, with its local labels renamed.
+char *canonical_body(asm_instruction_t *label) {
+    string_buffer_t *buffer = new_string_buffer();
+    local_names_t locals = {.names = NULL, .len = 0, .capacity = 0};
+    for (int i = 0; i < label->instr_size; i++) {
+        asm_instruction_t *instruction = &label->list[i];
+        for (int j = 0; j < instruction->arg_size; j++) {
+            string_buffer_write(buffer, j == 0 ? "" : (j == 1 ? " " : ", "));
+            canonical_text(buffer, &locals, instruction->args[j]);
+        }
+        string_buffer_write(buffer, instruction->type == ASM_LABEL ? ":\n" : "\n");
+    }
+    for (int i = 0; i < locals.len; i++) {
+        free(locals.names[i]);
+    }
+    free(locals.names);
+    char *body = buffer->data;
+    free(buffer);
+    return body;
+}
+
+static uint64_t hash_body(char *body) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char *c = body; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char) *c) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// The label emitted earlier in section with the same body, NULL if there is none.
+char *icf_find(icf_table_t *table, char *body, asm_section_text_t *section) {
+    uint64_t hash = hash_body(body);
+    for (int i = 0; i < table->len; i++) {
+        icf_entry_t *entry = &table->entries[i];
+        if (entry->hash == hash && entry->section == section && strcmp(entry->body, body) == 0) {
+            return entry->name;
+        }
+    }
+    return NULL;
+}
+
+void icf_add(icf_table_t *table, char *body, char *name, asm_section_text_t *section) {
+    if (table->len >= table->capacity) {
+        table->capacity *= 2;
+        table->entries = realloc(table->entries, sizeof(icf_entry_t) * table->capacity);
+        if (table->entries == NULL) {
+            error("Failed to reallocate memory for code folding", ERROR_ALLOC);
+        }
+    }
+    icf_entry_t entry = {.hash = hash_body(body), .body = body, .name = name, .section = section};
+    table->entries[table->len++] = entry;
+}
+
+void free_icf_table(icf_table_t *table) {
+    for (int i = 0; i < table->len; i++) {
+        free(table->entries[i].body);
+    }
+    free(table->entries);
+    free(table);
+}
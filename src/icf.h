@@ -0,0 +1,28 @@
+#ifndef ASMPP_ICF_H
+#define ASMPP_ICF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "asm.h"
+
+// A label body already emitted, in the form bodies are compared in.
+typedef struct {
+    uint64_t hash;
+    char *body;
+    char *name;
+    asm_section_text_t *section;
+} icf_entry_t;
+
+typedef struct {
+    icf_entry_t *entries;
+    int len;
+    int capacity;
+} icf_table_t;
+
+icf_table_t *new_icf_table();
+char *canonical_body(asm_instruction_t *label);
+char *icf_find(icf_table_t *table, char *body, asm_section_text_t *section);
+void icf_add(icf_table_t *table, char *body, char *name, asm_section_text_t *section);
+void free_icf_table(icf_table_t *table);
+
+#endif //ASMPP_ICF_H
@@ -0,0 +1,281 @@
+#include "inliner.h"
+#include "analysis.h"
+#include "codegen.h"
+#include <string.h>
+
+static label_t *find_label(stmt_list_t *stmts, char *name) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && strcmp(stmt->label->name, name) == 0) {
+            return stmt->label;
+        }
+    }
+    return NULL;
+}
+
+static bool references_label(instr_list_t *list, char *name) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_CALL:
+                if (strcmp(instr->instr_call->callee, name) == 0) {
+                    return true;
+                }
+                break;
+            case INSTR_ASM:
+                for (int j = 0; j < instr->instr_asm->args->len; j++) {
+                    expr_t *expr = get_expr(instr->instr_asm->args, j);
+                    if (expr->kind == LABEL && strcmp(expr->label, name) == 0) {
+                        return true;
+                    }
+                }
+                break;
+            case INSTR_IF:
+                if (references_label(instr->instr_if->then_instrs, name)
+                    || references_label(instr->instr_if->else_instrs, name)) {
+                    return true;
+                }
+                break;
+            case INSTR_LOOP:
+                if (references_label(instr->instr_loop->body, name)) {
+                    return true;
+                }
+                break;
+            case INSTR_SWITCH:
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    if (references_label(instr->instr_switch->bodies[j], name)) {
+                        return true;
+                    }
+                }
+                if (references_label(instr->instr_switch->default_instrs, name)) {
+                    return true;
+                }
+                break;
+        }
+    }
+    return false;
+}
+
+// Any jump or return would leave the inlined body instead of the callee.
+static bool has_exit(instr_list_t *list, int len) {
+    for (int i = 0; i < len; i++) {
+        instr_t *instr = get_instr(list, i);
+        if (instr->kind == INSTR_ASM && (instr->instr_asm->name[0] == 'j' || strcmp(instr->instr_asm->name, "ret") == 0)) {
+            return true;
+        }
+        if (instr->kind == INSTR_IF && (has_exit(instr->instr_if->then_instrs, instr->instr_if->then_instrs->len)
+                                        || has_exit(instr->instr_if->else_instrs, instr->instr_if->else_instrs->len))) {
+            return true;
+        }
+        if (instr->kind == INSTR_LOOP && has_exit(instr->instr_loop->body, instr->instr_loop->body->len)) {
+            return true;
+        }
+        if (instr->kind == INSTR_SWITCH) {
+            instr_switch_t *instr_switch = instr->instr_switch;
+            for (int j = 0; j < instr_switch->len; j++) {
+                if (has_exit(instr_switch->bodies[j], instr_switch->bodies[j]->len)) {
+                    return true;
+                }
+            }
+            if (has_exit(instr_switch->default_instrs, instr_switch->default_instrs->len)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// The body must end with a plain ret and leave the label nowhere else. It must not touch rsp either,
+// since the return address is no longer on the stack once inlined, nor have locals, which live in its frame.
+static bool has_inlinable_body(label_t *callee) {
+    instr_list_t *instrs = callee->instrs;
+    if (instrs->len == 0 || callee->locals->len > 0) {
+        return false;
+    }
+    instr_t *last = get_instr(instrs, instrs->len - 1);
+    if (last->kind != INSTR_ASM || strcmp(last->instr_asm->name, "ret") != 0 || last->instr_asm->args->len != 0) {
+        return false;
+    }
+    return !has_exit(instrs, instrs->len - 1) && !(instr_list_regs(instrs) & regset_of(RSP));
+}
+
+static bool is_inlinable(label_t *caller, label_t *callee, instr_t *call_instr) {
+    instr_call_t *call = call_instr->instr_call;
+    if (callee == caller || has_attribute(callee->attributes, "noinline")) {
+        return false;
+    }
+    if (!has_inlinable_body(callee) || references_label(callee->instrs, callee->name)) {
+        return false;
+    }
+    // layout_frames saves the callee-saved registers a C ABI label writes in its own prologue, which an
+    // inlined body does not get: the caller must not need them after the call.
+    if (has_c_abi(callee->attributes)) {
+        regset_t saved = instr_list_defs(callee->instrs) & sysv_callee_saved() & ~regset_of(RSP);
+        if (saved & live_after(caller->instrs, call_instr, label_live_out(caller))) {
+            return false;
+        }
+    }
+    call_abi_t *abi = resolve_call_abi(callee->abi, callee->attributes);
+    if (call->args->len > abi->args->len) {
+        return false;
+    }
+    for (int i = 0; i < call->args->len; i++) {
+        if (get_argument(abi->args, i)->kind != ARGUMENT_REGISTER) {
+            return false;
+        }
+    }
+    return has_attribute(callee->attributes, "inline") || count_instrs(callee->instrs) <= INLINE_THRESHOLD;
+}
+
+static void rename_expr(expr_t *expr, register_kind_t *map) {
+    if (expr->kind == REGISTER) {
+        expr->register_ = register_with_width(map[register_family(expr->register_)], register_width(expr->register_));
+    } else if (expr->kind == MEMORY) {
+        if (expr->memory.base != NO_REGISTER) {
+            expr->memory.base = map[register_family(expr->memory.base)];
+        }
+        if (expr->memory.index != NO_REGISTER) {
+            expr->memory.index = map[register_family(expr->memory.index)];
+        }
+    }
+}
+
+static void rename_exprs(expr_list_t *list, register_kind_t *map) {
+    for (int i = 0; i < list->len; i++) {
+        rename_expr(get_expr(list, i), map);
+    }
+}
+
+static void rename_cond(cond_t *cond, register_kind_t *map) {
+    if (cond->kind == COND_CMP) {
+        rename_exprs(cond->operands, map);
+        return;
+    }
+    rename_cond(cond->lhs, map);
+    if (cond->rhs != NULL) {
+        rename_cond(cond->rhs, map);
+    }
+}
+
+static void rename_registers(instr_list_t *list, register_kind_t *map) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_ASM:
+                rename_exprs(instr->instr_asm->args, map);
+                break;
+            case INSTR_CALL:
+                rename_exprs(instr->instr_call->args, map);
+                break;
+            case INSTR_IF:
+                rename_cond(instr->instr_if->cond, map);
+                rename_registers(instr->instr_if->then_instrs, map);
+                rename_registers(instr->instr_if->else_instrs, map);
+                break;
+            case INSTR_LOOP:
+                if (instr->instr_loop->kind == LOOP_WHILE) {
+                    rename_cond(instr->instr_loop->cond, map);
+                } else {
+                    rename_expr(instr->instr_loop->counter, map);
+                    rename_expr(instr->instr_loop->count, map);
+                }
+                rename_registers(instr->instr_loop->body, map);
+                break;
+            case INSTR_SWITCH:
+                rename_expr(instr->instr_switch->value, map);
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    rename_registers(instr->instr_switch->bodies[j], map);
+                }
+                rename_registers(instr->instr_switch->default_instrs, map);
+                break;
+        }
+    }
+}
+
+// Appends the callee body in place of the call. A register argument is substituted for the parameter when
+// the body never writes either of them and the parameter is dead after the call; the others are moved.
+static void inline_call(label_t *caller, label_t *callee, instr_t *call_instr, instr_list_t *out) {
+    instr_call_t *call = call_instr->instr_call;
+    call_abi_t *abi = resolve_call_abi(callee->abi, callee->attributes);
+    regset_t live = live_after(caller->instrs, call_instr, label_live_out(caller));
+    regset_t body_regs = instr_list_regs(callee->instrs);
+    regset_t body_defs = instr_list_defs(callee->instrs);
+    regset_t params = 0;
+    for (int i = 0; i < call->args->len; i++) {
+        params |= regset_of(get_argument(abi->args, i)->reg);
+    }
+
+    register_kind_t map[NO_REGISTER];
+    for (int i = 0; i < NO_REGISTER; i++) {
+        map[i] = i;
+    }
+    register_kind_t dsts[call->args->len + 1];
+    expr_t *srcs[call->args->len + 1];
+    int move_count = 0;
+    for (int i = 0; i < call->args->len; i++) {
+        register_kind_t param = get_argument(abi->args, i)->reg;
+        expr_t *arg = get_expr(call->args, i);
+        if (arg->kind == REGISTER && register_width(arg->register_) == register_width(param)
+            && register_family(param) != register_family(arg->register_)
+            && !(live & regset_of(param))
+            && !(body_defs & (regset_of(param) | regset_of(arg->register_)))
+            && !(body_regs & regset_of(arg->register_))
+            && !(params & regset_of(arg->register_))) {
+            map[register_family(param)] = register_family(arg->register_);
+            continue;
+        }
+        dsts[move_count] = param;
+        srcs[move_count] = arg;
+        move_count++;
+    }
+
+    instr_list_t *moves = resolve_parallel_move(dsts, srcs, move_count);
+    for (int i = 0; i < moves->len; i++) {
+        append_instr(out, get_instr(moves, i));
+    }
+    instr_list_t *body = copy_instr_list(callee->instrs);
+    body->len--;
+    rename_registers(body, map);
+    for (int i = 0; i < body->len; i++) {
+        append_instr(out, get_instr(body, i));
+    }
+}
+
+static void inline_instr_list(stmt_list_t *stmts, label_t *caller, instr_list_t *list, opt_stats_t *stats) {
+    instr_list_t *out = new_instr_list();
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        if (instr->kind == INSTR_IF) {
+            inline_instr_list(stmts, caller, instr->instr_if->then_instrs, stats);
+            inline_instr_list(stmts, caller, instr->instr_if->else_instrs, stats);
+        } else if (instr->kind == INSTR_LOOP) {
+            inline_instr_list(stmts, caller, instr->instr_loop->body, stats);
+        } else if (instr->kind == INSTR_SWITCH) {
+            for (int j = 0; j < instr->instr_switch->len; j++) {
+                inline_instr_list(stmts, caller, instr->instr_switch->bodies[j], stats);
+            }
+            inline_instr_list(stmts, caller, instr->instr_switch->default_instrs, stats);
+        } else if (instr->kind == INSTR_CALL) {
+            label_t *callee = find_label(stmts, instr->instr_call->callee);
+            if (callee != NULL && is_inlinable(caller, callee, instr)) {
+                inline_call(caller, callee, instr, out);
+                stats->calls_inlined++;
+                continue;
+            }
+        }
+        append_instr(out, instr);
+    }
+    list->len = out->len;
+    list->capacity = out->capacity;
+    list->instrs = out->instrs;
+}
+
+// Labels are handled in source order, so a callee defined earlier already had its own calls inlined.
+void inline_calls(stmt_list_t *stmts, opt_stats_t *stats) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            inline_instr_list(stmts, stmt->label, stmt->label->instrs, stats);
+        }
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef ASMPP_INLINER_H
+#define ASMPP_INLINER_H
+
+#include "ast.h"
+#include "optimize.h"
+
+#define INLINE_THRESHOLD 8
+
+void inline_calls(stmt_list_t *stmts, opt_stats_t *stats);
+
+#endif //ASMPP_INLINER_H
@@ -0,0 +1,286 @@
+#include "isel.h"
+#include "analysis.h"
+#include <string.h>
+
+typedef struct {
+    label_t *label;
+    opt_stats_t *stats;
+} isel_t;
+
+static instr_t *new_asm(char *op, expr_t *dst, expr_t *src) {
+    expr_list_t *args = new_expr_list();
+    append_expr(args, dst);
+    if (src != NULL) {
+        append_expr(args, src);
+    }
+    return new_asm_instr(new_instr_asm(op, args));
+}
+
+static expr_t *reg(register_kind_t reg) {
+    return new_expr_register(reg);
+}
+
+static expr_t *imm(int64_t value) {
+    return new_expr_immediate(value);
+}
+
+// [base + index*scale + displacement], addressed with the 64-bit registers: the low bits of the
+// result are the same whatever the width of the destination.
+static expr_t *address(register_kind_t base, register_kind_t index, int64_t scale, int64_t displacement) {
+    return new_expr_memory(base == NO_REGISTER ? NO_REGISTER : register_family(base),
+                           index == NO_REGISTER ? NO_REGISTER : register_family(index), scale, displacement);
+}
+
+static bool is_asm(instr_t *instr, char *op, int argc) {
+    return instr->kind == INSTR_ASM && strcmp(instr->instr_asm->name, op) == 0 && instr->instr_asm->args->len == argc;
+}
+
+static expr_t *arg(instr_t *instr, int index) {
+    return get_expr(instr->instr_asm->args, index);
+}
+
+static bool is_wide_reg(expr_t *expr) {
+    return expr->kind == REGISTER && register_family(expr->register_) <= R15 && expr->register_ < AX;
+}
+
+static bool fits_imm32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static int log2_exact(uint64_t value) {
+    if (value == 0 || (value & (value - 1)) != 0) {
+        return -1;
+    }
+    return __builtin_ctzll(value);
+}
+
+static regset_t live_after_instr(isel_t *isel, instr_t *instr) {
+    return live_after(isel->label->instrs, instr, label_live_out(isel->label));
+}
+
+// The value the closest preceding write in list gives to the register family, if it is a constant.
+static bool known_value(instr_list_t *list, int index, register_kind_t family, uint64_t *value) {
+    for (int i = index - 1; i >= 0; i--) {
+        instr_t *instr = get_instr(list, i);
+        regset_t uses, defs;
+        instr_effects(instr, &uses, &defs);
+        if (!(defs & regset_of(family))) {
+            continue;
+        }
+        if (instr->kind != INSTR_ASM || instr->instr_asm->args->len != 2 || !is_wide_reg(arg(instr, 0))
+            || register_family(arg(instr, 0)->register_) != family) {
+            return false;
+        }
+        bool wide = register_width(arg(instr, 0)->register_) == 64;
+        if (is_asm(instr, "mov", 2) && arg(instr, 1)->kind == IMMEDIATE) {
+            *value = wide ? (uint64_t) arg(instr, 1)->immediate : (uint32_t) arg(instr, 1)->immediate;
+            return true;
+        }
+        if ((is_asm(instr, "xor", 2) || is_asm(instr, "sub", 2)) && expr_equal(arg(instr, 0), arg(instr, 1))) {
+            *value = 0;
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+// imul by 2^k becomes shl, by 3, 5 or 9 a lea. Both set the flags differently, or not at all.
+static bool select_mul(isel_t *isel, instr_t *instr, instr_list_t *out) {
+    expr_t *dst, *src, *factor;
+    if (is_asm(instr, "imul", 2)) {
+        dst = src = arg(instr, 0);
+        factor = arg(instr, 1);
+    } else if (is_asm(instr, "imul", 3)) {
+        dst = arg(instr, 0);
+        src = arg(instr, 1);
+        factor = arg(instr, 2);
+    } else {
+        return false;
+    }
+    if (!is_wide_reg(dst) || src->kind != REGISTER || factor->kind != IMMEDIATE
+        || live_after_instr(isel, instr) & REGSET_FLAGS) {
+        return false;
+    }
+    int64_t value = factor->immediate;
+    int shift = log2_exact((uint64_t) value);
+    if (value == 3 || value == 5 || value == 9) {
+        append_instr(out, new_asm("lea", reg(dst->register_), address(src->register_, src->register_, value - 1, 0)));
+        return true;
+    }
+    if (shift <= 0) {
+        return false;
+    }
+    if (!expr_equal(dst, src)) {
+        append_instr(out, new_asm("mov", reg(dst->register_), reg(src->register_)));
+    }
+    append_instr(out, new_asm("shl", reg(dst->register_), imm(shift)));
+    return true;
+}
+
+// mov d, s followed by add d, x (or sub d, imm) is the three-operand lea d, [s + x].
+static bool select_lea(isel_t *isel, instr_list_t *list, int index, instr_list_t *out) {
+    if (index + 1 >= list->len) {
+        return false;
+    }
+    instr_t *mov = get_instr(list, index);
+    instr_t *op = get_instr(list, index + 1);
+    if (!is_asm(mov, "mov", 2) || !(is_asm(op, "add", 2) || is_asm(op, "sub", 2))) {
+        return false;
+    }
+    expr_t *dst = arg(mov, 0), *src = arg(mov, 1), *rhs = arg(op, 1);
+    if (!is_wide_reg(dst) || !is_wide_reg(src) || register_width(dst->register_) != register_width(src->register_)
+        || register_family(dst->register_) == register_family(src->register_) || !expr_equal(arg(op, 0), dst)
+        || live_after_instr(isel, op) & REGSET_FLAGS) {
+        return false;
+    }
+    expr_t *lea;
+    bool add = strcmp(op->instr_asm->name, "add") == 0;
+    if (add && is_wide_reg(rhs) && register_width(rhs->register_) == register_width(dst->register_)
+        && register_family(rhs->register_) != register_family(dst->register_)) {
+        lea = address(src->register_, rhs->register_, 1, 0);
+    } else if (rhs->kind == IMMEDIATE && fits_imm32(rhs->immediate) && rhs->immediate != INT32_MIN) {
+        lea = address(src->register_, NO_REGISTER, 1, add ? rhs->immediate : -rhs->immediate);
+    } else {
+        return false;
+    }
+    append_instr(out, new_asm("lea", reg(dst->register_), lea));
+    return true;
+}
+
+// Granlund-Montgomery: n / d == mulhi(n, multiplier) >> shift, or when the multiplier needs 65 bits,
+// t = mulhi(n, multiplier) and n / d == (t + ((n - t) >> 1)) >> (shift - 1). Only for d <= 2^63.
+static void unsigned_magic(uint64_t d, uint64_t *multiplier, int *shift, bool *add) {
+    int l = 64 - __builtin_clzll(d - 1);
+    unsigned __int128 p = (unsigned __int128) 1 << (63 + l);
+    unsigned __int128 m = (p + d - 1) / d;
+    if (m * d - p <= ((unsigned __int128) 1 << (l - 1))) {
+        *multiplier = (uint64_t) m;
+        *shift = l - 1;
+        *add = false;
+        return;
+    }
+    p = (unsigned __int128) 1 << (64 + l);
+    m = (p + d - 1) / d;
+    *multiplier = (uint64_t) (m - ((unsigned __int128) 1 << 64));
+    *shift = l;
+    *add = true;
+}
+
+// div r64 with rdx known zero and r64 a known constant: rax = rax / d and rdx = rax % d without the divider.
+// The divisor register and rdx serve as scratch, the divisor is reloaded when it is still needed.
+// div leaves the flags undefined, so nothing can consume them.
+static bool select_div(isel_t *isel, instr_list_t *list, int index, instr_list_t *out) {
+    instr_t *instr = get_instr(list, index);
+    if (!is_asm(instr, "div", 1) || arg(instr, 0)->kind != REGISTER || register_width(arg(instr, 0)->register_) != 64) {
+        return false;
+    }
+    register_kind_t divisor = arg(instr, 0)->register_;
+    uint64_t d, rdx;
+    if (divisor == RAX || divisor == RDX || divisor == RSP || divisor == RIP
+        || !known_value(list, index, divisor, &d) || !known_value(list, index, RDX, &rdx) || rdx != 0 || d < 2) {
+        return false;
+    }
+    regset_t live = live_after_instr(isel, instr);
+    bool need_remainder = (live & regset_of(RDX)) != 0;
+    int shift = log2_exact(d);
+    if (shift > 0) {
+        if (need_remainder) {
+            if (d - 1 > INT32_MAX) {
+                return false;
+            }
+            append_instr(out, new_asm("mov", reg(RDX), reg(RAX)));
+            append_instr(out, new_asm("and", reg(RDX), imm((int64_t) (d - 1))));
+        }
+        append_instr(out, new_asm("shr", reg(RAX), imm(shift)));
+        return true;
+    }
+    if (d > (UINT64_C(1) << 63)) {
+        // The quotient is 1 when n >= d and 0 otherwise, too small for a multiplier.
+        if (need_remainder) {
+            append_instr(out, new_asm("mov", reg(RDX), reg(RAX)));
+            append_instr(out, new_asm("sub", reg(RDX), reg(divisor)));
+            append_instr(out, new_asm("cmovb", reg(RDX), reg(RAX)));
+        } else {
+            append_instr(out, new_asm("cmp", reg(RAX), reg(divisor)));
+        }
+        append_instr(out, new_asm("mov", reg(EAX), imm(0)));
+        append_instr(out, new_asm("setae", reg(AL), NULL));
+        return true;
+    }
+    if (need_remainder && d > INT32_MAX) {
+        return false;
+    }
+    uint64_t multiplier;
+    bool add;
+    unsigned_magic(d, &multiplier, &shift, &add);
+    if (need_remainder || add) {
+        append_instr(out, new_asm("mov", reg(divisor), reg(RAX)));
+    }
+    append_instr(out, new_asm("mov", reg(RDX), imm((int64_t) multiplier)));
+    append_instr(out, new_asm("mul", reg(RDX), NULL));
+    if (add) {
+        append_instr(out, new_asm("mov", reg(RAX), reg(divisor)));
+        append_instr(out, new_asm("sub", reg(RAX), reg(RDX)));
+        append_instr(out, new_asm("shr", reg(RAX), imm(1)));
+        append_instr(out, new_asm("add", reg(RAX), reg(RDX)));
+        if (shift > 1) {
+            append_instr(out, new_asm("shr", reg(RAX), imm(shift - 1)));
+        }
+    } else {
+        if (shift > 0) {
+            append_instr(out, new_asm("shr", reg(RDX), imm(shift)));
+        }
+        append_instr(out, new_asm("mov", reg(RAX), reg(RDX)));
+    }
+    if (need_remainder) {
+        instr_t *product = new_asm("imul", reg(RDX), reg(RAX));
+        append_expr(product->instr_asm->args, imm((int64_t) d));
+        append_instr(out, product);
+        append_instr(out, new_asm("sub", reg(divisor), reg(RDX)));
+        append_instr(out, new_asm("mov", reg(RDX), reg(divisor)));
+    }
+    if (live & regset_of(divisor)) {
+        append_instr(out, new_asm("mov", reg(divisor), imm((int64_t) d)));
+    }
+    return true;
+}
+
+static void select_list(isel_t *isel, instr_list_t *list) {
+    instr_list_t *out = new_instr_list();
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        if (instr->kind == INSTR_IF) {
+            select_list(isel, instr->instr_if->then_instrs);
+            select_list(isel, instr->instr_if->else_instrs);
+        } else if (instr->kind == INSTR_LOOP) {
+            select_list(isel, instr->instr_loop->body);
+        } else if (instr->kind == INSTR_SWITCH) {
+            for (int j = 0; j < instr->instr_switch->len; j++) {
+                select_list(isel, instr->instr_switch->bodies[j]);
+            }
+            select_list(isel, instr->instr_switch->default_instrs);
+        } else if (select_lea(isel, list, i, out)) {
+            isel->stats->instrs_selected++;
+            i++;
+            continue;
+        } else if (select_mul(isel, instr, out) || select_div(isel, list, i, out)) {
+            isel->stats->instrs_selected++;
+            continue;
+        }
+        append_instr(out, instr);
+    }
+    list->len = out->len;
+    list->capacity = out->capacity;
+    list->instrs = out->instrs;
+}
+
+void select_instructions(stmt_list_t *stmts, opt_stats_t *stats) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            isel_t isel = {.label = stmt->label, .stats = stats};
+            select_list(&isel, stmt->label->instrs);
+        }
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef ASMPP_ISEL_H
+#define ASMPP_ISEL_H
+
+#include "ast.h"
+#include "optimize.h"
+
+void select_instructions(stmt_list_t *stmts, opt_stats_t *stats);
+
+#endif //ASMPP_ISEL_H
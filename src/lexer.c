@@ -145,6 +145,54 @@ void lexer_lex(lexer_t* lexer) {
                 lexer_advance(lexer, 1);
                 lexer_append_token(lexer, TOKEN_ASSIGN, 1);
                 break;
+            case '+':
+                lexer_advance(lexer, 1);
+                lexer_append_token(lexer, TOKEN_PLUS, 1);
+                break;
+            case '-':
+                lexer_advance(lexer, 1);
+                lexer_append_token(lexer, TOKEN_MINUS, 1);
+                break;
+            case '*':
+                lexer_advance(lexer, 1);
+                lexer_append_token(lexer, TOKEN_STAR, 1);
+                break;
+            case '/':
+                lexer_advance(lexer, 1);
+                lexer_append_token(lexer, TOKEN_SLASH, 1);
+                break;
+            case '%':
+                lexer_advance(lexer, 1);
+                lexer_append_token(lexer, TOKEN_PERCENT, 1);
+                break;
+            case '&':
+                lexer_advance(lexer, 1);
+                lexer_append_token(lexer, TOKEN_AMP, 1);
+                break;
+            case '|':
+                lexer_advance(lexer, 1);
+                lexer_append_token(lexer, TOKEN_PIPE, 1);
+                break;
+            case '^':
+                lexer_advance(lexer, 1);
+                lexer_append_token(lexer, TOKEN_CARET, 1);
+                break;
+            case '~':
+                lexer_advance(lexer, 1);
+                lexer_append_token(lexer, TOKEN_TILDE, 1);
+                break;
+            case '.':
+                lexer_advance(lexer, 1);
+                lexer_append_token(lexer, TOKEN_DOT, 1);
+                break;
+            case '<':
+            case '>':
+                if (lexer->pos + 1 >= lexer->len || lexer->source[lexer->pos + 1] != c) {
+                    error("Unexpected character", ERROR_INVALID);
+                }
+                lexer_advance(lexer, 2);
+                lexer_append_token(lexer, c == '<' ? TOKEN_SHL : TOKEN_SHR, 2);
+                break;
             case '(':
                 lexer_advance(lexer, 1);
                 lexer_append_token(lexer, TOKEN_LPAREN, 1);
@@ -188,7 +236,8 @@ void lexer_lex(lexer_t* lexer) {
                     }
                     lexer_append_token(lexer, TOKEN_IDENT, n);
                 } else if (isdigit(c)) {
-                    while (isdigit(lexer_peek(lexer))) {
+                    // Also takes the 0x/0b prefixes and hex digits, the parser validates the literal.
+                    while (isalnum(lexer_peek(lexer))) {
                         lexer_advance(lexer, 1);
                     }
                     lexer_append_token(lexer, TOKEN_NUMBER, lexer->pos - pos);
@@ -255,6 +304,45 @@ char* display_token(token_t* token) {
         case TOKEN_RBRACKET:
             kind = "RBRACKET";
             break;
+        case TOKEN_ASSIGN:
+            kind = "ASSIGN";
+            break;
+        case TOKEN_PLUS:
+            kind = "PLUS";
+            break;
+        case TOKEN_MINUS:
+            kind = "MINUS";
+            break;
+        case TOKEN_STAR:
+            kind = "STAR";
+            break;
+        case TOKEN_SLASH:
+            kind = "SLASH";
+            break;
+        case TOKEN_PERCENT:
+            kind = "PERCENT";
+            break;
+        case TOKEN_SHL:
+            kind = "SHL";
+            break;
+        case TOKEN_SHR:
+            kind = "SHR";
+            break;
+        case TOKEN_AMP:
+            kind = "AMP";
+            break;
+        case TOKEN_PIPE:
+            kind = "PIPE";
+            break;
+        case TOKEN_CARET:
+            kind = "CARET";
+            break;
+        case TOKEN_TILDE:
+            kind = "TILDE";
+            break;
+        case TOKEN_DOT:
+            kind = "DOT";
+            break;
         case TOKEN_IDENT:
             kind = "IDENT";
             break;
@@ -23,6 +23,18 @@ enum token_kind_t {
     TOKEN_LBRACKET,
     TOKEN_RBRACKET,
     TOKEN_ASSIGN,
+    TOKEN_PLUS,
+    TOKEN_MINUS,
+    TOKEN_STAR,
+    TOKEN_SLASH,
+    TOKEN_PERCENT,
+    TOKEN_SHL,
+    TOKEN_SHR,
+    TOKEN_AMP,
+    TOKEN_PIPE,
+    TOKEN_CARET,
+    TOKEN_TILDE,
+    TOKEN_DOT,
     TOKEN_IDENT,
     TOKEN_NUMBER,
     TOKEN_STRING,
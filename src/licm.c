@@ -0,0 +1,158 @@
+#include "licm.h"
+#include "analysis.h"
+#include <string.h>
+
+typedef struct {
+    stmt_list_t *stmts;
+    label_t *label;
+    opt_stats_t *stats;
+} licm_t;
+
+static bool is_rodata(licm_t *licm, char *name) {
+    for (int i = 0; i < licm->stmts->len; i++) {
+        stmt_t *stmt = get_stmt(licm->stmts, i);
+        if (stmt->kind == STMT_DATA && strcmp(stmt->data->name, name) == 0) {
+            return has_attribute(stmt->data->attributes, "rodata");
+        }
+    }
+    return false;
+}
+
+// Number of instructions in list that may write the register family.
+static int count_defs(instr_list_t *list, regset_t family) {
+    int count = 0;
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        regset_t uses, defs;
+        switch (instr->kind) {
+            case INSTR_IF:
+                count += count_defs(instr->instr_if->then_instrs, family);
+                count += count_defs(instr->instr_if->else_instrs, family);
+                break;
+            case INSTR_LOOP:
+                count += count_defs(instr->instr_loop->body, family);
+                if (instr->instr_loop->kind == LOOP_COUNTED && (expr_regs(instr->instr_loop->counter) & family)) {
+                    count++;
+                }
+                break;
+            default:
+                instr_effects(instr, &uses, &defs);
+                if (defs & family) {
+                    count++;
+                }
+                break;
+        }
+    }
+    return count;
+}
+
+// mov r, imm / mov r, label, lea r, [invariant address] and loads from [rodata] data through an invariant address.
+// A load runs before the loop even when the body would not, and an index only checked by the loop condition may
+// be out of bounds then: unless the loop is known to run, only fixed addresses are loaded.
+static bool is_invariant_def(licm_t *licm, instr_t *instr, regset_t loop_defs, bool runs) {
+    if (instr->kind != INSTR_ASM || instr->instr_asm->args->len != 2) {
+        return false;
+    }
+    char *op = instr->instr_asm->name;
+    expr_t *dst = get_expr(instr->instr_asm->args, 0);
+    expr_t *src = get_expr(instr->instr_asm->args, 1);
+    if (dst->kind != REGISTER || register_family(dst->register_) > R15 || register_width(dst->register_) < 32) {
+        return false;
+    }
+    if (strcmp(op, "mov") == 0 && (src->kind == IMMEDIATE || src->kind == LABEL)) {
+        return true;
+    }
+    if (src->kind != MEMORY || (expr_regs(src) & loop_defs)) {
+        return false;
+    }
+    if (strcmp(op, "lea") == 0) {
+        return true;
+    }
+    if (strcmp(op, "mov") != 0 || src->memory.label == NULL || !is_rodata(licm, src->memory.label)) {
+        return false;
+    }
+    return runs || (src->memory.base == NO_REGISTER && src->memory.index == NO_REGISTER);
+}
+
+static regset_t loop_header_regs(instr_loop_t *loop) {
+    if (loop->kind == LOOP_WHILE) {
+        return cond_regs(loop->cond);
+    }
+    return expr_regs(loop->counter) | expr_regs(loop->count);
+}
+
+static regset_t loop_defs(instr_loop_t *loop) {
+    regset_t defs = instr_list_defs(loop->body);
+    if (loop->kind == LOOP_COUNTED) {
+        defs |= expr_regs(loop->counter);
+    }
+    return defs;
+}
+
+// An instruction of the body can run once before the loop when it is the only write to its register,
+// nothing in the loop reads the register before it, and the loop condition does not read it either.
+// Unless the loop is known to run, the register must also be dead after the loop, which may run zero times.
+static int find_hoistable(licm_t *licm, instr_t *loop_instr) {
+    instr_loop_t *loop = loop_instr->instr_loop;
+    instr_list_t *body = loop->body;
+    regset_t defs = loop_defs(loop);
+    bool runs = loop->kind == LOOP_COUNTED && loop->count->kind == IMMEDIATE && loop->count->immediate > 0;
+    regset_t used_before = loop_header_regs(loop);
+    for (int i = 0; i < body->len; i++) {
+        instr_t *instr = get_instr(body, i);
+        regset_t uses, instr_defs;
+        instr_effects(instr, &uses, &instr_defs);
+        if (is_invariant_def(licm, instr, defs, runs)) {
+            regset_t family = regset_of(get_expr(instr->instr_asm->args, 0)->register_);
+            if (!(used_before & family) && count_defs(body, family) == 1
+                && (runs || !(live_after(licm->label->instrs, loop_instr, label_live_out(licm->label)) & family))) {
+                return i;
+            }
+        }
+        used_before |= uses;
+    }
+    return -1;
+}
+
+static void licm_list(licm_t *licm, instr_list_t *list) {
+    instr_list_t *out = new_instr_list();
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        if (instr->kind == INSTR_IF) {
+            licm_list(licm, instr->instr_if->then_instrs);
+            licm_list(licm, instr->instr_if->else_instrs);
+        } else if (instr->kind == INSTR_SWITCH) {
+            for (int j = 0; j < instr->instr_switch->len; j++) {
+                licm_list(licm, instr->instr_switch->bodies[j]);
+            }
+            licm_list(licm, instr->instr_switch->default_instrs);
+        } else if (instr->kind == INSTR_LOOP) {
+            // Inner loops first: what they hoist lands in the outer body and may move further out.
+            instr_list_t *body = instr->instr_loop->body;
+            licm_list(licm, body);
+            int index;
+            while ((index = find_hoistable(licm, instr)) != -1) {
+                append_instr(out, get_instr(body, index));
+                for (int j = index; j < body->len - 1; j++) {
+                    body->instrs[j] = body->instrs[j + 1];
+                }
+                body->len--;
+                licm->stats->instrs_hoisted++;
+            }
+        }
+        append_instr(out, instr);
+    }
+    list->len = out->len;
+    list->capacity = out->capacity;
+    list->instrs = out->instrs;
+}
+
+void hoist_loop_invariants(stmt_list_t *stmts, opt_stats_t *stats) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            licm_t licm = {.stmts = stmts, .label = stmt->label, .stats = stats};
+            licm_list(&licm, stmt->label->instrs);
+        }
+    }
+}
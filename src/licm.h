@@ -0,0 +1,9 @@
+#ifndef ASMPP_LICM_H
+#define ASMPP_LICM_H
+
+#include "ast.h"
+#include "optimize.h"
+
+void hoist_loop_invariants(stmt_list_t *stmts, opt_stats_t *stats);
+
+#endif //ASMPP_LICM_H
@@ -0,0 +1,200 @@
+#include "lifetime.h"
+#include "analysis.h"
+#include "error.h"
+#include <stdlib.h>
+
+static void *lifetime_reserve(void *array, int *capacity, int len, size_t size) {
+    if (len < *capacity) {
+        return array;
+    }
+    *capacity = *capacity == 0 ? 16 : *capacity * 2;
+    array = realloc(array, size * *capacity);
+    if (array == NULL) {
+        error("Failed to allocate memory for lifetimes", ERROR_ALLOC);
+    }
+    return array;
+}
+
+lifetime_scan_t *new_lifetime_scan(lifetime_visit_t visit, void *data) {
+    lifetime_scan_t *scan = calloc(1, sizeof(lifetime_scan_t));
+    if (scan == NULL) {
+        error("Failed to allocate memory for lifetimes", ERROR_ALLOC);
+    }
+    scan->visit = visit;
+    scan->data = data;
+    return scan;
+}
+
+static int next_pos(lifetime_scan_t *scan, instr_t *instr) {
+    scan->instrs = lifetime_reserve(scan->instrs, &scan->instrs_capacity, scan->pos, sizeof(instr_t *));
+    scan->instrs[scan->pos] = instr;
+    return scan->pos++;
+}
+
+void lifetime_add_use(lifetime_scan_t *scan, int id, int pos, bool read, bool write, bool fixed) {
+    scan->uses = lifetime_reserve(scan->uses, &scan->uses_capacity, scan->uses_len, sizeof(lifetime_use_t));
+    scan->uses[scan->uses_len++] = (lifetime_use_t) {
+            .id = id, .pos = pos, .read = read, .write = write, .fixed = fixed
+    };
+}
+
+static void scan_cond(lifetime_scan_t *scan, cond_t *cond, int pos) {
+    if (cond->kind == COND_CMP) {
+        for (int i = 0; i < cond->operands->len; i++) {
+            scan->visit(scan, NULL, get_expr(cond->operands, i), pos, true, false, true);
+        }
+        return;
+    }
+    scan_cond(scan, cond->lhs, pos);
+    if (cond->rhs != NULL) {
+        scan_cond(scan, cond->rhs, pos);
+    }
+}
+
+static void scan_loop(lifetime_scan_t *scan, instr_loop_t *loop) {
+    int start;
+    if (loop->kind == LOOP_WHILE) {
+        start = next_pos(scan, NULL);
+        scan_cond(scan, loop->cond, start);
+    } else {
+        int init = next_pos(scan, NULL);
+        scan->visit(scan, NULL, loop->count, init, true, false, true);
+        scan->visit(scan, NULL, loop->counter, init, expr_equal(loop->counter, loop->count), true, true);
+        start = scan->pos;
+    }
+    scan_lifetimes(scan, loop->body);
+    int end = next_pos(scan, NULL);
+    if (loop->kind == LOOP_WHILE) {
+        scan_cond(scan, loop->cond, end);
+    } else {
+        scan->visit(scan, NULL, loop->counter, end, true, true, true);
+    }
+    scan->loops = lifetime_reserve(scan->loops, &scan->loops_capacity, scan->loops_len, sizeof(lifetime_loop_t));
+    scan->loops[scan->loops_len++] = (lifetime_loop_t) {.start = start, .end = end};
+}
+
+static void scan_instr(lifetime_scan_t *scan, instr_t *instr) {
+    switch (instr->kind) {
+        case INSTR_ASM: {
+            int pos = next_pos(scan, instr);
+            for (int i = 0; i < instr->instr_asm->args->len; i++) {
+                bool read, write;
+                operand_access(instr->instr_asm, i, &read, &write);
+                scan->visit(scan, instr, get_expr(instr->instr_asm->args, i), pos, read, write, false);
+            }
+            break;
+        }
+        case INSTR_CALL: {
+            int pos = next_pos(scan, instr);
+            for (int i = 0; i < instr->instr_call->args->len; i++) {
+                scan->visit(scan, instr, get_expr(instr->instr_call->args, i), pos, true, false, false);
+            }
+            break;
+        }
+        case INSTR_IF:
+            scan_cond(scan, instr->instr_if->cond, next_pos(scan, NULL));
+            scan_lifetimes(scan, instr->instr_if->then_instrs);
+            scan_lifetimes(scan, instr->instr_if->else_instrs);
+            break;
+        case INSTR_LOOP:
+            scan_loop(scan, instr->instr_loop);
+            break;
+        case INSTR_SWITCH:
+            scan->visit(scan, NULL, instr->instr_switch->value, next_pos(scan, NULL), true, false, true);
+            for (int i = 0; i < instr->instr_switch->len; i++) {
+                scan_lifetimes(scan, instr->instr_switch->bodies[i]);
+            }
+            scan_lifetimes(scan, instr->instr_switch->default_instrs);
+            break;
+    }
+}
+
+void scan_lifetimes(lifetime_scan_t *scan, instr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        scan_instr(scan, get_instr(list, i));
+    }
+}
+
+// A value used in a loop is kept over the whole loop when it comes from before the loop, is still needed
+// after it, or is read in an iteration before being written.
+static void extend_over_loop(lifetime_scan_t *scan, int id, lifetime_t *lifetime, lifetime_loop_t *loop) {
+    int first = -1;
+    bool carried = false;
+    for (int i = 0; i < scan->uses_len; i++) {
+        lifetime_use_t *use = &scan->uses[i];
+        if (use->id != id || use->pos < loop->start || use->pos > loop->end) {
+            continue;
+        }
+        if (first == -1) {
+            first = use->pos;
+        }
+        if (use->pos == first) {
+            carried |= use->read;
+        }
+    }
+    if (lifetime->start < loop->start && lifetime->end >= loop->start) {
+        lifetime->end = lifetime->end > loop->end ? lifetime->end : loop->end;
+    }
+    if (lifetime->start <= loop->end && lifetime->end > loop->end) {
+        lifetime->start = lifetime->start < loop->start ? lifetime->start : loop->start;
+    }
+    if (carried) {
+        lifetime->start = lifetime->start < loop->start ? lifetime->start : loop->start;
+        lifetime->end = lifetime->end > loop->end ? lifetime->end : loop->end;
+    }
+}
+
+// Lifetimes of ids 0 to len - 1, from their first use to their last, stretched over the loops they live through.
+lifetime_t *build_lifetimes(lifetime_scan_t *scan, int len) {
+    lifetime_t *lifetimes = calloc(len + 1, sizeof(lifetime_t));
+    if (lifetimes == NULL) {
+        error("Failed to allocate memory for lifetimes", ERROR_ALLOC);
+    }
+    for (int i = 0; i < scan->uses_len; i++) {
+        lifetime_use_t *use = &scan->uses[i];
+        lifetime_t *lifetime = &lifetimes[use->id];
+        if (!lifetime->used) {
+            lifetime->used = true;
+            lifetime->start = use->pos;
+        }
+        lifetime->end = use->pos;
+        lifetime->fixed |= use->fixed;
+    }
+    for (int i = 0; i < scan->loops_len; i++) {
+        for (int id = 0; id < len; id++) {
+            if (lifetimes[id].used) {
+                extend_over_loop(scan, id, &lifetimes[id], &scan->loops[i]);
+            }
+        }
+    }
+    for (int id = 0; id < len; id++) {
+        lifetime_t *lifetime = &lifetimes[id];
+        bool fresh = false, reused = false;
+        for (int i = 0; i < scan->uses_len; i++) {
+            lifetime_use_t *use = &scan->uses[i];
+            if (use->id != id) {
+                continue;
+            }
+            if (use->pos == lifetime->start) {
+                fresh |= use->write;
+                reused |= use->read || !use->write;
+            }
+            if (use->pos == lifetime->end && use->write) {
+                lifetime->end_written = true;
+            }
+        }
+        lifetime->start_written = fresh && !reused;
+    }
+    return lifetimes;
+}
+
+bool lifetimes_overlap(lifetime_t *a, lifetime_t *b) {
+    return a->used && b->used && a->start <= b->end && b->start <= a->end;
+}
+
+void free_lifetime_scan(lifetime_scan_t *scan) {
+    free(scan->instrs);
+    free(scan->uses);
+    free(scan->loops);
+    free(scan);
+}
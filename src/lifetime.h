@@ -0,0 +1,64 @@
+#ifndef ASMPP_LIFETIME_H
+#define ASMPP_LIFETIME_H
+
+#include "ast.h"
+
+// Lifetimes of things a label names, virtual registers or stack locals, over its instructions laid out in
+// source order. Every instruction takes a position, as do the condition of an if or a switch, and the head and
+// back-edge of a loop.
+
+typedef struct lifetime_scan_t lifetime_scan_t;
+
+// Called on every operand with how it is used. Fixed operands belong to a condition, a loop or a switch,
+// instr is NULL for them.
+typedef void (*lifetime_visit_t)(lifetime_scan_t *scan, instr_t *instr, expr_t *expr, int pos, bool read, bool write, bool fixed);
+
+typedef struct {
+    int id;
+    int pos;
+    bool read;
+    bool write;
+    bool fixed;
+} lifetime_use_t;
+
+// The positions from the head of a loop to its back-edge.
+typedef struct {
+    int start;
+    int end;
+} lifetime_loop_t;
+
+// start_written: the instruction at start only writes the value, it does not need it before.
+// end_written: the instruction at end writes it, so it is not done with it once it read it.
+typedef struct {
+    int start;
+    int end;
+    bool used;
+    bool fixed;
+    bool start_written;
+    bool end_written;
+} lifetime_t;
+
+struct lifetime_scan_t {
+    lifetime_visit_t visit;
+    void *data;
+    int pos;
+    // The instruction at each position, NULL for conditions and loops.
+    instr_t **instrs;
+    int instrs_capacity;
+    lifetime_use_t *uses;
+    int uses_len;
+    int uses_capacity;
+    // Inner loops come first.
+    lifetime_loop_t *loops;
+    int loops_len;
+    int loops_capacity;
+};
+
+lifetime_scan_t *new_lifetime_scan(lifetime_visit_t visit, void *data);
+void scan_lifetimes(lifetime_scan_t *scan, instr_list_t *list);
+void lifetime_add_use(lifetime_scan_t *scan, int id, int pos, bool read, bool write, bool fixed);
+lifetime_t *build_lifetimes(lifetime_scan_t *scan, int len);
+bool lifetimes_overlap(lifetime_t *a, lifetime_t *b);
+void free_lifetime_scan(lifetime_scan_t *scan);
+
+#endif //ASMPP_LIFETIME_H
@@ -0,0 +1,310 @@
+#include "memopt.h"
+#include "analysis.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+
+// reg holds the bytes at location, as of the last load from or store to it.
+typedef struct {
+    expr_t *location;
+    int bytes;
+    register_kind_t reg;
+} memopt_value_t;
+
+// A store nothing has read yet: a later store to the same location makes it dead.
+typedef struct {
+    expr_t *location;
+    int bytes;
+    int index;
+} memopt_store_t;
+
+typedef struct {
+    stmt_list_t *stmts;
+    opt_stats_t *stats;
+    memopt_value_t values[MEMOPT_MAX_VALUES];
+    int values_len;
+    memopt_store_t stores[MEMOPT_MAX_VALUES];
+    int stores_len;
+    // Dead stores among the instructions kept so far, by index.
+    bool *dead;
+} memopt_t;
+
+static bool same_label(char *a, char *b) {
+    return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+static bool same_address(expr_t *a, expr_t *b) {
+    return a->memory.base == b->memory.base && a->memory.index == b->memory.index
+           && (a->memory.index == NO_REGISTER || a->memory.scale == b->memory.scale)
+           && same_label(a->memory.label, b->memory.label);
+}
+
+static bool same_location(expr_t *a, int a_bytes, expr_t *b, int b_bytes) {
+    return same_address(a, b) && a->memory.displacement == b->memory.displacement && a_bytes == b_bytes;
+}
+
+// Two accesses are disjoint when they are at different offsets from the same address, or in different data.
+static bool may_alias(expr_t *a, int a_bytes, expr_t *b, int b_bytes) {
+    bool data_only = a->memory.base == NO_REGISTER && a->memory.index == NO_REGISTER
+                     && b->memory.base == NO_REGISTER && b->memory.index == NO_REGISTER;
+    if (data_only && a->memory.label != NULL && b->memory.label != NULL && !same_label(a->memory.label, b->memory.label)) {
+        return false;
+    }
+    if (!same_address(a, b)) {
+        return true;
+    }
+    return a->memory.displacement < b->memory.displacement + b_bytes
+           && b->memory.displacement < a->memory.displacement + a_bytes;
+}
+
+static void forget_all(memopt_t *memopt) {
+    memopt->values_len = 0;
+    memopt->stores_len = 0;
+}
+
+// A mov between a register of 32 or 64 bits and memory of the same size; other widths merge into the
+// register or extend, which is not worth following.
+static bool is_full_move(instr_asm_t *instr, int mem_index) {
+    if (strcmp(instr->name, "mov") != 0 || instr->args->len != 2) {
+        return false;
+    }
+    expr_t *mem = get_expr(instr->args, mem_index);
+    expr_t *reg = get_expr(instr->args, 1 - mem_index);
+    if (mem->kind != MEMORY || reg->kind != REGISTER || register_width(reg->register_) < 32) {
+        return false;
+    }
+    return mem->memory.size == 0 || mem->memory.size * 8 == register_width(reg->register_);
+}
+
+static register_kind_t find_value(memopt_t *memopt, expr_t *location, int bytes) {
+    for (int i = 0; i < memopt->values_len; i++) {
+        if (same_location(memopt->values[i].location, memopt->values[i].bytes, location, bytes)) {
+            return memopt->values[i].reg;
+        }
+    }
+    return NO_REGISTER;
+}
+
+static void add_value(memopt_t *memopt, expr_t *location, int bytes, register_kind_t reg) {
+    if (memopt->values_len == MEMOPT_MAX_VALUES) {
+        memmove(memopt->values, memopt->values + 1, sizeof(memopt_value_t) * (MEMOPT_MAX_VALUES - 1));
+        memopt->values_len--;
+    }
+    memopt_value_t value = {.location = location, .bytes = bytes, .reg = reg};
+    memopt->values[memopt->values_len++] = value;
+}
+
+static void add_store(memopt_t *memopt, expr_t *location, int bytes, int index) {
+    if (memopt->stores_len == MEMOPT_MAX_VALUES) {
+        memmove(memopt->stores, memopt->stores + 1, sizeof(memopt_store_t) * (MEMOPT_MAX_VALUES - 1));
+        memopt->stores_len--;
+    }
+    memopt_store_t store = {.location = location, .bytes = bytes, .index = index};
+    memopt->stores[memopt->stores_len++] = store;
+}
+
+// Registers written: values held in them, and locations addressed through them, are gone.
+static void forget_regs(memopt_t *memopt, regset_t regs) {
+    int len = 0;
+    for (int i = 0; i < memopt->values_len; i++) {
+        memopt_value_t value = memopt->values[i];
+        if (!(regset_of(value.reg) & regs) && !(expr_regs(value.location) & regs)) {
+            memopt->values[len++] = value;
+        }
+    }
+    memopt->values_len = len;
+    len = 0;
+    for (int i = 0; i < memopt->stores_len; i++) {
+        if (!(expr_regs(memopt->stores[i].location) & regs)) {
+            memopt->stores[len++] = memopt->stores[i];
+        }
+    }
+    memopt->stores_len = len;
+}
+
+// location was written, or read when reading: values it may overlap are stale, stores it may overlap are read.
+static void forget_location(memopt_t *memopt, expr_t *location, int bytes, bool reading) {
+    int len = 0;
+    if (!reading) {
+        for (int i = 0; i < memopt->values_len; i++) {
+            memopt_value_t value = memopt->values[i];
+            if (!may_alias(value.location, value.bytes, location, bytes)) {
+                memopt->values[len++] = value;
+            }
+        }
+        memopt->values_len = len;
+        return;
+    }
+    for (int i = 0; i < memopt->stores_len; i++) {
+        if (!may_alias(memopt->stores[i].location, memopt->stores[i].bytes, location, bytes)) {
+            memopt->stores[len++] = memopt->stores[i];
+        }
+    }
+    memopt->stores_len = len;
+}
+
+// Size of a memory operand, from the register next to it when not written out.
+static int operand_bytes(instr_asm_t *instr, expr_t *mem) {
+    if (mem->memory.size != 0) {
+        return mem->memory.size;
+    }
+    for (int i = 0; i < instr->args->len; i++) {
+        expr_t *expr = get_expr(instr->args, i);
+        if (expr->kind == REGISTER) {
+            return register_width(expr->register_) / 8;
+        }
+    }
+    return 8;
+}
+
+// Returns false when the instruction is redundant and can go.
+static bool memopt_instr(memopt_t *memopt, instr_list_t *out, instr_t *instr) {
+    instr_asm_t *asm_ = instr->instr_asm;
+    regset_t uses, defs;
+    instr_effects(instr, &uses, &defs);
+    if (!is_known_instr(asm_) || is_volatile_access(memopt->stmts, instr)) {
+        forget_all(memopt);
+        return true;
+    }
+
+    if (is_full_move(asm_, 1)) {
+        // mov reg, [m] when a register already holds [m]: a register move, or nothing when it is the same one.
+        expr_t *dst = get_expr(asm_->args, 0);
+        expr_t *src = get_expr(asm_->args, 1);
+        int bytes = register_width(dst->register_) / 8;
+        register_kind_t holder = find_value(memopt, src, bytes);
+        if (holder == dst->register_) {
+            memopt->stats->loads_removed++;
+            return false;
+        }
+        expr_t *location = src;
+        if (holder != NO_REGISTER) {
+            location = copy_expr(src);
+            *src = *new_expr_register(holder);
+            memopt->stats->loads_removed++;
+        } else {
+            forget_location(memopt, src, bytes, true);
+        }
+        forget_regs(memopt, regset_of(dst->register_));
+        if (!(expr_regs(location) & regset_of(dst->register_))) {
+            add_value(memopt, location, bytes, dst->register_);
+        }
+        return true;
+    }
+
+    if (is_full_move(asm_, 0)) {
+        expr_t *dst = get_expr(asm_->args, 0);
+        expr_t *src = get_expr(asm_->args, 1);
+        int bytes = register_width(src->register_) / 8;
+        // Storing back what was loaded from there.
+        if (find_value(memopt, dst, bytes) == src->register_) {
+            memopt->stats->stores_removed++;
+            return false;
+        }
+        for (int i = 0; i < memopt->stores_len; i++) {
+            if (same_location(memopt->stores[i].location, memopt->stores[i].bytes, dst, bytes)) {
+                // Overwritten before anything read it.
+                memopt->dead[memopt->stores[i].index] = true;
+                memopt->stats->stores_removed++;
+            }
+        }
+        forget_location(memopt, dst, bytes, true);
+        forget_location(memopt, dst, bytes, false);
+        add_value(memopt, dst, bytes, src->register_);
+        add_store(memopt, dst, bytes, out->len);
+        return true;
+    }
+
+    // Explicit memory operands are read, and written as well by an instruction that writes memory.
+    for (int i = 0; i < asm_->args->len; i++) {
+        expr_t *expr = get_expr(asm_->args, i);
+        if (expr->kind != MEMORY || strcmp(asm_->name, "lea") == 0) {
+            continue;
+        }
+        int bytes = operand_bytes(asm_, expr);
+        forget_location(memopt, expr, bytes, true);
+        if (defs & REGSET_MEMORY) {
+            forget_location(memopt, expr, bytes, false);
+        }
+    }
+    static const char *implicit[] = {"push", "pop", "call", "syscall", "leave", "ret"};
+    for (int i = 0; i < (int) (sizeof(implicit) / sizeof(implicit[0])); i++) {
+        if (strcmp(asm_->name, implicit[i]) == 0) {
+            // They reach memory through rsp without naming it.
+            forget_all(memopt);
+            return true;
+        }
+    }
+    if (asm_->name[0] == 'j') {
+        // Whatever is at the target may read the stores.
+        memopt->stores_len = 0;
+    }
+    forget_regs(memopt, defs & REGSET_GPR);
+    return true;
+}
+
+static void memopt_list(memopt_t *memopt, instr_list_t *list);
+
+static void memopt_nested(memopt_t *memopt, instr_t *instr) {
+    switch (instr->kind) {
+        case INSTR_IF:
+            memopt_list(memopt, instr->instr_if->then_instrs);
+            memopt_list(memopt, instr->instr_if->else_instrs);
+            break;
+        case INSTR_LOOP:
+            memopt_list(memopt, instr->instr_loop->body);
+            break;
+        case INSTR_SWITCH:
+            for (int j = 0; j < instr->instr_switch->len; j++) {
+                memopt_list(memopt, instr->instr_switch->bodies[j]);
+            }
+            memopt_list(memopt, instr->instr_switch->default_instrs);
+            break;
+        default:
+            break;
+    }
+}
+
+// Nothing enters a list but through its top, so what is known holds until a call, a nested block or an
+// instruction that may touch memory behind our back.
+static void memopt_list(memopt_t *memopt, instr_list_t *list) {
+    bool *saved = memopt->dead;
+    memopt->dead = calloc(list->len + 1, sizeof(bool));
+    if (memopt->dead == NULL) {
+        error("Failed to allocate memory for memory optimization", ERROR_ALLOC);
+    }
+    forget_all(memopt);
+    instr_list_t *out = new_instr_list();
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        if (instr->kind != INSTR_ASM) {
+            memopt_nested(memopt, instr);
+            forget_all(memopt);
+            append_instr(out, instr);
+            continue;
+        }
+        if (memopt_instr(memopt, out, instr)) {
+            append_instr(out, instr);
+        }
+    }
+    list->len = 0;
+    for (int i = 0; i < out->len; i++) {
+        if (!memopt->dead[i]) {
+            list->instrs[list->len++] = *get_instr(out, i);
+        }
+    }
+    free(memopt->dead);
+    memopt->dead = saved;
+}
+
+// Loads of a location a register already holds become register moves, or go; stores of what a location
+// already holds, and stores overwritten before any read, go. Only within a block; [volatile] data is left alone.
+void eliminate_redundant_memory_ops(stmt_list_t *stmts, opt_stats_t *stats) {
+    memopt_t memopt = {.stmts = stmts, .stats = stats, .values_len = 0, .stores_len = 0, .dead = NULL};
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            memopt_list(&memopt, stmt->label->instrs);
+        }
+    }
+}
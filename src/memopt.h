@@ -0,0 +1,12 @@
+#ifndef ASMPP_MEMOPT_H
+#define ASMPP_MEMOPT_H
+
+#include "ast.h"
+#include "optimize.h"
+
+// Memory locations known to be held in registers at a time.
+#define MEMOPT_MAX_VALUES 16
+
+void eliminate_redundant_memory_ops(stmt_list_t *stmts, opt_stats_t *stats);
+
+#endif //ASMPP_MEMOPT_H
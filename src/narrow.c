@@ -0,0 +1,124 @@
+#include "narrow.h"
+#include "analysis.h"
+#include <string.h>
+
+static bool is_reg_width(expr_t *expr, int bits) {
+    return expr->kind == REGISTER && register_family(expr->register_) <= R15 && expr->register_ < AH
+           && register_width(expr->register_) == bits;
+}
+
+static void set_width(expr_t *expr, int bits) {
+    expr->register_ = register_with_width(register_family(expr->register_), bits);
+}
+
+static bool is_op(instr_asm_t *instr, char *op, int argc) {
+    return strcmp(instr->name, op) == 0 && instr->args->len == argc;
+}
+
+// Rewrites that give the same result and the same flags with a shorter encoding: 32-bit writes
+// zero-extend to 64 bits, so the REX.W prefix or the imm64/sign-extended imm32 form is not needed.
+bool narrow_instr(instr_asm_t *instr) {
+    if (instr->args->len == 0) {
+        return false;
+    }
+    expr_t *dst = get_expr(instr->args, 0);
+    expr_t *src = instr->args->len > 1 ? get_expr(instr->args, 1) : NULL;
+    if (!is_reg_width(dst, 64)) {
+        return false;
+    }
+    if (is_op(instr, "mov", 2) && src->kind == IMMEDIATE && src->immediate >= 0 && src->immediate <= UINT32_MAX) {
+        set_width(dst, 32);
+        return true;
+    }
+    if (is_op(instr, "xor", 2) && expr_equal(dst, src)) {
+        set_width(dst, 32);
+        set_width(src, 32);
+        return true;
+    }
+    // The result has its upper half clear either way, so the sign and zero flags agree too.
+    if (is_op(instr, "and", 2) && src->kind == IMMEDIATE && src->immediate >= 0 && src->immediate <= INT32_MAX) {
+        set_width(dst, 32);
+        return true;
+    }
+    if (is_op(instr, "movzx", 2)) {
+        set_width(dst, 32);
+        return true;
+    }
+    return false;
+}
+
+// Rewrites that are shorter but write the flags differently (or not at all).
+static bool narrow_flags_dead(instr_asm_t *instr) {
+    if (instr->args->len != 2) {
+        return false;
+    }
+    expr_t *dst = get_expr(instr->args, 0);
+    expr_t *src = get_expr(instr->args, 1);
+    if (!(is_reg_width(dst, 64) || is_reg_width(dst, 32)) || src->kind != IMMEDIATE) {
+        return false;
+    }
+    register_kind_t r32 = register_with_width(register_family(dst->register_), 32);
+    if (strcmp(instr->name, "mov") == 0 && src->immediate == 0) {
+        instr->name = "xor";
+        dst->register_ = r32;
+        *src = *new_expr_register(r32);
+        return true;
+    }
+    if (strcmp(instr->name, "and") != 0) {
+        return false;
+    }
+    if (src->immediate == 0xff || src->immediate == 0xffff) {
+        instr->name = "movzx";
+        dst->register_ = r32;
+        *src = *new_expr_register(register_with_width(register_family(r32), src->immediate == 0xff ? 8 : 16));
+        return true;
+    }
+    if (src->immediate == 0xffffffff && register_width(dst->register_) == 64) {
+        instr->name = "mov";
+        dst->register_ = r32;
+        *src = *new_expr_register(r32);
+        return true;
+    }
+    return false;
+}
+
+static void narrow_list(label_t *label, instr_list_t *list, opt_stats_t *stats) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        if (instr->kind == INSTR_IF) {
+            narrow_list(label, instr->instr_if->then_instrs, stats);
+            narrow_list(label, instr->instr_if->else_instrs, stats);
+            continue;
+        }
+        if (instr->kind == INSTR_LOOP) {
+            narrow_list(label, instr->instr_loop->body, stats);
+            continue;
+        }
+        if (instr->kind == INSTR_SWITCH) {
+            for (int j = 0; j < instr->instr_switch->len; j++) {
+                narrow_list(label, instr->instr_switch->bodies[j], stats);
+            }
+            narrow_list(label, instr->instr_switch->default_instrs, stats);
+            continue;
+        }
+        if (instr->kind != INSTR_ASM) {
+            continue;
+        }
+        bool flags_dead = !(live_after(label->instrs, instr, label_live_out(label)) & REGSET_FLAGS);
+        bool narrowed = flags_dead && narrow_flags_dead(instr->instr_asm);
+        // The flags-dead rewrites may leave a 64-bit form that narrows further.
+        narrowed |= narrow_instr(instr->instr_asm);
+        if (narrowed) {
+            stats->instrs_narrowed++;
+        }
+    }
+}
+
+void narrow_instructions(stmt_list_t *stmts, opt_stats_t *stats) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            narrow_list(stmt->label, stmt->label->instrs, stats);
+        }
+    }
+}
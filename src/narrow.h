@@ -0,0 +1,10 @@
+#ifndef ASMPP_NARROW_H
+#define ASMPP_NARROW_H
+
+#include "ast.h"
+#include "optimize.h"
+
+bool narrow_instr(instr_asm_t *instr);
+void narrow_instructions(stmt_list_t *stmts, opt_stats_t *stats);
+
+#endif //ASMPP_NARROW_H
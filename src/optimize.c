@@ -0,0 +1,64 @@
+#include "optimize.h"
+#include "dce.h"
+#include "inliner.h"
+#include "tailcall.h"
+#include "constprop.h"
+#include "isel.h"
+#include "narrow.h"
+#include "licm.h"
+#include "sched.h"
+#include "memopt.h"
+#include "regalloc.h"
+#include "frame.h"
+#include "summary.h"
+#include "target.h"
+#include "error.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+opt_stats_t *new_opt_stats() {
+    opt_stats_t *stats = malloc(sizeof(opt_stats_t));
+    if (stats == NULL) {
+        error("Failed to allocate memory for optimization stats", ERROR_ALLOC);
+    }
+    memset(stats, 0, sizeof(opt_stats_t));
+    return stats;
+}
+
+void print_opt_stats(opt_stats_t *stats) {
+    printf("Optimization stats:\n");
+    printf("  Labels removed:         %d\n", stats->labels_removed);
+    printf("  Instructions removed:   %d\n", stats->instrs_removed);
+    printf("  Calls inlined:          %d\n", stats->calls_inlined);
+    printf("  Tail calls:             %d\n", stats->tail_calls);
+    printf("  Constants propagated:   %d\n", stats->consts_propagated);
+    printf("  Instructions selected:  %d\n", stats->instrs_selected);
+    printf("  Instructions narrowed:  %d\n", stats->instrs_narrowed);
+    printf("  Instructions hoisted:   %d\n", stats->instrs_hoisted);
+    printf("  Profile hints:          %d\n", stats->profile_hints);
+    printf("  Instructions scheduled: %d\n", stats->instrs_scheduled);
+    printf("  Loads eliminated:       %d\n", stats->loads_removed);
+    printf("  Stores eliminated:      %d\n", stats->stores_removed);
+    printf("  Labels folded:          %d\n", stats->labels_folded);
+    printf("  Registers spilled:      %d\n", stats->regs_spilled);
+    printf("  Spill moves inserted:   %d\n", stats->spill_moves);
+    printf("  Stack slots shared:     %d\n", stats->slots_shared);
+    printf("  Registers saved:        %d\n", stats->regs_saved);
+    printf("  Code size (estimated):  %d bytes\n", stats->code_size);
+}
+
+void optimize(stmt_list_t *stmts, config_t *config, opt_stats_t *stats) {
+    allocate_registers(stmts, stats);
+    inline_calls(stmts, stats);
+    hoist_loop_invariants(stmts, stats);
+    propagate_constants(stmts, stats);
+    select_instructions(stmts, stats);
+    eliminate_redundant_memory_ops(stmts, stats);
+    narrow_instructions(stmts, stats);
+    optimize_tail_calls(stmts, stats);
+    eliminate_dead_code(stmts, stats);
+    summarize_labels(stmts);
+    layout_frames(stmts, config, stats);
+    schedule_instructions(stmts, find_target(config->arch), stats);
+}
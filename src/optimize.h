@@ -0,0 +1,32 @@
+#ifndef ASMPP_OPTIMIZE_H
+#define ASMPP_OPTIMIZE_H
+
+#include "ast.h"
+#include "cli.h"
+
+typedef struct {
+    int labels_removed;
+    int instrs_removed;
+    int calls_inlined;
+    int tail_calls;
+    int consts_propagated;
+    int instrs_selected;
+    int instrs_narrowed;
+    int instrs_hoisted;
+    int profile_hints;
+    int instrs_scheduled;
+    int loads_removed;
+    int stores_removed;
+    int labels_folded;
+    int regs_spilled;
+    int spill_moves;
+    int slots_shared;
+    int regs_saved;
+    int code_size;
+} opt_stats_t;
+
+opt_stats_t *new_opt_stats();
+void print_opt_stats(opt_stats_t *stats);
+void optimize(stmt_list_t *stmts, config_t *config, opt_stats_t *stats);
+
+#endif //ASMPP_OPTIMIZE_H
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 
 parser_t *new_parser(token_list_t *tokens) {
     parser_t *parser = malloc(sizeof(parser_t));
@@ -12,6 +13,13 @@ parser_t *new_parser(token_list_t *tokens) {
     parser->tokens = tokens;
     parser->stmts = new_stmt_list();
     parser->index = 0;
+    parser->label = NULL;
+    parser->constants_len = 0;
+    parser->constants_capacity = 8;
+    parser->constants = malloc(sizeof(constant_t) * parser->constants_capacity);
+    if (parser->constants == NULL) {
+        error("Failed to allocate memory for constants", ERROR_ALLOC);
+    }
     return parser;
 }
 
@@ -113,6 +121,7 @@ void parse(parser_t *parser) {
             }
 
             expect(parser, TOKEN_LBRACE);
+            parser->label = label;
 
             while (!check(parser, TOKEN_RBRACE)) {
                 if (eof(parser)) {
@@ -123,10 +132,21 @@ void parse(parser_t *parser) {
                     continue;
                 }
 
+                if (match_ident(parser, "var")) {
+                    parse_var(parser);
+                    continue;
+                }
+
+                if (match_ident(parser, "local")) {
+                    parse_local(parser);
+                    continue;
+                }
+
                 instr_t* instr = parse_instr(parser);
                 append_instr(label->instrs, instr);
             }
             expect(parser, TOKEN_RBRACE);
+            parser->label = NULL;
             append_stmt(parser->stmts, new_label_stmt(label));
         } else if (match_ident(parser, "extern")) {
             token_t *ident = expect(parser, TOKEN_IDENT);
@@ -152,8 +172,16 @@ void parse(parser_t *parser) {
 
             append_stmt(parser->stmts, new_extern_stmt(new_extern(abi, ident->lexeme, attributes)));
 
+        } else if (match_ident(parser, "const")) {
+            token_t *ident = expect(parser, TOKEN_IDENT);
+            expect(parser, TOKEN_ASSIGN);
+            define_constant(parser, ident->lexeme, parse_const_expr(parser));
         } else if (match_ident(parser, "data")) {
             token_t *ident = expect(parser, TOKEN_IDENT);
+            attribute_list_t *attributes = new_attribute_list();
+            if (check(parser, TOKEN_LBRACKET)) {
+                attributes = parse_attribute_list(parser);
+            }
             expect(parser, TOKEN_COLON);
             type_t *type = parse_type(parser);
             if (match(parser, TOKEN_ASSIGN)) {
@@ -168,9 +196,13 @@ void parse(parser_t *parser) {
                     expr_t *expr = parse_expr(parser);
                     append_expr(values, expr);
                 }
-                append_stmt(parser->stmts, new_data_stmt(new_data(ident->lexeme, type, values)));
+                data_t *data = new_data(ident->lexeme, type, values);
+                data->attributes = attributes;
+                append_stmt(parser->stmts, new_data_stmt(data));
             } else {
-                append_stmt(parser->stmts, new_data_stmt(new_data_uninitialized(ident->lexeme, type)));
+                data_t *data = new_data_uninitialized(ident->lexeme, type);
+                data->attributes = attributes;
+                append_stmt(parser->stmts, new_data_stmt(data));
             }
         } else {
             instr_t *instr = parse_instr(parser);
@@ -199,8 +231,14 @@ attribute_list_t *parse_attribute_list(parser_t *parser) {
                 if (args->len > 0) {
                     expect(parser, TOKEN_COMMA);
                 }
-                token_t *arg = expect(parser, TOKEN_STRING);
-                append_string(args, arg->lexeme);
+                if (check(parser, TOKEN_STRING)) {
+                    append_string(args, expect(parser, TOKEN_STRING)->lexeme);
+                } else {
+                    // Numeric arguments such as unroll(4) may use constants, they are kept in decimal.
+                    char *arg = malloc(32);
+                    snprintf(arg, 32, "%lld", (long long) parse_const_expr(parser));
+                    append_string(args, arg);
+                }
             }
             append_attribute(attributes, new_attribute(ATTR_DIRECTIVE, ident->lexeme, args));
         } else {
@@ -224,9 +262,12 @@ type_t* parse_type(parser_t *parser) {
     } else {
         error("Invalid type", ERROR_INVALID);
     }
-    if (match(parser, TOKEN_LBRACKET)) {
-        token_t* number = expect(parser, TOKEN_NUMBER);
-        int length = atoi(number->lexeme);
+    // A bracket opening attributes, as in `local buf: qword [align(16)]`, is not an array length.
+    bool attributes = check(parser, TOKEN_LBRACKET) && parser->index + 1 < parser->tokens->len
+            && get_token(parser->tokens, parser->index + 1)->kind == TOKEN_IDENT
+            && find_constant(parser, get_token(parser->tokens, parser->index + 1)->lexeme) == NULL;
+    if (!attributes && match(parser, TOKEN_LBRACKET)) {
+        int length = (int) parse_const_expr(parser);
         expect(parser, TOKEN_RBRACKET);
         return new_array_type(
                 new_simple_type(kind),
@@ -238,22 +279,134 @@ type_t* parse_type(parser_t *parser) {
 
 }
 
+// A physical register, or a virtual one of the label being parsed. -1 when name is neither.
+static int find_register(parser_t *parser, char *name) {
+    int reg = find_register_kind_by_name(name);
+    if (reg != -1 || parser->label == NULL) {
+        return reg;
+    }
+    int var = find_var(parser->label->vars, name);
+    return var == -1 ? -1 : VIRTUAL_REGISTER + var;
+}
+
+// `var name` or `var name: type`, after the `var`.
+void parse_var(parser_t *parser) {
+    token_t *ident = expect(parser, TOKEN_IDENT);
+    if (find_register(parser, ident->lexeme) != -1 || find_constant(parser, ident->lexeme) != NULL
+        || find_local(parser->label->locals, ident->lexeme) != -1) {
+        error("Var name is already a register, a constant or a local", ERROR_INVALID);
+    }
+    int width = 64;
+    if (match(parser, TOKEN_COLON)) {
+        type_t *type = parse_type(parser);
+        if (type->kind == TYPE_ARRAY) {
+            error("A var holds a single byte, word, dword or qword", ERROR_INVALID);
+        }
+        width = 8 << type->kind;
+        free_type(type);
+    }
+    append_var(parser->label->vars, new_var(ident->lexeme, width));
+}
+
+// `local name`, `local name: type` or `local name: type [align(n)]`, after the `local`. A qword by default,
+// aligned to its element size unless told otherwise.
+void parse_local(parser_t *parser) {
+    token_t *ident = expect(parser, TOKEN_IDENT);
+    if (find_register(parser, ident->lexeme) != -1 || find_constant(parser, ident->lexeme) != NULL
+        || find_local(parser->label->locals, ident->lexeme) != -1) {
+        error("Local name is already a register, a constant or a local", ERROR_INVALID);
+    }
+    int size = 8;
+    int align = 8;
+    if (match(parser, TOKEN_COLON)) {
+        type_t *type = parse_type(parser);
+        if (type->kind == TYPE_ARRAY) {
+            align = 1 << type->base->kind;
+            size = align * type->array_size;
+        } else {
+            align = 1 << type->kind;
+            size = align;
+        }
+        free_type(type);
+    }
+    if (size <= 0) {
+        error("A local must be at least one byte", ERROR_INVALID);
+    }
+    if (check(parser, TOKEN_LBRACKET)) {
+        attribute_list_t *attributes = parse_attribute_list(parser);
+        for (int i = 0; i < attributes->len; i++) {
+            attribute_t *attribute = get_attribute(attributes, i);
+            if (strcmp(attribute->name, "align") != 0 || attribute->value == NULL || attribute->value->len != 1) {
+                error("Locals only take an align(n) attribute", ERROR_INVALID);
+            }
+            char *end;
+            long value = strtol(get_string(attribute->value, 0), &end, 10);
+            if (*end != '\0' || value < 1 || value > 4096 || (value & (value - 1)) != 0) {
+                error("Local alignment must be a power of two up to 4096", ERROR_INVALID);
+            }
+            align = (int) value;
+        }
+    }
+    append_local(parser->label->locals, new_local(ident->lexeme, size, align));
+}
+
+// `loop reg, count { ... }`, as opposed to the x86 `loop target` instruction.
+static bool is_counted_loop(parser_t *parser) {
+    token_t *token = peek(parser);
+    if (token->kind != TOKEN_IDENT || strcmp(token->lexeme, "loop") != 0 || parser->index + 2 >= parser->tokens->len) {
+        return false;
+    }
+    token_t *counter = get_token(parser->tokens, parser->index + 1);
+    return counter->kind == TOKEN_IDENT && find_register(parser, counter->lexeme) != -1
+           && get_token(parser->tokens, parser->index + 2)->kind == TOKEN_COMMA;
+}
+
+instr_list_t* parse_block(parser_t *parser) {
+    instr_list_t* instrs = new_instr_list();
+    expect(parser, TOKEN_LBRACE);
+    while (!match(parser, TOKEN_RBRACE)) {
+        if (eof(parser)) {
+            error("Unexpected end of file, expected '}' ", ERROR_INVALID);
+        }
+        if (match(parser, TOKEN_NEWLINE)) {
+            continue;
+        }
+        append_instr(instrs, parse_instr(parser));
+    }
+    return instrs;
+}
+
 instr_t* parse_instr(parser_t *parser) {
     token_t *token = peek(parser);
 
+    if (token->kind == TOKEN_IDENT && strcmp(token->lexeme, "var") == 0) {
+        error("var is only allowed at the top level of a label", ERROR_INVALID);
+    }
+    if (token->kind == TOKEN_IDENT && strcmp(token->lexeme, "local") == 0) {
+        error("local is only allowed at the top level of a label", ERROR_INVALID);
+    }
+
     if (match_ident(parser, "if")) {
-        token_t* cmp_op = expect(parser, TOKEN_IDENT);
-        expect(parser, TOKEN_LPAREN);
-        expr_list_t *cond = new_expr_list();
-        expr_t* arg0 = parse_expr(parser);
-        append_expr(cond, arg0);
-        expect(parser, TOKEN_COMMA);
-        expr_t* arg1 = parse_expr(parser);
-        append_expr(cond, arg1);
-        expect(parser, TOKEN_RPAREN);
+        // if.likely / if.unlikely are shorthands for the [likely] / [unlikely] attributes.
+        char *hint = NULL;
+        if (match(parser, TOKEN_DOT)) {
+            token_t *ident = expect(parser, TOKEN_IDENT);
+            if (strcmp(ident->lexeme, "likely") != 0 && strcmp(ident->lexeme, "unlikely") != 0) {
+                error("Expected 'likely' or 'unlikely' after 'if.'", ERROR_INVALID);
+            }
+            hint = ident->lexeme;
+        }
+        cond_t* cond = parse_cond(parser);
+        attribute_list_t *attributes = new_attribute_list();
+        if (check(parser, TOKEN_LBRACKET)) {
+            attributes = parse_attribute_list(parser);
+        }
+        if (hint != NULL) {
+            append_attribute(attributes, new_attribute(ATTR_FLAG, hint, NULL));
+        }
         expect(parser, TOKEN_LBRACE);
 
-        instr_if_t* instr_if = new_instr_if(cond, get_cmp_kind_by_name(cmp_op->lexeme), new_instr_list(), new_instr_list());
+        instr_if_t* instr_if = new_instr_if(cond, new_instr_list(), new_instr_list(), attributes);
 
         while (!check(parser, TOKEN_RBRACE) && !eof(parser)) {
             if (eof(parser)) {
@@ -270,6 +423,9 @@ instr_t* parse_instr(parser_t *parser) {
         match(parser, TOKEN_RBRACE);
 
         if (match_ident(parser, "else")) {
+            if (check(parser, TOKEN_LBRACKET)) {
+                instr_if->else_attributes = parse_attribute_list(parser);
+            }
             expect(parser, TOKEN_LBRACE);
             while (!match(parser, TOKEN_RBRACE) && !eof(parser)) {
                 if (eof(parser)) {
@@ -286,6 +442,70 @@ instr_t* parse_instr(parser_t *parser) {
         }
 
         return new_if_instr(instr_if);
+    } else if (match_ident(parser, "while")) {
+        cond_t* cond = parse_cond(parser);
+        attribute_list_t *attributes = new_attribute_list();
+        if (check(parser, TOKEN_LBRACKET)) {
+            attributes = parse_attribute_list(parser);
+        }
+        return new_loop_instr(new_instr_while(cond, parse_block(parser), attributes));
+    } else if (match_ident(parser, "switch")) {
+        expr_t* value = parse_expr(parser);
+        if (value->kind != REGISTER) {
+            error("Switch value must be a register", ERROR_INVALID);
+        }
+        attribute_list_t *attributes = new_attribute_list();
+        if (check(parser, TOKEN_LBRACKET)) {
+            attributes = parse_attribute_list(parser);
+        }
+        instr_switch_t* instr_switch = new_instr_switch(value, attributes);
+        instr_list_t* arm = NULL;
+        bool has_default = false;
+        expect(parser, TOKEN_LBRACE);
+        while (!match(parser, TOKEN_RBRACE)) {
+            if (eof(parser)) {
+                error("Unexpected end of file, expected '}' ", ERROR_INVALID);
+            }
+            if (match(parser, TOKEN_NEWLINE)) {
+                continue;
+            }
+            if (match_ident(parser, "case")) {
+                int64_t case_value = parse_const_expr(parser);
+                for (int i = 0; i < instr_switch->len; i++) {
+                    if (instr_switch->cases[i] == case_value) {
+                        error("Duplicate case in switch", ERROR_INVALID);
+                    }
+                }
+                expect(parser, TOKEN_COLON);
+                arm = new_instr_list();
+                append_case(instr_switch, case_value, arm);
+            } else if (match_ident(parser, "default")) {
+                if (has_default) {
+                    error("Duplicate default in switch", ERROR_INVALID);
+                }
+                expect(parser, TOKEN_COLON);
+                has_default = true;
+                arm = instr_switch->default_instrs;
+            } else if (arm == NULL) {
+                error("Expected 'case' or 'default' in switch", ERROR_INVALID);
+            } else {
+                append_instr(arm, parse_instr(parser));
+            }
+        }
+        return new_switch_instr(instr_switch);
+    } else if (is_counted_loop(parser)) {
+        advance(parser, 1);
+        expr_t* counter = parse_expr(parser);
+        if (counter->kind != REGISTER) {
+            error("Loop counter must be a register", ERROR_INVALID);
+        }
+        expect(parser, TOKEN_COMMA);
+        expr_t* count = parse_expr(parser);
+        attribute_list_t *attributes = new_attribute_list();
+        if (check(parser, TOKEN_LBRACKET)) {
+            attributes = parse_attribute_list(parser);
+        }
+        return new_loop_instr(new_instr_counted_loop(counter, count, parse_block(parser), attributes));
     } else if (match(parser, TOKEN_IDENT)){
         token_t* opcode = token;
         if (match(parser, TOKEN_LPAREN)) {
@@ -304,7 +524,7 @@ instr_t* parse_instr(parser_t *parser) {
             return new_call_instr(new_instr_call(opcode->lexeme, args));
         }
         instr_asm_t* instr_asm = new_instr_asm(opcode->lexeme, new_expr_list());
-        if (!match(parser, TOKEN_NEWLINE)) {
+        if (!eof(parser) && !match(parser, TOKEN_NEWLINE) && !check(parser, TOKEN_RBRACE)) {
             expr_t* arg0 = parse_expr(parser);
             append_expr(instr_asm->args, arg0);
             while (check(parser, TOKEN_COMMA) && !eof(parser)) {
@@ -316,9 +536,7 @@ instr_t* parse_instr(parser_t *parser) {
                 append_expr(instr_asm->args, expr);
             }
 
-            if (!eof(parser)) {
-                advance(parser, 1);
-            }
+            match(parser, TOKEN_NEWLINE);
         }
 
 
@@ -328,14 +546,283 @@ instr_t* parse_instr(parser_t *parser) {
     }
 }
 
-expr_t* parse_expr(parser_t *parser) {
+cond_t* parse_cond(parser_t *parser) {
+    token_t* op = expect(parser, TOKEN_IDENT);
+    expect(parser, TOKEN_LPAREN);
+    if (strcmp(op->lexeme, "not") == 0) {
+        cond_t* cond = new_cond_logical(COND_NOT, parse_cond(parser), NULL);
+        expect(parser, TOKEN_RPAREN);
+        return cond;
+    }
+    if (strcmp(op->lexeme, "and") == 0 || strcmp(op->lexeme, "or") == 0) {
+        cond_kind_t kind = op->lexeme[0] == 'a' ? COND_AND : COND_OR;
+        cond_t* cond = parse_cond(parser);
+        while (match(parser, TOKEN_COMMA)) {
+            cond = new_cond_logical(kind, cond, parse_cond(parser));
+        }
+        expect(parser, TOKEN_RPAREN);
+        return cond;
+    }
+    expr_list_t *operands = new_expr_list();
+    append_expr(operands, parse_expr(parser));
+    expect(parser, TOKEN_COMMA);
+    append_expr(operands, parse_expr(parser));
+    expect(parser, TOKEN_RPAREN);
+    return new_cond_cmp(get_cmp_kind_by_name(op->lexeme), operands);
+}
+
+void define_constant(parser_t* parser, char* name, int64_t value) {
+    if (find_register_kind_by_name(name) != -1) {
+        error("Constant name is a register", ERROR_INVALID);
+    }
+    if (find_constant(parser, name) != NULL) {
+        error("Constant already defined", ERROR_INVALID);
+    }
+    if (parser->constants_len == parser->constants_capacity) {
+        parser->constants_capacity *= 2;
+        parser->constants = realloc(parser->constants, sizeof(constant_t) * parser->constants_capacity);
+        if (parser->constants == NULL) {
+            error("Failed to reallocate memory for constants", ERROR_ALLOC);
+        }
+    }
+    parser->constants[parser->constants_len].name = name;
+    parser->constants[parser->constants_len].value = value;
+    parser->constants_len++;
+}
+
+constant_t* find_constant(parser_t* parser, char* name) {
+    for (int i = 0; i < parser->constants_len; i++) {
+        if (strcmp(parser->constants[i].name, name) == 0) {
+            return &parser->constants[i];
+        }
+    }
+    return NULL;
+}
+
+// Decimal, 0x hexadecimal or 0b binary. Values up to 2^64 - 1 wrap to the matching negative immediate.
+static int64_t parse_number(token_t* token) {
+    char* digits = token->lexeme;
+    int base = 10;
+    if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+        base = 16;
+        digits += 2;
+    } else if (digits[0] == '0' && (digits[1] == 'b' || digits[1] == 'B')) {
+        base = 2;
+        digits += 2;
+    }
+    char* end;
+    errno = 0;
+    uint64_t value = strtoull(digits, &end, base);
+    if (*digits == '\0' || *end != '\0' || errno == ERANGE) {
+        error("Invalid number", ERROR_INVALID);
+    }
+    return (int64_t) value;
+}
+
+static bool is_const_start(parser_t* parser) {
+    if (eof(parser)) {
+        return false;
+    }
+    token_t* token = peek(parser);
+    switch (token->kind) {
+        case TOKEN_NUMBER:
+        case TOKEN_LPAREN:
+        case TOKEN_MINUS:
+        case TOKEN_PLUS:
+        case TOKEN_TILDE:
+            return true;
+        case TOKEN_IDENT:
+            return find_constant(parser, token->lexeme) != NULL;
+        default:
+            return false;
+    }
+}
+
+static int64_t parse_const_unary(parser_t* parser) {
     token_t* token = peek(parser);
+    if (match(parser, TOKEN_MINUS)) {
+        return (int64_t) -(uint64_t) parse_const_unary(parser);
+    }
+    if (match(parser, TOKEN_PLUS)) {
+        return parse_const_unary(parser);
+    }
+    if (match(parser, TOKEN_TILDE)) {
+        return ~parse_const_unary(parser);
+    }
     if (match(parser, TOKEN_NUMBER)) {
-        int value = atoi(token->lexeme);
-        return new_expr_immediate(value);
+        return parse_number(token);
+    }
+    if (match(parser, TOKEN_LPAREN)) {
+        int64_t value = parse_const_expr(parser);
+        expect(parser, TOKEN_RPAREN);
+        return value;
     }
     if (match(parser, TOKEN_IDENT)) {
-        return new_expr_register(get_register_kind_by_name(token->lexeme));
+        constant_t* constant = find_constant(parser, token->lexeme);
+        if (constant == NULL) {
+            error("Unknown constant", ERROR_INVALID);
+        }
+        return constant->value;
+    }
+    error("Unexpected token in constant expression", ERROR_INVALID);
+    return 0;
+}
+
+static int64_t parse_const_mul(parser_t* parser) {
+    int64_t value = parse_const_unary(parser);
+    while (check(parser, TOKEN_STAR) || check(parser, TOKEN_SLASH) || check(parser, TOKEN_PERCENT)) {
+        token_kind_t op = peek(parser)->kind;
+        advance(parser, 1);
+        int64_t rhs = parse_const_unary(parser);
+        if (op == TOKEN_STAR) {
+            value = (int64_t) ((uint64_t) value * (uint64_t) rhs);
+            continue;
+        }
+        if (rhs == 0) {
+            error("Division by zero in constant expression", ERROR_INVALID);
+        }
+        if (rhs == -1) {
+            value = op == TOKEN_SLASH ? (int64_t) -(uint64_t) value : 0;
+        } else {
+            value = op == TOKEN_SLASH ? value / rhs : value % rhs;
+        }
+    }
+    return value;
+}
+
+static int64_t parse_const_add(parser_t* parser) {
+    int64_t value = parse_const_mul(parser);
+    while (check(parser, TOKEN_PLUS) || check(parser, TOKEN_MINUS)) {
+        bool add = peek(parser)->kind == TOKEN_PLUS;
+        advance(parser, 1);
+        uint64_t rhs = (uint64_t) parse_const_mul(parser);
+        value = (int64_t) (add ? (uint64_t) value + rhs : (uint64_t) value - rhs);
+    }
+    return value;
+}
+
+static int64_t parse_const_shift(parser_t* parser) {
+    int64_t value = parse_const_add(parser);
+    while (check(parser, TOKEN_SHL) || check(parser, TOKEN_SHR)) {
+        bool left = peek(parser)->kind == TOKEN_SHL;
+        advance(parser, 1);
+        int64_t count = parse_const_add(parser);
+        if (count < 0 || count > 63) {
+            error("Shift count out of range in constant expression", ERROR_INVALID);
+        }
+        // Like the instructions: << is shl, >> is the logical shr.
+        value = (int64_t) (left ? (uint64_t) value << count : (uint64_t) value >> count);
+    }
+    return value;
+}
+
+static int64_t parse_const_and(parser_t* parser) {
+    int64_t value = parse_const_shift(parser);
+    while (match(parser, TOKEN_AMP)) {
+        value &= parse_const_shift(parser);
+    }
+    return value;
+}
+
+static int64_t parse_const_xor(parser_t* parser) {
+    int64_t value = parse_const_and(parser);
+    while (match(parser, TOKEN_CARET)) {
+        value ^= parse_const_and(parser);
+    }
+    return value;
+}
+
+// Operand arithmetic is folded at parse time with C precedence and 64-bit wrap-around.
+int64_t parse_const_expr(parser_t *parser) {
+    int64_t value = parse_const_xor(parser);
+    while (match(parser, TOKEN_PIPE)) {
+        value |= parse_const_xor(parser);
+    }
+    return value;
+}
+
+static int get_size_by_name(char* name) {
+    if (strcmp(name, "byte") == 0) {
+        return 1;
+    } else if (strcmp(name, "word") == 0) {
+        return 2;
+    } else if (strcmp(name, "dword") == 0) {
+        return 4;
+    } else if (strcmp(name, "qword") == 0) {
+        return 8;
+    }
+    return 0;
+}
+
+// [base + index*scale + label + displacement], terms in any order.
+expr_t* parse_memory(parser_t *parser, int size) {
+    expect(parser, TOKEN_LBRACKET);
+    expr_t* memory = new_expr_memory(NO_REGISTER, NO_REGISTER, 1, 0);
+    memory->memory.size = size;
+    bool negative = false;
+    do {
+        token_t* token = peek(parser);
+        int reg = token->kind == TOKEN_IDENT ? find_register(parser, token->lexeme) : -1;
+        if (reg != -1) {
+            advance(parser, 1);
+            if (negative) {
+                error("Registers cannot be subtracted in a memory operand", ERROR_INVALID);
+            }
+            int64_t scale = 1;
+            if (match(parser, TOKEN_STAR)) {
+                scale = parse_const_unary(parser);
+                if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+                    error("Invalid scale in memory operand", ERROR_INVALID);
+                }
+            }
+            if (scale == 1 && memory->memory.base == NO_REGISTER) {
+                memory->memory.base = reg;
+            } else if (memory->memory.index == NO_REGISTER) {
+                memory->memory.index = reg;
+                memory->memory.scale = scale;
+            } else {
+                error("Too many registers in memory operand", ERROR_INVALID);
+            }
+        } else if (token->kind == TOKEN_IDENT && find_constant(parser, token->lexeme) == NULL) {
+            advance(parser, 1);
+            if (negative || memory->memory.label != NULL) {
+                error("Invalid label in memory operand", ERROR_INVALID);
+            }
+            memory->memory.label = token->lexeme;
+        } else {
+            int64_t value = parse_const_mul(parser);
+            memory->memory.displacement = (int64_t) (negative
+                    ? (uint64_t) memory->memory.displacement - (uint64_t) value
+                    : (uint64_t) memory->memory.displacement + (uint64_t) value);
+        }
+        negative = check(parser, TOKEN_MINUS);
+    } while (match(parser, TOKEN_PLUS) || match(parser, TOKEN_MINUS));
+    expect(parser, TOKEN_RBRACKET);
+    return memory;
+}
+
+expr_t* parse_expr(parser_t *parser) {
+    token_t* token = peek(parser);
+    if (is_const_start(parser)) {
+        return new_expr_immediate(parse_const_expr(parser));
+    }
+    if (check(parser, TOKEN_LBRACKET)) {
+        return parse_memory(parser, 0);
+    }
+    if (token->kind == TOKEN_IDENT && get_size_by_name(token->lexeme) != 0
+        && parser->index + 1 < parser->tokens->len && get_token(parser->tokens, parser->index + 1)->kind == TOKEN_LBRACKET) {
+        advance(parser, 1);
+        return parse_memory(parser, get_size_by_name(token->lexeme));
+    }
+    if (match(parser, TOKEN_IDENT)) {
+        int reg = find_register(parser, token->lexeme);
+        if (reg == -1 && parser->label != NULL && find_local(parser->label->locals, token->lexeme) != -1) {
+            error("A local is only named in a memory operand, as [name]", ERROR_INVALID);
+        }
+        if (reg == -1) {
+            return new_expr_label(token->lexeme);
+        }
+        return new_expr_register(reg);
     }
     if (match(parser, TOKEN_STRING)) {
         return new_expr_string(token->lexeme);
@@ -5,10 +5,20 @@
 
 typedef struct parser_t parser_t;
 
+typedef struct {
+    char* name;
+    int64_t value;
+} constant_t;
+
 struct parser_t {
     token_list_t* tokens;
     stmt_list_t* stmts;
     int index;
+    constant_t* constants;
+    int constants_len;
+    int constants_capacity;
+    // The label being parsed, whose vars are register operands.
+    label_t* label;
 };
 
 parser_t* new_parser(token_list_t* tokens);
@@ -22,8 +32,16 @@ bool match(parser_t* parser, token_kind_t kind);
 bool match_ident(parser_t* parser, const char* ident);
 void parse(parser_t* parser);
 type_t* parse_type(parser_t* parser);
+void parse_var(parser_t* parser);
+void parse_local(parser_t* parser);
 instr_t* parse_instr(parser_t *parser);
+instr_list_t* parse_block(parser_t *parser);
+cond_t* parse_cond(parser_t *parser);
 expr_t* parse_expr(parser_t *parser);
+expr_t* parse_memory(parser_t *parser, int size);
+int64_t parse_const_expr(parser_t *parser);
+void define_constant(parser_t* parser, char* name, int64_t value);
+constant_t* find_constant(parser_t* parser, char* name);
 attribute_list_t *parse_attribute_list(parser_t *parser);
 void free_parser(parser_t* parser);
 
@@ -0,0 +1,732 @@
+#include "profile.h"
+#include "analysis.h"
+#include "inliner.h"
+#include "error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COUNTS_LABEL "__asmpp_profile_counts"
+#define KEYS_LABEL "__asmpp_profile_keys"
+#define PATH_LABEL "__asmpp_profile_path"
+#define DUMP_LABEL "__asmpp_profile_dump"
+
+// FNV-1a of the label name, mixed with the block index. Only names and indices go in, so the keys of
+// a label survive edits elsewhere in the file.
+uint64_t profile_key(char *label, int block) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char *c = label; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char) *c) * 0x100000001b3ull;
+    }
+    return hash ^ ((uint64_t) block * 0x9e3779b97f4a7c15ull);
+}
+
+uint64_t profile_else_key(uint64_t then_key) {
+    return ~then_key;
+}
+
+profile_t *new_profile() {
+    profile_t *profile = malloc(sizeof(profile_t));
+    if (profile == NULL) {
+        error("Failed to allocate memory for profile", ERROR_ALLOC);
+    }
+    profile->len = 0;
+    profile->capacity = 16;
+    profile->keys = malloc(sizeof(uint64_t) * profile->capacity);
+    profile->counts = malloc(sizeof(uint64_t) * profile->capacity);
+    if (profile->keys == NULL || profile->counts == NULL) {
+        error("Failed to allocate memory for profile", ERROR_ALLOC);
+    }
+    return profile;
+}
+
+static int profile_find(profile_t *profile, uint64_t key) {
+    for (int i = 0; i < profile->len; i++) {
+        if (profile->keys[i] == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Counts of the same key add up, so that several runs can share a profile.
+void profile_add(profile_t *profile, uint64_t key, uint64_t count) {
+    int index = profile_find(profile, key);
+    if (index != -1) {
+        profile->counts[index] += count;
+        return;
+    }
+    if (profile->len >= profile->capacity) {
+        profile->capacity *= 2;
+        profile->keys = realloc(profile->keys, sizeof(uint64_t) * profile->capacity);
+        profile->counts = realloc(profile->counts, sizeof(uint64_t) * profile->capacity);
+        if (profile->keys == NULL || profile->counts == NULL) {
+            error("Failed to reallocate memory for profile", ERROR_ALLOC);
+        }
+    }
+    profile->keys[profile->len] = key;
+    profile->counts[profile->len] = count;
+    profile->len++;
+}
+
+bool profile_lookup(profile_t *profile, uint64_t key, uint64_t *count) {
+    int index = profile_find(profile, key);
+    if (index == -1) {
+        return false;
+    }
+    *count = profile->counts[index];
+    return true;
+}
+
+// Every run of an instrumented program appends a record: magic, n, n keys, n counts.
+profile_t *read_profile(char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        error("Failed to open profile", ERROR_INVALID);
+    }
+    profile_t *profile = new_profile();
+    uint64_t header[2];
+    while (fread(header, sizeof(uint64_t), 2, file) == 2) {
+        if (header[0] != PROFILE_MAGIC) {
+            error("Invalid profile", ERROR_INVALID);
+        }
+        uint64_t *record = malloc(sizeof(uint64_t) * 2 * header[1]);
+        if (record == NULL) {
+            error("Failed to allocate memory for profile", ERROR_ALLOC);
+        }
+        if (fread(record, sizeof(uint64_t), 2 * header[1], file) != 2 * header[1]) {
+            error("Truncated profile", ERROR_INVALID);
+        }
+        for (uint64_t i = 0; i < header[1]; i++) {
+            profile_add(profile, record[i], record[header[1] + i]);
+        }
+        free(record);
+    }
+    fclose(file);
+    return profile;
+}
+
+// Reads a line into buffer, dropping what does not fit. Returns false at the end of the file.
+static bool read_line(FILE *file, char *buffer, int size) {
+    if (fgets(buffer, size, file) == NULL) {
+        return false;
+    }
+    size_t len = strlen(buffer);
+    if (len > 0 && buffer[len - 1] == '\n') {
+        buffer[len - 1] = '\0';
+    } else {
+        int c;
+        while ((c = fgetc(file)) != EOF && c != '\n') {
+        }
+    }
+    return true;
+}
+
+static int split_tokens(char *line, char **tokens, int max) {
+    int len = 0;
+    for (char *token = strtok(line, " \t\r"); token != NULL && len < max; token = strtok(NULL, " \t\r")) {
+        tokens[len++] = token;
+    }
+    return len;
+}
+
+static bool parse_hex(char *token, uint64_t *value) {
+    char *end;
+    *value = strtoull(token, &end, 16);
+    return end != token && *end == '\0';
+}
+
+static bool is_decimal(char *token) {
+    for (char *c = token; *c != '\0'; c++) {
+        if (*c < '0' || *c > '9') {
+            return false;
+        }
+    }
+    return *token != '\0';
+}
+
+// A symbol of the map of a --profile-markers build. Samples between it and the next symbol belong to
+// its block, none when key is 0, and to the label it is in.
+typedef struct {
+    uint64_t address;
+    uint64_t key;
+    bool label;
+    bool marker;
+    int index;
+} profile_symbol_t;
+
+static int compare_profile_symbols(const void *a, const void *b) {
+    const profile_symbol_t *lhs = a;
+    const profile_symbol_t *rhs = b;
+    if (lhs->address != rhs->address) {
+        return lhs->address < rhs->address ? -1 : 1;
+    }
+    return lhs->index - rhs->index;
+}
+
+// Markers are named <label>.P<key in hex>_<n>, labels start their block 0. Other local labels of the
+// code are not block boundaries, every other symbol ends the block before it.
+static bool symbol_key(char type, char *name, profile_symbol_t *symbol) {
+    symbol->label = false;
+    symbol->marker = false;
+    char *marker = strstr(name, ".P");
+    if (marker != NULL && strlen(marker) > 19 && marker[18] == '_') {
+        char hex[17];
+        memcpy(hex, marker + 2, 16);
+        hex[16] = '\0';
+        if (parse_hex(hex, &symbol->key)) {
+            symbol->marker = true;
+            return true;
+        }
+    }
+    if (type != 't' && type != 'T') {
+        symbol->key = 0;
+        return true;
+    }
+    if (strchr(name, '.') != NULL) {
+        return false;
+    }
+    symbol->key = profile_key(name, 0);
+    symbol->label = true;
+    return true;
+}
+
+static profile_symbol_t *read_profile_map(char *path, int *len) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        error("Failed to open profile map", ERROR_INVALID);
+    }
+    int capacity = 64;
+    profile_symbol_t *symbols = malloc(sizeof(profile_symbol_t) * capacity);
+    if (symbols == NULL) {
+        error("Failed to allocate memory for profile map", ERROR_ALLOC);
+    }
+    *len = 0;
+    char line[1024];
+    while (read_line(file, line, sizeof(line))) {
+        char *tokens[3];
+        profile_symbol_t symbol;
+        // Undefined symbols have no address and only two columns.
+        if (split_tokens(line, tokens, 3) != 3 || strlen(tokens[1]) != 1 || !parse_hex(tokens[0], &symbol.address)
+            || !symbol_key(tokens[1][0], tokens[2], &symbol)) {
+            continue;
+        }
+        if (*len >= capacity) {
+            capacity *= 2;
+            symbols = realloc(symbols, sizeof(profile_symbol_t) * capacity);
+            if (symbols == NULL) {
+                error("Failed to reallocate memory for profile map", ERROR_ALLOC);
+            }
+        }
+        symbol.index = *len;
+        symbols[(*len)++] = symbol;
+    }
+    fclose(file);
+    qsort(symbols, *len, sizeof(profile_symbol_t), compare_profile_symbols);
+    return symbols;
+}
+
+// Takes `<address> <count>` lines as well as `perf script` output, where the address follows the event
+// name (`... cycles:u:  401136 main+0x6 ...`) or starts the line (`perf script -F ip,sym`).
+static bool parse_sample(char *line, uint64_t *address, uint64_t *count) {
+    char *tokens[32];
+    int len = split_tokens(line, tokens, 32);
+    if (len == 0 || tokens[0][0] == '#') {
+        return false;
+    }
+    if (len == 2 && is_decimal(tokens[1]) && parse_hex(tokens[0], address)) {
+        *count = strtoull(tokens[1], NULL, 10);
+        return true;
+    }
+    int start = 0;
+    for (int i = 0; i < len - 1; i++) {
+        if (tokens[i][strlen(tokens[i]) - 1] == ':') {
+            start = i + 1;
+        }
+    }
+    *count = 1;
+    return parse_hex(tokens[start], address);
+}
+
+// The samples of a block over its size in bytes: blocks run proportionally to their density, whatever
+// their size, as long as their instructions cost about the same. A label counts as a whole, so that it
+// has a density even when it starts with an if.
+profile_t *read_sample_profile(char *samples_path, char *map_path) {
+    int len;
+    profile_symbol_t *symbols = read_profile_map(map_path, &len);
+    uint64_t *samples = calloc(len + 1, sizeof(uint64_t));
+    if (samples == NULL) {
+        error("Failed to allocate memory for samples", ERROR_ALLOC);
+    }
+    FILE *file = fopen(samples_path, "r");
+    if (file == NULL) {
+        error("Failed to open samples", ERROR_INVALID);
+    }
+    char line[1024];
+    while (read_line(file, line, sizeof(line))) {
+        uint64_t address, count;
+        if (!parse_sample(line, &address, &count)) {
+            continue;
+        }
+        // The last symbol at or below the address; past the last symbol, the block has no known end.
+        int low = 0, high = len - 1, found = -1;
+        while (low <= high) {
+            int mid = (low + high) / 2;
+            if (symbols[mid].address <= address) {
+                found = mid;
+                low = mid + 1;
+            } else {
+                high = mid - 1;
+            }
+        }
+        if (found != -1 && found < len - 1) {
+            samples[found] += count;
+        }
+    }
+    fclose(file);
+
+    profile_t *counts = new_profile();
+    profile_t *sizes = new_profile();
+    uint64_t label = 0;
+    for (int i = 0; i < len - 1; i++) {
+        if (!symbols[i].marker) {
+            label = symbols[i].label ? symbols[i].key : 0;
+        }
+        uint64_t size = symbols[i + 1].address - symbols[i].address;
+        if (size == 0) {
+            continue;
+        }
+        if (symbols[i].key != 0) {
+            profile_add(counts, symbols[i].key, samples[i]);
+            profile_add(sizes, symbols[i].key, size);
+        }
+        if (label != 0 && symbols[i].key != label) {
+            profile_add(counts, label, samples[i]);
+            profile_add(sizes, label, size);
+        }
+    }
+    profile_t *profile = new_profile();
+    for (int i = 0; i < counts->len; i++) {
+        uint64_t size = sizes->counts[i];
+        profile_add(profile, counts->keys[i], (counts->counts[i] * 1024 + size - 1) / size);
+    }
+    free_profile(counts);
+    free_profile(sizes);
+    free(samples);
+    free(symbols);
+    return profile;
+}
+
+void free_profile(profile_t *profile) {
+    free(profile->keys);
+    free(profile->counts);
+    free(profile);
+}
+
+static void number_blocks(char *label, instr_list_t *list, int *next) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_IF:
+                instr->instr_if->profile_label = label;
+                instr->instr_if->profile_block = *next;
+                *next += 2;
+                number_blocks(label, instr->instr_if->then_instrs, next);
+                number_blocks(label, instr->instr_if->else_instrs, next);
+                break;
+            case INSTR_LOOP:
+                number_blocks(label, instr->instr_loop->body, next);
+                break;
+            case INSTR_SWITCH:
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    number_blocks(label, instr->instr_switch->bodies[j], next);
+                }
+                number_blocks(label, instr->instr_switch->default_instrs, next);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Done on the source, before any pass moves code around: ifs keep their numbers when they are inlined
+// elsewhere, so instrumented and optimized builds agree on the keys.
+void number_profile_blocks(stmt_list_t *stmts) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            int next = 1;
+            number_blocks(stmt->label->name, stmt->label->instrs, &next);
+        }
+    }
+}
+
+typedef struct {
+    label_t *label;
+    profile_t *slots;
+} instrument_t;
+
+static instr_t *new_asm(char *op, expr_t *dst, expr_t *src) {
+    expr_list_t *args = new_expr_list();
+    if (dst != NULL) {
+        append_expr(args, dst);
+    }
+    if (src != NULL) {
+        append_expr(args, src);
+    }
+    return new_asm_instr(new_instr_asm(op, args));
+}
+
+// Replaces remove instructions of list at index with instrs.
+static void splice_instrs(instr_list_t *list, int index, int remove, instr_list_t *instrs) {
+    instr_list_t *out = new_instr_list();
+    for (int i = 0; i < index; i++) {
+        append_instr(out, get_instr(list, i));
+    }
+    for (int i = 0; i < instrs->len; i++) {
+        append_instr(out, get_instr(instrs, i));
+    }
+    for (int i = index + remove; i < list->len; i++) {
+        append_instr(out, get_instr(list, i));
+    }
+    list->len = out->len;
+    list->capacity = out->capacity;
+    list->instrs = out->instrs;
+}
+
+// inc qword [counts + 8*slot]. When the flags are live, they are saved around it below the red zone.
+static instr_list_t *counter_instrs(int slot, bool keep_flags) {
+    instr_list_t *instrs = new_instr_list();
+    expr_t *counter = new_expr_memory(NO_REGISTER, NO_REGISTER, 1, 8 * (int64_t) slot);
+    counter->memory.label = COUNTS_LABEL;
+    counter->memory.size = 8;
+    if (keep_flags) {
+        append_instr(instrs, new_asm("lea", new_expr_register(RSP), new_expr_memory(RSP, NO_REGISTER, 1, -128)));
+        append_instr(instrs, new_asm("pushfq", NULL, NULL));
+    }
+    append_instr(instrs, new_asm("inc", counter, NULL));
+    if (keep_flags) {
+        append_instr(instrs, new_asm("popfq", NULL, NULL));
+        append_instr(instrs, new_asm("lea", new_expr_register(RSP), new_expr_memory(RSP, NO_REGISTER, 1, 128)));
+    }
+    return instrs;
+}
+
+// Returns the number of instructions inserted at index.
+static int insert_counter(instrument_t *ctx, instr_list_t *list, int index, uint64_t key) {
+    profile_add(ctx->slots, key, 0);
+    int slot = ctx->slots->len - 1;
+    for (int i = 0; i < ctx->slots->len; i++) {
+        if (ctx->slots->keys[i] == key) {
+            slot = i;
+        }
+    }
+    splice_instrs(list, index, 0, counter_instrs(slot, false));
+    if (live_after(ctx->label->instrs, get_instr(list, index), label_live_out(ctx->label)) & REGSET_FLAGS) {
+        instr_list_t *instrs = counter_instrs(slot, true);
+        splice_instrs(list, index, 1, instrs);
+        return instrs->len;
+    }
+    return 1;
+}
+
+static void instrument_list(instrument_t *ctx, instr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_IF: {
+                instr_if_t *instr_if = instr->instr_if;
+                instrument_list(ctx, instr_if->then_instrs);
+                instrument_list(ctx, instr_if->else_instrs);
+                if (instr_if->profile_label == NULL) {
+                    break;
+                }
+                insert_counter(ctx, instr_if->then_instrs, 0, profile_key(instr_if->profile_label, instr_if->profile_block + 1));
+                // The if itself moves down, the condition recomputes the flags anyway.
+                i += insert_counter(ctx, list, i, profile_key(instr_if->profile_label, instr_if->profile_block));
+                break;
+            }
+            case INSTR_LOOP:
+                instrument_list(ctx, instr->instr_loop->body);
+                break;
+            case INSTR_SWITCH:
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    instrument_list(ctx, instr->instr_switch->bodies[j]);
+                }
+                instrument_list(ctx, instr->instr_switch->default_instrs);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static expr_list_t *single_value(expr_t *value) {
+    expr_list_t *values = new_expr_list();
+    append_expr(values, value);
+    return values;
+}
+
+static void add_attribute(attribute_list_t *attributes, char *name) {
+    append_attribute(attributes, new_attribute(ATTR_FLAG, name, NULL));
+}
+
+// Appends the counter table and the dump label, run from .fini_array when linked with a libc, or called
+// by hand before exiting otherwise. Each run appends a record to the profile file:
+//
+//     fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)
+//     write(fd, keys, 8 * (n + 2)) / write(fd, counts, 8 * n) / close(fd)
+static void emit_profile_runtime(stmt_list_t *stmts, profile_t *slots, char *path) {
+    int n = slots->len;
+    data_t *counts = new_data_uninitialized(COUNTS_LABEL, new_array_type(new_simple_type(TYPE_QWORD), n > 0 ? n : 1));
+    append_stmt(stmts, new_data_stmt(counts));
+
+    expr_list_t *keys = new_expr_list();
+    append_expr(keys, new_expr_immediate((int64_t) PROFILE_MAGIC));
+    append_expr(keys, new_expr_immediate(n));
+    for (int i = 0; i < n; i++) {
+        append_expr(keys, new_expr_immediate((int64_t) slots->keys[i]));
+    }
+    data_t *keys_data = new_data(KEYS_LABEL, new_array_type(new_simple_type(TYPE_QWORD), n + 2), keys);
+    add_attribute(keys_data->attributes, "rodata");
+    append_stmt(stmts, new_data_stmt(keys_data));
+
+    expr_list_t *path_value = single_value(new_expr_string(path));
+    append_expr(path_value, new_expr_immediate(0));
+    data_t *path_data = new_data(PATH_LABEL, new_array_type(new_simple_type(TYPE_BYTE), (int) strlen(path) + 1), path_value);
+    add_attribute(path_data->attributes, "rodata");
+    append_stmt(stmts, new_data_stmt(path_data));
+
+    instr_list_t *write = new_instr_list();
+    append_instr(write, new_asm("mov", new_expr_register(RBX), new_expr_register(RAX)));
+    char *buffers[] = {KEYS_LABEL, COUNTS_LABEL};
+    int64_t sizes[] = {8 * (int64_t) (n + 2), 8 * (int64_t) n};
+    for (int i = 0; i < 2; i++) {
+        append_instr(write, new_asm("mov", new_expr_register(EAX), new_expr_immediate(1)));
+        append_instr(write, new_asm("mov", new_expr_register(RDI), new_expr_register(RBX)));
+        append_instr(write, new_asm("mov", new_expr_register(RSI), new_expr_label(buffers[i])));
+        append_instr(write, new_asm("mov", new_expr_register(EDX), new_expr_immediate(sizes[i])));
+        append_instr(write, new_asm("syscall", NULL, NULL));
+    }
+    append_instr(write, new_asm("mov", new_expr_register(EAX), new_expr_immediate(3)));
+    append_instr(write, new_asm("mov", new_expr_register(RDI), new_expr_register(RBX)));
+    append_instr(write, new_asm("syscall", NULL, NULL));
+
+    instr_list_t *dump = new_instr_list();
+    append_instr(dump, new_asm("push", new_expr_register(RBX), NULL));
+    append_instr(dump, new_asm("mov", new_expr_register(EAX), new_expr_immediate(2)));
+    append_instr(dump, new_asm("mov", new_expr_register(RDI), new_expr_label(PATH_LABEL)));
+    append_instr(dump, new_asm("mov", new_expr_register(ESI), new_expr_immediate(0x441)));
+    append_instr(dump, new_asm("mov", new_expr_register(EDX), new_expr_immediate(0644)));
+    append_instr(dump, new_asm("syscall", NULL, NULL));
+    expr_list_t *operands = new_expr_list();
+    append_expr(operands, new_expr_register(RAX));
+    append_expr(operands, new_expr_immediate(0));
+    append_instr(dump, new_if_instr(new_instr_if(new_cond_cmp(GE, operands), write, new_instr_list(), new_attribute_list())));
+    append_instr(dump, new_asm("pop", new_expr_register(RBX), NULL));
+    append_instr(dump, new_asm("ret", NULL, NULL));
+
+    attribute_list_t *attributes = new_attribute_list();
+    add_attribute(attributes, "global");
+    string_list_t *abi = new_string_list();
+    append_string(abi, "C");
+    append_attribute(attributes, new_attribute(ATTR_DIRECTIVE, "abi", abi));
+    label_t *label = new_label(DUMP_LABEL, new_call_abi("default", new_argument_list()), dump, attributes);
+    append_stmt(stmts, new_label_stmt(label));
+
+    data_t *fini = new_data("__asmpp_profile_fini", new_simple_type(TYPE_QWORD), single_value(new_expr_label(DUMP_LABEL)));
+    add_attribute(fini->attributes, "fini_array");
+    append_stmt(stmts, new_data_stmt(fini));
+}
+
+// Counts every label entry, every if and every then arm. The else arm is what the if ran minus the then arm.
+void instrument_profile(stmt_list_t *stmts, char *path) {
+    instrument_t ctx = {.label = NULL, .slots = new_profile()};
+    int len = stmts->len;
+    for (int i = 0; i < len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind != STMT_LABEL) {
+            continue;
+        }
+        ctx.label = stmt->label;
+        instrument_list(&ctx, stmt->label->instrs);
+        insert_counter(&ctx, stmt->label->instrs, 0, profile_key(stmt->label->name, 0));
+    }
+    emit_profile_runtime(stmts, ctx.slots, path);
+    free_profile(ctx.slots);
+}
+
+static bool has_layout_hint(instr_if_t *instr_if) {
+    char *hints[] = {"likely", "unlikely", "hot", "cold"};
+    for (int i = 0; i < 4; i++) {
+        if (has_attribute(instr_if->attributes, hints[i]) || has_attribute(instr_if->else_attributes, hints[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// An arm that never ran is cold, one taken at least 80% of the time is likely, at most 20% unlikely.
+// Instrumented profiles count the if and its then arm, sampled ones measure both arms.
+static void apply_if_profile(profile_t *profile, instr_if_t *instr_if, opt_stats_t *stats) {
+    if (instr_if->profile_label == NULL || has_layout_hint(instr_if)) {
+        return;
+    }
+    uint64_t then_key = profile_key(instr_if->profile_label, instr_if->profile_block + 1);
+    uint64_t entry, then, other;
+    if (!profile_lookup(profile, then_key, &then)) {
+        return;
+    }
+    if (profile_lookup(profile, profile_else_key(then_key), &other)) {
+        entry = then + other;
+    } else if (profile_lookup(profile, profile_key(instr_if->profile_label, instr_if->profile_block), &entry)) {
+        other = entry > then ? entry - then : 0;
+    } else {
+        return;
+    }
+    if (entry == 0) {
+        return;
+    }
+    if (then == 0 && instr_if->then_instrs->len > 0) {
+        add_attribute(instr_if->attributes, "cold");
+    } else if (other == 0 && instr_if->else_instrs->len > 0) {
+        add_attribute(instr_if->else_attributes, "cold");
+    } else if (then * 5 >= entry * 4) {
+        add_attribute(instr_if->attributes, "likely");
+    } else if (then * 5 <= entry) {
+        add_attribute(instr_if->attributes, "unlikely");
+    } else {
+        return;
+    }
+    stats->profile_hints++;
+}
+
+static void apply_list_profile(profile_t *profile, instr_list_t *list, opt_stats_t *stats) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_IF:
+                apply_if_profile(profile, instr->instr_if, stats);
+                apply_list_profile(profile, instr->instr_if->then_instrs, stats);
+                apply_list_profile(profile, instr->instr_if->else_instrs, stats);
+                break;
+            case INSTR_LOOP:
+                apply_list_profile(profile, instr->instr_loop->body, stats);
+                break;
+            case INSTR_SWITCH:
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    apply_list_profile(profile, instr->instr_switch->bodies[j], stats);
+                }
+                apply_list_profile(profile, instr->instr_switch->default_instrs, stats);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static uint64_t label_count(profile_t *profile, label_t *label) {
+    uint64_t count = 0;
+    profile_lookup(profile, profile_key(label->name, 0), &count);
+    return count;
+}
+
+static bool ends_with_terminator(stmt_t *stmt) {
+    if (stmt->kind == STMT_INSTR) {
+        return is_terminator(stmt->instr);
+    }
+    instr_list_t *instrs = stmt->label->instrs;
+    return instrs->len > 0 && is_terminator(get_instr(instrs, instrs->len - 1));
+}
+
+// Whether the label at index can go anywhere: nothing falls into it and it does not fall into the next one.
+static bool is_movable(stmt_list_t *stmts, int index) {
+    if (!ends_with_terminator(get_stmt(stmts, index))) {
+        return false;
+    }
+    for (int i = index - 1; i >= 0; i--) {
+        stmt_t *previous = get_stmt(stmts, i);
+        if (previous->kind == STMT_LABEL || previous->kind == STMT_INSTR) {
+            return ends_with_terminator(previous);
+        }
+    }
+    return true;
+}
+
+// Movable labels are laid out hottest first, in the slots such labels already occupy.
+static void order_labels(stmt_list_t *stmts, profile_t *profile) {
+    int *slots = malloc(sizeof(int) * (stmts->len + 1));
+    stmt_t *labels = malloc(sizeof(stmt_t) * (stmts->len + 1));
+    if (slots == NULL || labels == NULL) {
+        error("Failed to allocate memory for label ordering", ERROR_ALLOC);
+    }
+    int len = 0;
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && is_movable(stmts, i)) {
+            slots[len] = i;
+            labels[len++] = *stmt;
+        }
+    }
+    // Insertion sort keeps labels of equal counts in source order.
+    for (int i = 1; i < len; i++) {
+        stmt_t current = labels[i];
+        int j = i - 1;
+        while (j >= 0 && label_count(profile, labels[j].label) < label_count(profile, current.label)) {
+            labels[j + 1] = labels[j];
+            j--;
+        }
+        labels[j + 1] = current;
+    }
+    for (int i = 0; i < len; i++) {
+        stmts->stmts[slots[i]] = labels[i];
+    }
+    free(slots);
+    free(labels);
+}
+
+// Turns the counts into the attributes the passes and codegen already act on: [hot]/[cold] labels,
+// [inline]/[noinline] callees and likely/unlikely/cold if arms. Attributes written in the source win.
+// Only movable labels are made [hot] or [cold], the others have to stay next to their neighbours.
+void apply_profile(stmt_list_t *stmts, profile_t *profile, opt_stats_t *stats) {
+    uint64_t max = 0;
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && label_count(profile, stmt->label) > max) {
+            max = label_count(profile, stmt->label);
+        }
+    }
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind != STMT_LABEL) {
+            continue;
+        }
+        label_t *label = stmt->label;
+        apply_list_profile(profile, label->instrs, stats);
+        uint64_t count;
+        if (!profile_lookup(profile, profile_key(label->name, 0), &count)
+            || has_attribute(label->attributes, "hot") || has_attribute(label->attributes, "cold")) {
+            continue;
+        }
+        bool movable = is_movable(stmts, i);
+        if (count == 0) {
+            if (movable) {
+                add_attribute(label->attributes, "cold");
+            }
+            if (!has_attribute(label->attributes, "inline")) {
+                add_attribute(label->attributes, "noinline");
+            }
+            stats->profile_hints++;
+        } else if (count >= max / 10) {
+            if (movable) {
+                add_attribute(label->attributes, "hot");
+            }
+            // Hot callees are worth inlining past the usual size limit, within reason.
+            if (!has_attribute(label->attributes, "noinline") && count_instrs(label->instrs) <= 4 * INLINE_THRESHOLD) {
+                add_attribute(label->attributes, "inline");
+            }
+            stats->profile_hints++;
+        }
+    }
+    order_labels(stmts, profile);
+}
@@ -0,0 +1,35 @@
+#ifndef ASMPP_PROFILE_H
+#define ASMPP_PROFILE_H
+
+#include "ast.h"
+#include "optimize.h"
+
+// "ASMPPPRF" read as a little-endian qword, at the start of every record of a profile file.
+#define PROFILE_MAGIC 0x46525050504d5341ull
+#define PROFILE_DEFAULT_PATH "asmpp.profdata"
+
+// Execution counts keyed by profile_key. Block 0 of a label is its entry, each if takes two more
+// blocks in pre-order: its entry, then its then arm. Sampled profiles hold sample densities instead,
+// which compare the same way, and the else arms as well since the density of the entry of an if says
+// little.
+typedef struct {
+    int len;
+    int capacity;
+    uint64_t *keys;
+    uint64_t *counts;
+} profile_t;
+
+uint64_t profile_key(char *label, int block);
+uint64_t profile_else_key(uint64_t then_key);
+profile_t *new_profile();
+void profile_add(profile_t *profile, uint64_t key, uint64_t count);
+bool profile_lookup(profile_t *profile, uint64_t key, uint64_t *count);
+profile_t *read_profile(char *path);
+profile_t *read_sample_profile(char *samples_path, char *map_path);
+void free_profile(profile_t *profile);
+
+void number_profile_blocks(stmt_list_t *stmts);
+void instrument_profile(stmt_list_t *stmts, char *path);
+void apply_profile(stmt_list_t *stmts, profile_t *profile, opt_stats_t *stats);
+
+#endif //ASMPP_PROFILE_H
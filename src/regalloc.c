@@ -0,0 +1,480 @@
+#include "regalloc.h"
+#include "analysis.h"
+#include "lifetime.h"
+#include "summary.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// Where a virtual register is live, the registers it must not get, and where it ended up: reg, or its stack
+// slot when reg is NO_REGISTER.
+typedef struct {
+    int var;
+    int start;
+    int end;
+    bool used;
+    bool spillable;
+    bool start_written;
+    bool end_written;
+    regset_t forbidden;
+    register_kind_t reg;
+    char *slot;
+} ra_interval_t;
+
+typedef struct {
+    stmt_list_t *stmts;
+    label_t *label;
+    opt_stats_t *stats;
+    lifetime_scan_t *scan;
+    ra_interval_t *intervals;
+    regset_t pool;
+    // Registers kept out of the pool to reload spilled operands into, in order.
+    register_kind_t scratch[4];
+    int scratch_len;
+    int spilled;
+} regalloc_t;
+
+// Caller-saved registers first, so that labels keep the callee-saved ones for values live across calls.
+static const register_kind_t ra_order[] = {
+        RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11, RBX, R12, R13, R14, R15
+};
+
+#define RA_ORDER_LEN ((int) (sizeof(ra_order) / sizeof(ra_order[0])))
+
+static void ra_error(regalloc_t *ra, const char *message) {
+    char *error_message = malloc(strlen(message) + strlen(ra->label->name) + 16);
+    sprintf(error_message, "%s in label %s", message, ra->label->name);
+    error(error_message, ERROR_INVALID);
+}
+
+// Registers an instruction relies on without naming them. Calls, syscalls and returns only read what the
+// label put in place by name, and what they overwrite is handled as clobbers.
+static regset_t implicit_regs(instr_list_t *list) {
+    regset_t set = 0;
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_ASM: {
+                char *op = instr->instr_asm->name;
+                if (strcmp(op, "call") == 0 || strcmp(op, "syscall") == 0 || strcmp(op, "ret") == 0) {
+                    break;
+                }
+                // String instructions, cpuid, rdtsc and the like come with their implicit registers, and an
+                // unknown instruction with every register.
+                regset_t uses, defs;
+                instr_effects(instr, &uses, &defs);
+                set |= (uses | defs) & REGSET_GPR;
+                break;
+            }
+            case INSTR_CALL:
+                break;
+            case INSTR_IF:
+                set |= implicit_regs(instr->instr_if->then_instrs) | implicit_regs(instr->instr_if->else_instrs);
+                break;
+            case INSTR_LOOP:
+                set |= implicit_regs(instr->instr_loop->body);
+                break;
+            case INSTR_SWITCH:
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    set |= implicit_regs(instr->instr_switch->bodies[j]);
+                }
+                set |= implicit_regs(instr->instr_switch->default_instrs);
+                break;
+        }
+    }
+    return set;
+}
+
+// Virtual registers only get registers the label does not use by itself. Under the C ABI, callee-saved ones
+// given out are saved by layout_frames.
+static regset_t register_pool(label_t *label) {
+    regset_t reserved = instr_list_regs(label->instrs) | implicit_regs(label->instrs);
+    for (int i = 0; i < label->abi->args->len; i++) {
+        argument_t *arg = get_argument(label->abi->args, i);
+        if (arg->kind == ARGUMENT_REGISTER) {
+            reserved |= regset_of(arg->reg);
+        }
+    }
+    return REGSET_GPR & ~(regset_of(RSP) | regset_of(RBP)) & ~reserved;
+}
+
+static regset_t ra_instr_clobbers(regalloc_t *ra, instr_t *instr) {
+    return instr == NULL ? 0 : instr_clobbers(ra->stmts, instr);
+}
+
+static void ra_add_use(lifetime_scan_t *scan, register_kind_t reg, int pos, bool read, bool write, bool fixed) {
+    if (is_virtual_register(reg)) {
+        lifetime_add_use(scan, reg - VIRTUAL_REGISTER, pos, read, write, fixed);
+    }
+}
+
+static void ra_visit(lifetime_scan_t *scan, instr_t *instr, expr_t *expr, int pos, bool read, bool write, bool fixed) {
+    // Which instruction it is does not matter here, clobbers are taken from scan->instrs.
+    (void) instr;
+    if (expr->kind == REGISTER) {
+        ra_add_use(scan, expr->register_, pos, read, write, fixed);
+    } else if (expr->kind == MEMORY) {
+        ra_add_use(scan, expr->memory.base, pos, true, false, fixed);
+        ra_add_use(scan, expr->memory.index, pos, true, false, fixed);
+    }
+}
+
+static void ra_build_intervals(regalloc_t *ra) {
+    int len = ra->label->vars->len;
+    lifetime_t *lifetimes = build_lifetimes(ra->scan, len);
+    ra->intervals = calloc(len + 1, sizeof(ra_interval_t));
+    if (ra->intervals == NULL) {
+        error("Failed to allocate memory for register allocation", ERROR_ALLOC);
+    }
+    for (int i = 0; i < len; i++) {
+        lifetime_t *lifetime = &lifetimes[i];
+        ra->intervals[i] = (ra_interval_t) {
+                .var = i, .start = lifetime->start, .end = lifetime->end, .used = lifetime->used,
+                .spillable = !lifetime->fixed, .start_written = lifetime->start_written,
+                .end_written = lifetime->end_written
+        };
+        if (!lifetime->used) {
+            continue;
+        }
+        for (int pos = lifetime->start + 1; pos < lifetime->end; pos++) {
+            ra->intervals[i].forbidden |= ra_instr_clobbers(ra, ra->scan->instrs[pos]);
+        }
+    }
+    free(lifetimes);
+}
+
+static int compare_intervals(const void *a, const void *b) {
+    ra_interval_t *x = *(ra_interval_t **) a;
+    ra_interval_t *y = *(ra_interval_t **) b;
+    if (x->start != y->start) {
+        return x->start - y->start;
+    }
+    return x->var - y->var;
+}
+
+static register_kind_t first_in_order(regset_t set) {
+    for (int i = 0; i < RA_ORDER_LEN; i++) {
+        if (set & regset_of(ra_order[i])) {
+            return ra_order[i];
+        }
+    }
+    return NO_REGISTER;
+}
+
+static bool is_expired(ra_interval_t *active, ra_interval_t *interval) {
+    return active->end < interval->start
+           || (active->end == interval->start && !active->end_written && interval->start_written);
+}
+
+static void ra_spill(regalloc_t *ra, ra_interval_t *interval) {
+    interval->reg = NO_REGISTER;
+    ra->spilled++;
+}
+
+// Linear scan: intervals are taken by start, each gets a register free over its whole interval, or else the
+// interval ending last among the candidates goes to the stack.
+static void ra_linear_scan(regalloc_t *ra) {
+    int len = ra->label->vars->len;
+    ra_interval_t **order = malloc(sizeof(ra_interval_t *) * (len + 1));
+    ra_interval_t **active = malloc(sizeof(ra_interval_t *) * (len + 1));
+    if (order == NULL || active == NULL) {
+        error("Failed to allocate memory for register allocation", ERROR_ALLOC);
+    }
+    int order_len = 0;
+    for (int i = 0; i < len; i++) {
+        if (ra->intervals[i].used) {
+            order[order_len++] = &ra->intervals[i];
+        }
+    }
+    qsort(order, order_len, sizeof(ra_interval_t *), compare_intervals);
+
+    regset_t pool = ra->pool;
+    for (int i = 0; i < ra->scratch_len; i++) {
+        pool &= ~regset_of(ra->scratch[i]);
+    }
+    ra->spilled = 0;
+    int active_len = 0;
+    for (int i = 0; i < order_len; i++) {
+        ra_interval_t *interval = order[i];
+        int kept = 0;
+        regset_t taken = 0;
+        for (int j = 0; j < active_len; j++) {
+            if (!is_expired(active[j], interval)) {
+                active[kept++] = active[j];
+                taken |= regset_of(active[j]->reg);
+            }
+        }
+        active_len = kept;
+
+        regset_t allowed = pool & ~interval->forbidden;
+        if ((allowed & ~taken) != 0) {
+            interval->reg = first_in_order(allowed & ~taken);
+            active[active_len++] = interval;
+            continue;
+        }
+        int victim = -1;
+        for (int j = 0; j < active_len; j++) {
+            if (active[j]->spillable && (regset_of(active[j]->reg) & allowed) != 0
+                && (victim == -1 || active[j]->end > active[victim]->end)) {
+                victim = j;
+            }
+        }
+        if (interval->spillable && (victim == -1 || active[victim]->end <= interval->end)) {
+            ra_spill(ra, interval);
+            continue;
+        }
+        if (victim == -1) {
+            ra_error(ra, "Too many virtual registers live at once");
+        }
+        interval->reg = active[victim]->reg;
+        ra_spill(ra, active[victim]);
+        active[victim] = interval;
+    }
+    free(order);
+    free(active);
+}
+
+// The most spilled virtual registers a single instruction names, each needs a scratch register.
+static int ra_scratch_needed(regalloc_t *ra) {
+    lifetime_use_t *uses = ra->scan->uses;
+    int uses_len = ra->scan->uses_len;
+    int needed = 0;
+    for (int i = 0; i < uses_len;) {
+        int pos = uses[i].pos;
+        int count = 0;
+        for (int j = i; j < uses_len && uses[j].pos == pos; j++) {
+            bool seen = false;
+            for (int k = i; k < j && !seen; k++) {
+                seen = uses[k].id == uses[j].id;
+            }
+            if (!seen && ra->intervals[uses[j].id].reg == NO_REGISTER) {
+                count++;
+            }
+        }
+        needed = count > needed ? count : needed;
+        while (i < uses_len && uses[i].pos == pos) {
+            i++;
+        }
+    }
+    return needed;
+}
+
+// Spilled operands are reloaded into scratch registers kept out of the allocation. Reserving them may spill
+// more, so this goes on until the reserved ones are enough.
+static void ra_allocate(regalloc_t *ra) {
+    for (;;) {
+        ra_linear_scan(ra);
+        int needed = ra_scratch_needed(ra);
+        if (needed <= ra->scratch_len) {
+            return;
+        }
+        ra->scratch_len = 0;
+        for (int i = RA_ORDER_LEN - 1; i >= 0 && ra->scratch_len < needed; i--) {
+            if (ra->pool & regset_of(ra_order[i])) {
+                ra->scratch[ra->scratch_len++] = ra_order[i];
+            }
+        }
+        if (ra->scratch_len < needed) {
+            ra_error(ra, "No register left to reload spilled virtual registers");
+        }
+    }
+}
+
+static register_kind_t ra_physical(regalloc_t *ra, register_kind_t reg, int width) {
+    ra_interval_t *interval = &ra->intervals[reg - VIRTUAL_REGISTER];
+    if (interval->reg == NO_REGISTER) {
+        ra_error(ra, "Spilled virtual register in a condition, loop or switch");
+    }
+    return register_with_width(interval->reg, width);
+}
+
+static void ra_rename_expr(regalloc_t *ra, expr_t *expr) {
+    if (expr->kind == REGISTER && is_virtual_register(expr->register_)) {
+        int width = get_var(ra->label->vars, expr->register_ - VIRTUAL_REGISTER)->width;
+        expr->register_ = ra_physical(ra, expr->register_, width);
+    } else if (expr->kind == MEMORY) {
+        if (is_virtual_register(expr->memory.base)) {
+            expr->memory.base = ra_physical(ra, expr->memory.base, 64);
+        }
+        if (is_virtual_register(expr->memory.index)) {
+            expr->memory.index = ra_physical(ra, expr->memory.index, 64);
+        }
+    }
+}
+
+static void ra_rename_list(regalloc_t *ra, expr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        ra_rename_expr(ra, get_expr(list, i));
+    }
+}
+
+static void ra_rename_cond(regalloc_t *ra, cond_t *cond) {
+    if (cond->kind == COND_CMP) {
+        ra_rename_list(ra, cond->operands);
+        return;
+    }
+    ra_rename_cond(ra, cond->lhs);
+    if (cond->rhs != NULL) {
+        ra_rename_cond(ra, cond->rhs);
+    }
+}
+
+// Spilled virtual registers live in a stack local of their own, named after them. The lexer does not take
+// dots in names, so it cannot clash with one of the label.
+static char *ra_slot(regalloc_t *ra, ra_interval_t *interval) {
+    if (interval->slot == NULL) {
+        char *name = get_var(ra->label->vars, interval->var)->name;
+        interval->slot = malloc(strlen(name) + 7);
+        if (interval->slot == NULL) {
+            error("Failed to allocate memory for register allocation", ERROR_ALLOC);
+        }
+        sprintf(interval->slot, "%s.spill", name);
+        append_local(ra->label->locals, new_local(interval->slot, REGALLOC_SLOT_SIZE, REGALLOC_SLOT_SIZE));
+    }
+    return interval->slot;
+}
+
+static instr_t *ra_slot_move(regalloc_t *ra, ra_interval_t *interval, register_kind_t scratch, bool load) {
+    int width = get_var(ra->label->vars, interval->var)->width;
+    expr_t *slot = new_expr_memory(NO_REGISTER, NO_REGISTER, 1, 0);
+    slot->memory.label = ra_slot(ra, interval);
+    slot->memory.size = width / 8;
+    expr_t *reg = new_expr_register(register_with_width(scratch, width));
+    expr_list_t *args = new_expr_list();
+    append_expr(args, load ? reg : slot);
+    append_expr(args, load ? slot : reg);
+    ra->stats->spill_moves++;
+    return new_asm_instr(new_instr_asm("mov", args));
+}
+
+// Instructions and calls: spilled operands are loaded into scratch registers before, and written ones stored
+// back after.
+static void ra_rewrite_simple(regalloc_t *ra, instr_t *instr, instr_list_t *out) {
+    expr_list_t *args = instr->kind == INSTR_ASM ? instr->instr_asm->args : instr->instr_call->args;
+    ra_interval_t *spilled[4];
+    bool loaded[4];
+    bool stored[4];
+    int spilled_len = 0;
+    for (int i = 0; i < args->len; i++) {
+        expr_t *expr = get_expr(args, i);
+        register_kind_t regs[] = {NO_REGISTER, NO_REGISTER};
+        bool read = true, write = false;
+        if (expr->kind == REGISTER) {
+            regs[0] = expr->register_;
+            if (instr->kind == INSTR_ASM) {
+                operand_access(instr->instr_asm, i, &read, &write);
+            }
+        } else if (expr->kind == MEMORY) {
+            regs[0] = expr->memory.base;
+            regs[1] = expr->memory.index;
+        }
+        for (int j = 0; j < 2; j++) {
+            if (!is_virtual_register(regs[j]) || ra->intervals[regs[j] - VIRTUAL_REGISTER].reg != NO_REGISTER) {
+                continue;
+            }
+            ra_interval_t *interval = &ra->intervals[regs[j] - VIRTUAL_REGISTER];
+            int k = 0;
+            while (k < spilled_len && spilled[k] != interval) {
+                k++;
+            }
+            if (k == spilled_len) {
+                spilled[spilled_len] = interval;
+                loaded[spilled_len] = false;
+                stored[spilled_len++] = false;
+            }
+            loaded[k] |= read;
+            stored[k] |= write;
+        }
+    }
+    for (int k = 0; k < spilled_len; k++) {
+        if (loaded[k]) {
+            append_instr(out, ra_slot_move(ra, spilled[k], ra->scratch[k], true));
+        }
+    }
+    for (int k = 0; k < spilled_len; k++) {
+        spilled[k]->reg = ra->scratch[k];
+    }
+    ra_rename_list(ra, args);
+    append_instr(out, instr);
+    for (int k = 0; k < spilled_len; k++) {
+        if (stored[k]) {
+            append_instr(out, ra_slot_move(ra, spilled[k], ra->scratch[k], false));
+        }
+        spilled[k]->reg = NO_REGISTER;
+    }
+}
+
+static void ra_rewrite_list(regalloc_t *ra, instr_list_t *list);
+
+static void ra_rewrite_instr(regalloc_t *ra, instr_t *instr, instr_list_t *out) {
+    switch (instr->kind) {
+        case INSTR_ASM:
+        case INSTR_CALL:
+            ra_rewrite_simple(ra, instr, out);
+            return;
+        case INSTR_IF:
+            ra_rename_cond(ra, instr->instr_if->cond);
+            ra_rewrite_list(ra, instr->instr_if->then_instrs);
+            ra_rewrite_list(ra, instr->instr_if->else_instrs);
+            break;
+        case INSTR_LOOP: {
+            instr_loop_t *loop = instr->instr_loop;
+            if (loop->kind == LOOP_WHILE) {
+                ra_rename_cond(ra, loop->cond);
+            } else {
+                ra_rename_expr(ra, loop->counter);
+                if (loop->count != loop->counter) {
+                    ra_rename_expr(ra, loop->count);
+                }
+            }
+            ra_rewrite_list(ra, loop->body);
+            break;
+        }
+        case INSTR_SWITCH: {
+            instr_switch_t *instr_switch = instr->instr_switch;
+            ra_rename_expr(ra, instr_switch->value);
+            for (int i = 0; i < instr_switch->len; i++) {
+                ra_rewrite_list(ra, instr_switch->bodies[i]);
+            }
+            ra_rewrite_list(ra, instr_switch->default_instrs);
+            break;
+        }
+    }
+    append_instr(out, instr);
+}
+
+static void ra_rewrite_list(regalloc_t *ra, instr_list_t *list) {
+    instr_list_t *out = new_instr_list();
+    for (int i = 0; i < list->len; i++) {
+        ra_rewrite_instr(ra, get_instr(list, i), out);
+    }
+    list->len = out->len;
+    list->capacity = out->capacity;
+    list->instrs = out->instrs;
+}
+
+// Spill slots are stack locals, layout_frames places them with the others.
+static void allocate_label(stmt_list_t *stmts, label_t *label, opt_stats_t *stats) {
+    regalloc_t ra = {.stmts = stmts, .label = label, .stats = stats, .pool = register_pool(label)};
+    ra.scan = new_lifetime_scan(ra_visit, &ra);
+    scan_lifetimes(ra.scan, label->instrs);
+    ra_build_intervals(&ra);
+    ra_allocate(&ra);
+    stats->regs_spilled += ra.spilled;
+    ra_rewrite_list(&ra, label->instrs);
+    free_lifetime_scan(ra.scan);
+    free(ra.intervals);
+}
+
+// Runs before every other pass, which then only see physical registers.
+static void allocate_visit(stmt_list_t *stmts, label_t *label, void *data) {
+    if (label->vars->len > 0) {
+        allocate_label(stmts, label, data);
+    }
+}
+
+// Callees go first, so a value live across a call only avoids the registers the callee really overwrites.
+void allocate_registers(stmt_list_t *stmts, opt_stats_t *stats) {
+    summarize_bottom_up(stmts, allocate_visit, stats);
+}
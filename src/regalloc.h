@@ -0,0 +1,12 @@
+#ifndef ASMPP_REGALLOC_H
+#define ASMPP_REGALLOC_H
+
+#include "ast.h"
+#include "optimize.h"
+
+// Every spilled virtual register gets a stack slot of this many bytes, whatever its width.
+#define REGALLOC_SLOT_SIZE 8
+
+void allocate_registers(stmt_list_t *stmts, opt_stats_t *stats);
+
+#endif //ASMPP_REGALLOC_H
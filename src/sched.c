@@ -0,0 +1,239 @@
+#include "sched.h"
+#include "analysis.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    stmt_list_t *stmts;
+    label_t *label;
+    target_t *target;
+    opt_stats_t *stats;
+} sched_t;
+
+typedef struct {
+    instr_t instr;
+    regset_t uses;
+    regset_t defs;
+    int latency;
+    bool load;
+    // The flags it writes are overwritten before anything reads them.
+    bool dead_flags;
+    int priority;
+    int preds;
+    int ready_at;
+    bool scheduled;
+} sched_node_t;
+
+static bool is_op(char *op, const char **ops, int len) {
+    for (int i = 0; i < len; i++) {
+        if (strcmp(op, ops[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Control flow, volatile accesses and instructions whose effects are unknown stay where they are, and
+// nothing moves across them.
+static bool is_barrier(sched_t *sched, instr_t *instr) {
+    static const char *ops[] = {"call", "ret", "syscall", "jmp", "leave"};
+    if (instr->kind != INSTR_ASM) {
+        return true;
+    }
+    char *op = instr->instr_asm->name;
+    return !is_known_instr(instr->instr_asm) || is_op(op, ops, sizeof(ops) / sizeof(ops[0]))
+           || (op[0] == 'j' && is_flags_reader(op)) || is_volatile_access(sched->stmts, instr);
+}
+
+static int op_latency(target_t *target, char *op) {
+    static const char *mul[] = {"imul", "mul"};
+    static const char *div[] = {"div", "idiv"};
+    static const char *bitcount[] = {"popcnt", "lzcnt", "tzcnt", "bsf", "bsr"};
+    if (is_op(op, mul, 2)) {
+        return target->mul_latency;
+    }
+    if (is_op(op, div, 2)) {
+        return target->div_latency;
+    }
+    if (is_op(op, bitcount, 5)) {
+        return target->bitcount_latency;
+    }
+    return 1;
+}
+
+// Latency of the dependency of to on from, -1 when to may go first. Writes after reads and writes after
+// writes only keep their order. The flags written by two instructions need no order when neither is read.
+static int dependency(sched_t *sched, sched_node_t *from, sched_node_t *to) {
+    int latency = -1;
+    regset_t raw = from->defs & to->uses;
+    if (raw & (REGSET_GPR | REGSET_FLAGS)) {
+        latency = from->latency;
+    }
+    if ((raw & REGSET_MEMORY) && sched->target->load_latency > latency) {
+        latency = sched->target->load_latency;
+    }
+    regset_t waw = from->defs & to->defs;
+    if (from->dead_flags && to->dead_flags) {
+        waw &= ~REGSET_FLAGS;
+    }
+    if (latency == -1 && ((from->uses & to->defs) || waw)) {
+        latency = 0;
+    }
+    return latency;
+}
+
+// List scheduling: every cycle, issue the ready instructions on the longest latency path to the end of the
+// block first, up to the issue width and the load ports of the target. Ties keep the written order.
+static bool schedule_window(sched_t *sched, sched_node_t *nodes, int n, int *order) {
+    int *latencies = malloc(sizeof(int) * n * n);
+    if (latencies == NULL) {
+        error("Failed to allocate memory for instruction scheduling", ERROR_ALLOC);
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            latencies[i * n + j] = j > i ? dependency(sched, &nodes[i], &nodes[j]) : -1;
+            if (latencies[i * n + j] != -1) {
+                nodes[j].preds++;
+            }
+        }
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        nodes[i].priority = nodes[i].latency;
+        for (int j = i + 1; j < n; j++) {
+            int latency = latencies[i * n + j];
+            if (latency != -1 && latency + nodes[j].priority > nodes[i].priority) {
+                nodes[i].priority = latency + nodes[j].priority;
+            }
+        }
+    }
+
+    int len = 0;
+    for (int cycle = 0; len < n; cycle++) {
+        int issued = 0, loads = 0;
+        while (issued < sched->target->issue_width) {
+            int best = -1;
+            for (int i = 0; i < n; i++) {
+                sched_node_t *node = &nodes[i];
+                if (node->scheduled || node->preds > 0 || node->ready_at > cycle
+                    || (node->load && loads >= sched->target->load_ports)) {
+                    continue;
+                }
+                if (best == -1 || node->priority > nodes[best].priority) {
+                    best = i;
+                }
+            }
+            if (best == -1) {
+                break;
+            }
+            nodes[best].scheduled = true;
+            order[len++] = best;
+            issued++;
+            loads += nodes[best].load;
+            for (int j = 0; j < n; j++) {
+                int latency = latencies[best * n + j];
+                if (latency != -1) {
+                    nodes[j].preds--;
+                    if (cycle + latency > nodes[j].ready_at) {
+                        nodes[j].ready_at = cycle + latency;
+                    }
+                }
+            }
+        }
+    }
+    free(latencies);
+
+    bool changed = false;
+    for (int i = 0; i < n; i++) {
+        if (order[i] != i) {
+            changed = true;
+            sched->stats->instrs_scheduled++;
+        }
+    }
+    return changed;
+}
+
+// Schedules list[start, end), a run of instructions without barriers.
+static void schedule_block(sched_t *sched, instr_list_t *list, int start, int end) {
+    if (end - start < 2) {
+        return;
+    }
+    regset_t live = live_after(sched->label->instrs, get_instr(list, end - 1), label_live_out(sched->label));
+    sched_node_t *nodes = malloc(sizeof(sched_node_t) * (end - start));
+    int *order = malloc(sizeof(int) * (end - start));
+    if (nodes == NULL || order == NULL) {
+        error("Failed to allocate memory for instruction scheduling", ERROR_ALLOC);
+    }
+    bool flags_live = (live & REGSET_FLAGS) != 0;
+    for (int i = end - 1; i >= start; i--) {
+        sched_node_t *node = &nodes[i - start];
+        memset(node, 0, sizeof(sched_node_t));
+        node->instr = *get_instr(list, i);
+        instr_effects(&node->instr, &node->uses, &node->defs);
+        node->load = (node->uses & REGSET_MEMORY) != 0;
+        node->latency = op_latency(sched->target, node->instr.instr_asm->name)
+                        + (node->load ? sched->target->load_latency : 0);
+        node->dead_flags = (node->defs & REGSET_FLAGS) && !flags_live;
+        if (node->defs & REGSET_FLAGS) {
+            flags_live = false;
+        }
+        if (node->uses & REGSET_FLAGS) {
+            flags_live = true;
+        }
+    }
+    for (int window = start; window < end; window += SCHED_WINDOW) {
+        int n = end - window < SCHED_WINDOW ? end - window : SCHED_WINDOW;
+        if (n > 1 && schedule_window(sched, nodes + (window - start), n, order)) {
+            for (int i = 0; i < n; i++) {
+                list->instrs[window + i] = nodes[window - start + order[i]].instr;
+            }
+        }
+    }
+    free(nodes);
+    free(order);
+}
+
+static void schedule_list(sched_t *sched, instr_list_t *list) {
+    int start = 0;
+    for (int i = 0; i <= list->len; i++) {
+        instr_t *instr = i < list->len ? get_instr(list, i) : NULL;
+        if (instr != NULL && !is_barrier(sched, instr)) {
+            continue;
+        }
+        schedule_block(sched, list, start, i);
+        start = i + 1;
+        if (instr == NULL) {
+            continue;
+        }
+        switch (instr->kind) {
+            case INSTR_IF:
+                schedule_list(sched, instr->instr_if->then_instrs);
+                schedule_list(sched, instr->instr_if->else_instrs);
+                break;
+            case INSTR_LOOP:
+                schedule_list(sched, instr->instr_loop->body);
+                break;
+            case INSTR_SWITCH:
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    schedule_list(sched, instr->instr_switch->bodies[j]);
+                }
+                schedule_list(sched, instr->instr_switch->default_instrs);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Reorders the instructions of each basic block so that long latency ones, loads first, start early and
+// independent work fills their shadow. Blocks end at labels, calls, branches and volatile accesses.
+void schedule_instructions(stmt_list_t *stmts, target_t *target, opt_stats_t *stats) {
+    sched_t sched = {.stmts = stmts, .label = NULL, .target = target, .stats = stats};
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            sched.label = stmt->label;
+            schedule_list(&sched, stmt->label->instrs);
+        }
+    }
+}
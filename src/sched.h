@@ -0,0 +1,13 @@
+#ifndef ASMPP_SCHED_H
+#define ASMPP_SCHED_H
+
+#include "ast.h"
+#include "optimize.h"
+#include "target.h"
+
+// Longer blocks are scheduled a window at a time.
+#define SCHED_WINDOW 64
+
+void schedule_instructions(stmt_list_t *stmts, target_t *target, opt_stats_t *stats);
+
+#endif //ASMPP_SCHED_H
@@ -0,0 +1,294 @@
+#include "summary.h"
+#include "analysis.h"
+#include "error.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// Tarjan's walk over the call graph, which closes each cycle of labels calling each other after all
+// the labels they call.
+typedef struct {
+    stmt_list_t *stmts;
+    summary_visit_t visit;
+    void *data;
+    int *order;
+    int *low;
+    int *stack;
+    int stack_len;
+    bool *on_stack;
+    int next_order;
+} summary_walk_t;
+
+static int find_label_index(stmt_list_t *stmts, char *name) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && strcmp(stmt->label->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool is_jump(instr_asm_t *instr) {
+    return instr->name[0] == 'j';
+}
+
+// The label a call or a jump goes to, NULL when it has none or goes through a register or memory.
+static char *transfer_target(instr_t *instr) {
+    if (instr->kind == INSTR_CALL) {
+        return instr->instr_call->callee;
+    }
+    if (instr->kind != INSTR_ASM || instr->instr_asm->args->len != 1) {
+        return NULL;
+    }
+    if (!is_jump(instr->instr_asm) && strcmp(instr->instr_asm->name, "call") != 0) {
+        return NULL;
+    }
+    expr_t *target = get_expr(instr->instr_asm->args, 0);
+    return target->kind == LABEL ? target->label : NULL;
+}
+
+// A jump to another label runs it in our place, so whatever it overwrites, a call to us does too.
+static regset_t jump_clobbers(stmt_list_t *stmts, label_t *label, instr_list_t *list) {
+    regset_t set = 0;
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_ASM: {
+                if (!is_jump(instr->instr_asm)) {
+                    break;
+                }
+                char *target = transfer_target(instr);
+                if (target == NULL) {
+                    set |= REGSET_GPR & ~regset_of(RSP);
+                } else if (strcmp(target, label->name) != 0) {
+                    set |= call_clobbers(stmts, target);
+                }
+                break;
+            }
+            case INSTR_CALL:
+                break;
+            case INSTR_IF:
+                set |= jump_clobbers(stmts, label, instr->instr_if->then_instrs)
+                       | jump_clobbers(stmts, label, instr->instr_if->else_instrs);
+                break;
+            case INSTR_LOOP:
+                set |= jump_clobbers(stmts, label, instr->instr_loop->body);
+                break;
+            case INSTR_SWITCH:
+                set |= jump_clobbers(stmts, label, instr->instr_switch->default_instrs);
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    set |= jump_clobbers(stmts, label, instr->instr_switch->bodies[j]);
+                }
+                break;
+        }
+    }
+    return set;
+}
+
+// A label that does not end in a ret or a jump runs on into whatever is emitted after it.
+static bool falls_through(instr_list_t *list) {
+    if (list->len == 0) {
+        return true;
+    }
+    instr_t *last = get_instr(list, list->len - 1);
+    if (last->kind == INSTR_CALL) {
+        return !last->instr_call->tail;
+    }
+    if (last->kind != INSTR_ASM) {
+        return true;
+    }
+    char *name = last->instr_asm->name;
+    return strcmp(name, "ret") != 0 && strcmp(name, "jmp") != 0 && strcmp(name, "ud2") != 0;
+}
+
+// The label after index, -1 if the code that follows is not a label's.
+static int next_label_index(stmt_list_t *stmts, int index) {
+    for (int i = index + 1; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL) {
+            return i;
+        }
+        if (stmt->kind == STMT_INSTR) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+// Registers a call to the label at index overwrites: what its body writes, what its calls and jumps overwrite
+// and what a call loads its arguments into. A C ABI label restores the callee-saved ones it uses.
+static regset_t label_summary(stmt_list_t *stmts, int index) {
+    label_t *label = get_stmt(stmts, index)->label;
+    regset_t set = instr_list_writes(stmts, label->instrs) | jump_clobbers(stmts, label, label->instrs);
+    if (falls_through(label->instrs)) {
+        int next = next_label_index(stmts, index);
+        set |= next == -1 ? REGSET_GPR : call_clobbers(stmts, get_stmt(stmts, next)->label->name);
+    }
+    set &= REGSET_GPR & ~regset_of(RSP);
+    return has_c_abi(label->attributes) ? set & sysv_caller_saved() : set;
+}
+
+// Summarizes labels[0..len - 1] together: from empty summaries, grown until nothing changes, so labels that
+// call each other only overwrite the registers they really do, not all of them.
+static void summarize_together(stmt_list_t *stmts, int *labels, int len) {
+    for (int i = 0; i < len; i++) {
+        label_t *label = get_stmt(stmts, labels[i])->label;
+        label->clobbers = 0;
+        label->summarized = true;
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < len; i++) {
+            label_t *label = get_stmt(stmts, labels[i])->label;
+            regset_t clobbers = label_summary(stmts, labels[i]);
+            if (clobbers != label->clobbers) {
+                label->clobbers = clobbers;
+                changed = true;
+            }
+        }
+    }
+}
+
+static void walk_label(summary_walk_t *walk, int index);
+
+static void walk_edge(summary_walk_t *walk, int from, int to) {
+    if (walk->order[to] == 0) {
+        walk_label(walk, to);
+        walk->low[from] = walk->low[to] < walk->low[from] ? walk->low[to] : walk->low[from];
+    } else if (walk->on_stack[to]) {
+        walk->low[from] = walk->order[to] < walk->low[from] ? walk->order[to] : walk->low[from];
+    }
+}
+
+static void walk_callees(summary_walk_t *walk, int from, instr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        char *target = transfer_target(instr);
+        if (target != NULL) {
+            int index = find_label_index(walk->stmts, target);
+            if (index != -1) {
+                walk_edge(walk, from, index);
+            }
+        }
+        switch (instr->kind) {
+            case INSTR_IF:
+                walk_callees(walk, from, instr->instr_if->then_instrs);
+                walk_callees(walk, from, instr->instr_if->else_instrs);
+                break;
+            case INSTR_LOOP:
+                walk_callees(walk, from, instr->instr_loop->body);
+                break;
+            case INSTR_SWITCH:
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    walk_callees(walk, from, instr->instr_switch->bodies[j]);
+                }
+                walk_callees(walk, from, instr->instr_switch->default_instrs);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void walk_label(summary_walk_t *walk, int index) {
+    walk->order[index] = walk->low[index] = ++walk->next_order;
+    walk->stack[walk->stack_len++] = index;
+    walk->on_stack[index] = true;
+    label_t *label = get_stmt(walk->stmts, index)->label;
+    walk_callees(walk, index, label->instrs);
+    int next = next_label_index(walk->stmts, index);
+    if (falls_through(label->instrs) && next != -1) {
+        walk_edge(walk, index, next);
+    }
+    if (walk->low[index] != walk->order[index]) {
+        return;
+    }
+    // index heads a cycle, made of the labels above it on the stack.
+    int start = walk->stack_len;
+    do {
+        start--;
+        walk->on_stack[walk->stack[start]] = false;
+    } while (walk->stack[start] != index);
+    if (walk->visit != NULL) {
+        for (int i = walk->stack_len - 1; i >= start; i--) {
+            walk->visit(walk->stmts, get_stmt(walk->stmts, walk->stack[i])->label, walk->data);
+        }
+    }
+    summarize_together(walk->stmts, &walk->stack[start], walk->stack_len - start);
+    walk->stack_len = start;
+}
+
+// Visits every label after the labels it calls, and summarizes it once visited, so that visit sees the
+// summaries of its callees. Labels calling each other are visited before any of them is summarized, and see
+// each other with the clobbers of their ABI.
+void summarize_bottom_up(stmt_list_t *stmts, summary_visit_t visit, void *data) {
+    summary_walk_t walk = {.stmts = stmts, .visit = visit, .data = data};
+    walk.order = calloc(stmts->len + 1, sizeof(int));
+    walk.low = calloc(stmts->len + 1, sizeof(int));
+    walk.stack = calloc(stmts->len + 1, sizeof(int));
+    walk.on_stack = calloc(stmts->len + 1, sizeof(bool));
+    if (walk.order == NULL || walk.low == NULL || walk.stack == NULL || walk.on_stack == NULL) {
+        error("Failed to allocate memory for summaries", ERROR_ALLOC);
+    }
+    for (int i = 0; i < stmts->len; i++) {
+        if (get_stmt(stmts, i)->kind == STMT_LABEL && walk.order[i] == 0) {
+            walk_label(&walk, i);
+        }
+    }
+    free(walk.order);
+    free(walk.low);
+    free(walk.stack);
+    free(walk.on_stack);
+}
+
+// Recomputes every summary from the current bodies, once later passes have changed them.
+void summarize_labels(stmt_list_t *stmts) {
+    int *labels = calloc(stmts->len + 1, sizeof(int));
+    if (labels == NULL) {
+        error("Failed to allocate memory for summaries", ERROR_ALLOC);
+    }
+    int len = 0;
+    for (int i = 0; i < stmts->len; i++) {
+        if (get_stmt(stmts, i)->kind == STMT_LABEL) {
+            labels[len++] = i;
+        }
+    }
+    summarize_together(stmts, labels, len);
+    free(labels);
+}
+
+// One extern declaration per global label, to put in the modules that call them:
+//
+//     extern sum(rdi, rsi) [clobbers("rax", "rsi")]
+void write_clobber_summary(stmt_list_t *stmts, char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        error("Failed to open clobber summary", ERROR_INVALID);
+    }
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind != STMT_LABEL || !stmt->label->summarized || !has_attribute(stmt->label->attributes, "global")) {
+            continue;
+        }
+        label_t *label = stmt->label;
+        fprintf(file, "extern %s", label->name);
+        int params = 0;
+        for (int j = 0; j < label->abi->args->len; j++) {
+            argument_t *arg = get_argument(label->abi->args, j);
+            if (arg->kind == ARGUMENT_REGISTER) {
+                fprintf(file, "%s%s", params++ == 0 ? "(" : ", ", register_kind_to_string(arg->reg));
+            }
+        }
+        fprintf(file, "%s [%sclobbers(", params > 0 ? ")" : "", has_c_abi(label->attributes) ? "abi(\"C\"), " : "");
+        int count = 0;
+        for (int reg = RAX; reg <= R15; reg++) {
+            if (label->clobbers & regset_of(reg)) {
+                fprintf(file, "%s\"%s\"", count++ == 0 ? "" : ", ", register_kind_to_string(reg));
+            }
+        }
+        fprintf(file, ")]\n");
+    }
+    fclose(file);
+}
@@ -0,0 +1,15 @@
+#ifndef ASMPP_SUMMARY_H
+#define ASMPP_SUMMARY_H
+
+#include "ast.h"
+
+// Interprocedural clobber summaries: the registers a call to each label can overwrite, its callees included,
+// kept in label->clobbers for call_clobbers.
+
+typedef void (*summary_visit_t)(stmt_list_t *stmts, label_t *label, void *data);
+
+void summarize_bottom_up(stmt_list_t *stmts, summary_visit_t visit, void *data);
+void summarize_labels(stmt_list_t *stmts);
+void write_clobber_summary(stmt_list_t *stmts, char *path);
+
+#endif //ASMPP_SUMMARY_H
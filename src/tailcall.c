@@ -0,0 +1,154 @@
+#include "tailcall.h"
+#include "codegen.h"
+#include <string.h>
+
+static label_t *find_label(stmt_list_t *stmts, char *name) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && strcmp(stmt->label->name, name) == 0) {
+            return stmt->label;
+        }
+    }
+    return NULL;
+}
+
+static call_abi_t *find_abi(stmt_list_t *stmts, char *name) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && strcmp(stmt->label->name, name) == 0) {
+            return resolve_call_abi(stmt->label->abi, stmt->label->attributes);
+        }
+        if (stmt->kind == STMT_EXTERN && strcmp(stmt->extern_->name, name) == 0) {
+            return resolve_call_abi(stmt->extern_->abi, stmt->extern_->attributes);
+        }
+    }
+    return NULL;
+}
+
+// Stack arguments are pushed right before the call and would sit where the callee expects our return address.
+static bool fits_in_registers(call_abi_t *abi, int argc) {
+    if (abi == NULL || argc > abi->args->len) {
+        return false;
+    }
+    for (int i = 0; i < argc; i++) {
+        if (get_argument(abi->args, i)->kind == ARGUMENT_STACK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_push(instr_t *instr) {
+    return instr->kind == INSTR_ASM && strcmp(instr->instr_asm->name, "push") == 0;
+}
+
+static bool is_plain_ret(instr_t *instr) {
+    return instr->kind == INSTR_ASM && strcmp(instr->instr_asm->name, "ret") == 0 && instr->instr_asm->args->len == 0;
+}
+
+// Whether the list passes the address of a local on. The frame is gone once the label jumps away.
+static bool takes_local_address(label_t *label, instr_list_t *list) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        switch (instr->kind) {
+            case INSTR_ASM:
+                if (strcmp(instr->instr_asm->name, "lea") == 0 && instr->instr_asm->args->len == 2) {
+                    expr_t *src = get_expr(instr->instr_asm->args, 1);
+                    if (src->kind == MEMORY && src->memory.label != NULL && find_local(label->locals, src->memory.label) != -1) {
+                        return true;
+                    }
+                }
+                break;
+            case INSTR_CALL:
+                break;
+            case INSTR_IF:
+                if (takes_local_address(label, instr->instr_if->then_instrs)
+                    || takes_local_address(label, instr->instr_if->else_instrs)) {
+                    return true;
+                }
+                break;
+            case INSTR_LOOP:
+                if (takes_local_address(label, instr->instr_loop->body)) {
+                    return true;
+                }
+                break;
+            case INSTR_SWITCH:
+                for (int j = 0; j < instr->instr_switch->len; j++) {
+                    if (takes_local_address(label, instr->instr_switch->bodies[j])) {
+                        return true;
+                    }
+                }
+                if (takes_local_address(label, instr->instr_switch->default_instrs)) {
+                    return true;
+                }
+                break;
+        }
+    }
+    return false;
+}
+
+// `call X` written by hand, X being a label. Returns X.
+static char *get_asm_call_target(instr_t *instr) {
+    if (instr->kind != INSTR_ASM || strcmp(instr->instr_asm->name, "call") != 0 || instr->instr_asm->args->len != 1) {
+        return NULL;
+    }
+    expr_t *target = get_expr(instr->instr_asm->args, 0);
+    return target->kind == LABEL ? target->label : NULL;
+}
+
+static void optimize_tail_calls_in(stmt_list_t *stmts, label_t *label, instr_list_t *list, opt_stats_t *stats) {
+    for (int i = 0; i < list->len; i++) {
+        instr_t *instr = get_instr(list, i);
+        if (instr->kind == INSTR_IF) {
+            optimize_tail_calls_in(stmts, label, instr->instr_if->then_instrs, stats);
+            optimize_tail_calls_in(stmts, label, instr->instr_if->else_instrs, stats);
+            continue;
+        }
+        if (instr->kind == INSTR_LOOP) {
+            optimize_tail_calls_in(stmts, label, instr->instr_loop->body, stats);
+            continue;
+        }
+        if (instr->kind == INSTR_SWITCH) {
+            for (int j = 0; j < instr->instr_switch->len; j++) {
+                optimize_tail_calls_in(stmts, label, instr->instr_switch->bodies[j], stats);
+            }
+            optimize_tail_calls_in(stmts, label, instr->instr_switch->default_instrs, stats);
+            continue;
+        }
+        if (i + 1 >= list->len || !is_plain_ret(get_instr(list, i + 1))) {
+            continue;
+        }
+        if (instr->kind == INSTR_CALL) {
+            if (!fits_in_registers(find_abi(stmts, instr->instr_call->callee), instr->instr_call->args->len)) {
+                continue;
+            }
+            instr->instr_call->tail = true;
+        } else if (get_asm_call_target(instr) != NULL && (i == 0 || !is_push(get_instr(list, i - 1)))) {
+            char *target = get_asm_call_target(instr);
+            if (find_label(stmts, target) == label) {
+                // Keep self recursion as a call so that codegen turns it into a loop back-edge.
+                *instr = *new_call_instr(new_instr_call(target, new_expr_list()));
+                instr->instr_call->tail = true;
+            } else {
+                instr->instr_asm->name = "jmp";
+            }
+        } else {
+            continue;
+        }
+        // The ret after the call is now unreachable.
+        for (int j = i + 1; j < list->len - 1; j++) {
+            list->instrs[j] = list->instrs[j + 1];
+        }
+        list->len--;
+        stats->tail_calls++;
+    }
+}
+
+void optimize_tail_calls(stmt_list_t *stmts, opt_stats_t *stats) {
+    for (int i = 0; i < stmts->len; i++) {
+        stmt_t *stmt = get_stmt(stmts, i);
+        if (stmt->kind == STMT_LABEL && !takes_local_address(stmt->label, stmt->label->instrs)) {
+            optimize_tail_calls_in(stmts, stmt->label, stmt->label->instrs, stats);
+        }
+    }
+}
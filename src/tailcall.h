@@ -0,0 +1,9 @@
+#ifndef ASMPP_TAILCALL_H
+#define ASMPP_TAILCALL_H
+
+#include "ast.h"
+#include "optimize.h"
+
+void optimize_tail_calls(stmt_list_t *stmts, opt_stats_t *stats);
+
+#endif //ASMPP_TAILCALL_H
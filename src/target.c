@@ -0,0 +1,19 @@
+#include "target.h"
+#include <string.h>
+
+static target_t targets[] = {
+        {"generic", 16, 4, 2, 5, 3, 40, 3},
+        {"skylake", 32, 4, 2, 5, 3, 42, 3},
+        {"icelake", 16, 5, 2, 5, 3, 15, 3},
+        {"zen", 32, 5, 2, 4, 3, 45, 1},
+        {"atom", 16, 2, 1, 3, 5, 60, 3},
+};
+
+target_t *find_target(char *name) {
+    for (int i = 0; i < (int) (sizeof(targets) / sizeof(targets[0])); i++) {
+        if (strcmp(targets[i].name, name) == 0) {
+            return &targets[i];
+        }
+    }
+    return NULL;
+}
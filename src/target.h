@@ -0,0 +1,21 @@
+#ifndef ASMPP_TARGET_H
+#define ASMPP_TARGET_H
+
+typedef struct {
+    char *name;
+    // Alignment of loop heads, in bytes.
+    int loop_align;
+    // Instructions issued per cycle, and how many of them may load.
+    int issue_width;
+    int load_ports;
+    // Latencies in cycles: an L1 hit (also store to load forwarding), multiplication, 64-bit division and
+    // bit counting (popcnt, lzcnt, tzcnt, bsf, bsr). Everything else takes a cycle.
+    int load_latency;
+    int mul_latency;
+    int div_latency;
+    int bitcount_latency;
+} target_t;
+
+target_t *find_target(char *name);
+
+#endif //ASMPP_TARGET_H
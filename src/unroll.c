@@ -0,0 +1,105 @@
+#include "unroll.h"
+#include "analysis.h"
+#include "constprop.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+
+// 1 when the attributes do not ask for unrolling.
+int unroll_factor(attribute_list_t *attributes) {
+    int index = find_attribute(attributes, "unroll");
+    if (index == -1) {
+        return 1;
+    }
+    attribute_t *attribute = get_attribute(attributes, index);
+    if (attribute->value == NULL || attribute->value->len == 0) {
+        return UNROLL_FULL;
+    }
+    char *end;
+    long factor = strtol(get_string(attribute->value, 0), &end, 10);
+    if (*end != '\0' || factor < 1) {
+        error("Unroll factor must be a positive number", ERROR_INVALID);
+    }
+    return (int) factor;
+}
+
+static bool fits_imm32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Rewrites a copy of one instruction so that it reads counter + value, either by moving value into the
+// displacements of the addresses using counter (keep), or by replacing counter with value altogether.
+static bool rewrite_instr(instr_asm_t *instr, register_kind_t counter, int64_t value, bool keep) {
+    regset_t family = regset_of(counter);
+    for (int i = 0; i < instr->args->len; i++) {
+        expr_t *expr = get_expr(instr->args, i);
+        if (expr->kind == REGISTER && (regset_of(expr->register_) & family)) {
+            // A plain read can only become an immediate source.
+            expr_t *dst = get_expr(instr->args, 0);
+            if (keep || expr->register_ != counter || i != 1 || instr->args->len != 2
+                || !is_imm_source_instr(instr->name) || !fits_imm32(value)) {
+                return false;
+            }
+            instr->args->exprs[1] = *new_expr_immediate(value);
+            if (dst->kind == MEMORY && dst->memory.size == 0) {
+                dst->memory.size = register_width(counter) / 8;
+            }
+        } else if (expr->kind == MEMORY) {
+            if (expr->memory.base != NO_REGISTER && (regset_of(expr->memory.base) & family)) {
+                if (expr->memory.base != counter) {
+                    return false;
+                }
+                expr->memory.displacement += value;
+                if (!keep) {
+                    expr->memory.base = NO_REGISTER;
+                }
+            }
+            if (expr->memory.index != NO_REGISTER && (regset_of(expr->memory.index) & family)) {
+                if (expr->memory.index != counter) {
+                    return false;
+                }
+                expr->memory.displacement += value * expr->memory.scale;
+                if (!keep) {
+                    expr->memory.index = NO_REGISTER;
+                }
+            }
+            if (!fits_imm32(expr->memory.displacement)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// NULL when the body writes the counter or reads it in a way that cannot be rewritten.
+static instr_list_t *rewrite_body(instr_list_t *body, register_kind_t counter, int64_t value, bool keep) {
+    regset_t family = regset_of(counter);
+    instr_list_t *out = new_instr_list();
+    for (int i = 0; i < body->len; i++) {
+        instr_t *instr = get_instr(body, i);
+        if (instr->kind != INSTR_ASM || !is_known_instr(instr->instr_asm)) {
+            return NULL;
+        }
+        regset_t uses, defs;
+        instr_effects(instr, &uses, &defs);
+        if ((defs & family) || (uses & ~expr_list_regs(instr->instr_asm->args) & family)) {
+            return NULL;
+        }
+        instr_t *copy = copy_instr(instr);
+        if (!rewrite_instr(copy->instr_asm, counter, value, keep)) {
+            return NULL;
+        }
+        append_instr(out, copy);
+    }
+    return out;
+}
+
+// The body as it reads when counter is delta away from the register, with counter only used in addresses.
+instr_list_t *rebase_counter(instr_list_t *body, register_kind_t counter, int64_t delta) {
+    return rewrite_body(body, counter, delta, true);
+}
+
+// The body as it reads when counter holds value.
+instr_list_t *substitute_counter(instr_list_t *body, register_kind_t counter, int64_t value) {
+    return rewrite_body(body, counter, value, false);
+}
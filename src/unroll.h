@@ -0,0 +1,13 @@
+#ifndef ASMPP_UNROLL_H
+#define ASMPP_UNROLL_H
+
+#include "ast.h"
+
+// A bare [unroll] asks for the loop to be unrolled completely.
+#define UNROLL_FULL 0
+
+int unroll_factor(attribute_list_t *attributes);
+instr_list_t *rebase_counter(instr_list_t *body, register_kind_t counter, int64_t delta);
+instr_list_t *substitute_counter(instr_list_t *body, register_kind_t counter, int64_t value);
+
+#endif //ASMPP_UNROLL_H
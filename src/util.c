@@ -14,6 +14,7 @@ string_buffer_t *new_string_buffer() {
         free(buffer);
         return NULL;
     }
+    buffer->data[0] = '\0';
     buffer->size = 0;
     buffer->capacity = 10;
     buffer->tab_size = 4;
@@ -23,7 +24,7 @@ string_buffer_t *new_string_buffer() {
 
 void string_buffer_write(string_buffer_t *buffer, char *str) {
     int len = strlen(str);
-    if (buffer->size + len >= buffer->capacity) {
+    while (buffer->size + len >= buffer->capacity) {
         char *new_data = realloc(buffer->data, sizeof(char) * buffer->capacity * 2);
         if (new_data == NULL) {
             return;
@@ -33,6 +34,7 @@ void string_buffer_write(string_buffer_t *buffer, char *str) {
     }
     memcpy(buffer->data + buffer->size, str, len);
     buffer->size += len;
+    buffer->data[buffer->size] = '\0';
 }
 
 void string_buffer_writeln(string_buffer_t *buffer, char *str) {
@@ -42,11 +44,13 @@ void string_buffer_writeln(string_buffer_t *buffer, char *str) {
 
 void string_buffer_write_tabbed(string_buffer_t *buffer, char *str) {
     for (int i = 0; i < buffer->tab_count; i++) {
-        char* tab = malloc(sizeof(char) * buffer->tab_size);
+        char* tab = malloc(sizeof(char) * (buffer->tab_size + 1));
         for (int j = 0; j < buffer->tab_size; j++) {
             tab[j] = ' ';
         }
+        tab[buffer->tab_size] = '\0';
         string_buffer_write(buffer, tab);
+        free(tab);
     }
     string_buffer_write(buffer, str);
 }
@@ -0,0 +1,9 @@
+section .data
+section .bss
+section .text
+global min
+min:
+    mov rax, rdi
+    cmp rdi, rsi
+    cmovg rax, rsi
+    ret
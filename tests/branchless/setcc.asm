@@ -0,0 +1,9 @@
+section .data
+section .bss
+section .text
+global is_zero
+is_zero:
+    test rdi, rdi
+    sete al
+    movzx eax, al
+    ret
@@ -0,0 +1,10 @@
+section .data
+section .bss
+section .text
+global less
+less:
+    cmp rdi, rsi
+    setl r9b
+    movzx r9d, r9b
+    mov rax, r9
+    ret
@@ -0,0 +1,13 @@
+section .data
+section .bss
+section .text
+global load_pair
+load_pair:
+    push rdi
+    mov rdi, [rsi]
+    xchg qword [rsp], rdi
+    mov rsi, [rdi]
+    pop rdi
+    mov rax, rdi
+    add rax, rsi
+    ret
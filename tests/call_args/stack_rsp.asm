@@ -0,0 +1,12 @@
+section .data
+section .bss
+section .text
+k:
+    ret 16
+global main
+main:
+    push rax
+    push qword [rsp + 24]
+    mov rdi, [rsp + 24]
+    call k
+    ret
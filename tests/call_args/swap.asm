@@ -0,0 +1,9 @@
+section .data
+section .bss
+section .text
+global rsub
+rsub:
+    xchg rdi, rsi
+    mov rax, rdi
+    sub rax, rsi
+    ret
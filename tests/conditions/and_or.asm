@@ -0,0 +1,21 @@
+section .data
+section .bss
+section .text
+global in_range
+in_range:
+    xor eax, eax
+    cmp rdi, rsi
+    jl .L0
+    cmp rdi, rdx
+    jge .L0
+    lea rax, [rdi + 7]
+.L0:
+    test rdi, rdi
+    je .L2
+    cmp rsi, rdx
+    jb .L1
+.L2:
+    add rax, rsi
+    shl rax, 1
+.L1:
+    ret
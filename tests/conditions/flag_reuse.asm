@@ -0,0 +1,18 @@
+section .data
+section .bss
+section .text
+global sign
+sign:
+    cmp rdi, rsi
+    jge .L0
+    add rdi, 3
+    jmp done
+.L0:
+    jle .L1
+    sub rsi, 5
+    mov rdi, rsi
+.L1:
+    jmp done
+done:
+    mov rax, rdi
+    ret
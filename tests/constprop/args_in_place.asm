@@ -0,0 +1,13 @@
+section .data
+section .bss
+section .text
+add2:
+    lea rax, [rdi + rsi]
+    ret
+global main
+main:
+    mov edi, 7
+    mov esi, 9
+    call add2
+    add rax, rdi
+    ret
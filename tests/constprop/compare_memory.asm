@@ -0,0 +1,12 @@
+section .data
+    x dq 1
+section .bss
+section .text
+global main
+main:
+    mov ecx, 5
+    cmp qword [x], 5
+    jge .L0
+    mov eax, 1
+.L0:
+    ret
@@ -0,0 +1,9 @@
+section .data
+section .bss
+section .text
+global wrap
+wrap:
+    mov rax, rdi
+    and eax, 15
+    add rax, 32
+    ret
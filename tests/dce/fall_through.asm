@@ -0,0 +1,9 @@
+section .data
+section .bss
+section .text
+global entry
+entry:
+    mov eax, 1
+tail:
+    add rax, 2
+    ret
@@ -0,0 +1,9 @@
+section .data
+section .bss
+section .text
+used:
+    mov rax, rdi
+    ret
+global main
+main:
+    jmp used
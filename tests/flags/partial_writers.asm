@@ -0,0 +1,15 @@
+section .data
+section .bss
+section .text
+global carries
+carries:
+    add rdi, rsi
+    mov eax, 0
+    mov ecx, 0
+    inc rdx
+    adc rax, 0
+    add rdi, rsi
+    dec rdx
+    adc rcx, 0
+    add rax, rcx
+    ret
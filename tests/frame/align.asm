@@ -0,0 +1,17 @@
+section .data
+section .bss
+section .text
+global vec
+vec:
+    push rbp
+    mov rbp, rsp
+    and rsp, -32
+    lea rsp, [rsp - 40]
+    mov [rsp + 8], rdi
+    call fill
+    mov rax, [rsp + 8]
+    leave
+    ret
+fill:
+    mov eax, 0
+    ret
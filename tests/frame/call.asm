@@ -0,0 +1,14 @@
+section .data
+section .bss
+section .text
+fill:
+    mov qword [rdi], 1
+    ret
+global use
+use:
+    lea rsp, [rsp - 16]
+    lea rdi, [rsp]
+    call fill
+    mov rax, [rsp]
+    lea rsp, [rsp + 16]
+    ret
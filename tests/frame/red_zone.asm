@@ -0,0 +1,10 @@
+section .data
+section .bss
+section .text
+global swap_sum
+swap_sum:
+    mov [rsp - 8], rdi
+    mov [rsp - 8], rsi
+    mov rax, rdi
+    add rax, [rsp - 8]
+    ret
@@ -0,0 +1,15 @@
+section .data
+section .bss
+section .text
+global a
+a:
+    jmp x
+global b
+b:
+    jmp y
+x:
+    mov eax, 1
+    ret
+y:
+    mov eax, 2
+    ret
@@ -0,0 +1,9 @@
+section .data
+section .bss
+section .text
+global add_one
+inc_one:
+add_one:
+    lea rax, [rdi + 1]
+    ret
+global inc_one
@@ -0,0 +1,15 @@
+section .data
+section .bss
+section .text
+global max
+max:
+    cmp rdi, rsi
+    jle .L1
+    mov rax, rdi
+    add rax, 1
+    jmp .L0
+.L1:
+    mov rax, rsi
+    sub rax, 1
+.L0:
+    ret
@@ -0,0 +1,13 @@
+section .data
+section .bss
+section .text
+global clamp
+clamp:
+    mov rax, rdi
+    test rdi, rdi
+    jge .L0
+    xor eax, eax
+    neg rdi
+.L0:
+    add rax, rdi
+    ret
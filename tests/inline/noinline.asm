@@ -0,0 +1,21 @@
+section .data
+section .bss
+section .text
+twice:
+    lea rax, [rdi + rdi]
+    ret
+count:
+    test rdi, rdi
+    jne .L0
+    mov eax, 0
+    ret
+.L0:
+    dec rdi
+    call count
+    inc rax
+    ret
+global main
+main:
+    call twice
+    mov rdi, rax
+    jmp count
@@ -0,0 +1,8 @@
+section .data
+section .bss
+section .text
+global sum3
+sum3:
+    lea rax, [rdi + rsi]
+    add rax, rdx
+    ret
@@ -0,0 +1,18 @@
+section .data
+section .bss
+section .text
+global tenth
+tenth:
+    mov rax, rdi
+    xor edx, edx
+    mov rdx, -3689348814741910323
+    mov ecx, 10
+    mov rcx, rax
+    mul rdx
+    shr rdx, 3
+    mov rax, rdx
+    imul rdx, rax, 10
+    sub rcx, rdx
+    mov rdx, rcx
+    mov ecx, 10
+    ret
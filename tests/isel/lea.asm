@@ -0,0 +1,9 @@
+section .data
+section .bss
+section .text
+global offset
+offset:
+    lea rax, [rdi + rsi]
+    lea rdx, [rdi - 16]
+    imul rax, rdx
+    ret
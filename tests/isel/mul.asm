@@ -0,0 +1,10 @@
+section .data
+section .bss
+section .text
+global scale
+scale:
+    lea rsi, [rsi + rsi*4]
+    mov rax, rdi
+    shl rax, 3
+    add rax, rsi
+    ret
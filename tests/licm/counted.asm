@@ -0,0 +1,16 @@
+section .data
+section .rodata
+    table dq 1, 2, 3, 4
+section .bss
+section .text
+global sum4
+sum4:
+    mov rcx, [table + rsi*8]
+    xor eax, eax
+    mov edi, 4
+    align 16
+.L0:
+    add rax, rcx
+    dec rdi
+    jnz .L0
+    ret
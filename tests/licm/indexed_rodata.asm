@@ -0,0 +1,23 @@
+section .data
+section .rodata
+    table dq 1, 2, 3, 4
+    scale dq 3
+section .bss
+section .text
+global sum
+sum:
+    mov rdx, [scale]
+    xor eax, eax
+    jmp .L1
+    align 16
+.L0:
+    mov rcx, [table + rsi*8]
+    add rax, rcx
+    add rax, rdx
+    inc rdi
+.L1:
+    cmp rdi, rsi
+    jl .L0
+    mov ecx, 0
+    mov edx, 0
+    ret
@@ -0,0 +1,16 @@
+section .data
+section .bss
+section .text
+global count
+count:
+    test rdi, rdi
+    je .L0
+.L1:
+    lea rax, [rdi + rsi]
+    ret
+    section .text.unlikely progbits alloc exec nowrite align=16
+.L0:
+    mov esi, 100
+    add rsi, rsi
+    jmp .L1
+    section .text
@@ -0,0 +1,15 @@
+section .data
+section .bss
+section .text
+global checked_div
+checked_div:
+    test rsi, rsi
+    je .L0
+.L1:
+    mov rax, rdi
+    cqo
+    idiv rsi
+    ret
+.L0:
+    mov rax, -1
+    ret
@@ -0,0 +1,17 @@
+section .data
+section .bss
+section .text
+global sum
+sum:
+    xor eax, eax
+    mov rcx, rsi
+    test rcx, rcx
+    jz .L1
+    align 16
+.L0:
+    add rax, [rdi]
+    add rdi, 8
+    dec rcx
+    jnz .L0
+.L1:
+    ret
@@ -0,0 +1,15 @@
+section .data
+section .bss
+section .text
+global strlen
+strlen:
+    mov rax, rdi
+    jmp .L1
+    align 16
+.L0:
+    inc rax
+.L1:
+    cmp byte [rax], 0
+    jne .L0
+    sub rax, rdi
+    ret
@@ -0,0 +1,11 @@
+section .data
+section .bss
+section .text
+global copy
+copy:
+    mov rax, [rdi]
+    mov rdx, [rdi + 8]
+    mov rcx, rax
+    mov [rsi], rcx
+    add rax, rcx
+    ret
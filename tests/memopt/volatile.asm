@@ -0,0 +1,10 @@
+section .data
+    status dq 0
+section .bss
+section .text
+global poll
+poll:
+    mov rax, [status]
+    mov rcx, [status]
+    add rax, rcx
+    ret
@@ -0,0 +1,19 @@
+section .data
+section .bss
+section .text
+global main
+main:
+    add rax, rdi
+    mov edx, 0
+    mov ecx, 0
+    inc rsi
+    adc rdx, 0
+    shl rdi, cl
+    adc rcx, 0
+    xor r8d, r8d
+    shl rdi, 3
+    adc r8, 0
+    add rax, rdx
+    add rax, rcx
+    add rax, r8
+    ret
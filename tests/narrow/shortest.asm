@@ -0,0 +1,10 @@
+section .data
+section .bss
+section .text
+global zeros
+zeros:
+    mov ecx, 100
+    xor edx, edx
+    and esi, 65280
+    mov rax, rdi
+    ret
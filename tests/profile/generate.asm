@@ -0,0 +1,51 @@
+section .data
+section .rodata
+    __asmpp_profile_keys dq 5067200836620079937, 3, 2537657238391946210, -9120322389617246243, 2258945139493307336
+    __asmpp_profile_path db "app.prof", 0
+section .fini_array progbits alloc noexec write align=8
+    __asmpp_profile_fini dq __asmpp_profile_dump
+section .bss
+    __asmpp_profile_counts resq 3
+section .text
+global main
+main:
+    lea rsp, [rsp - 128]
+    pushfq
+    inc qword [__asmpp_profile_counts + 16]
+    popfq
+    lea rsp, [rsp + 128]
+    inc qword [__asmpp_profile_counts + 8]
+    test rdi, rdi
+    jge .L0
+    inc qword [__asmpp_profile_counts]
+    neg rdi
+.L0:
+    mov rax, rdi
+    ret
+global __asmpp_profile_dump
+__asmpp_profile_dump:
+    push rbx
+    mov eax, 2
+    mov rdi, __asmpp_profile_path
+    mov esi, 1089
+    mov edx, 420
+    syscall
+    test rax, rax
+    jl .L1
+    mov rbx, rax
+    mov eax, 1
+    mov rdi, rbx
+    mov rsi, __asmpp_profile_keys
+    mov edx, 40
+    syscall
+    mov eax, 1
+    mov rdi, rbx
+    mov rsi, __asmpp_profile_counts
+    mov edx, 24
+    syscall
+    mov eax, 3
+    mov rdi, rbx
+    syscall
+.L1:
+    pop rbx
+    ret
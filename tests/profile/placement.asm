@@ -0,0 +1,22 @@
+section .data
+section .bss
+section .text
+fix:
+    neg rdi
+done:
+    mov rax, rdi
+    ret
+section .text.hot progbits alloc exec nowrite align=16
+global main
+main:
+    test rdi, rdi
+    jge .L0
+    call fix
+.L0:
+    lea rax, [rdi + 1]
+    ret
+section .text.unlikely progbits alloc exec nowrite align=16
+global unused
+unused:
+    mov rax, rdi
+    ret
@@ -0,0 +1,10 @@
+section .data
+section .bss
+section .text
+global leaf
+leaf:
+    push rbp
+    mov rbp, rsp
+    lea rax, [rdi + 1]
+    pop rbp
+    ret
@@ -0,0 +1,10 @@
+section .data
+section .bss
+section .text
+global own
+own:
+    push rbx
+    mov rbx, rdi
+    lea rax, [rbx + 1]
+    pop rbx
+    ret
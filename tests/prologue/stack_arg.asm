@@ -0,0 +1,12 @@
+section .data
+section .bss
+section .text
+global seventh
+seventh:
+    push rbx
+    lea rsp, [rsp - 8]
+    mov rbx, [rsp + 24]
+    lea rsp, [rsp + 8]
+    lea rax, [rbx + rbx]
+    pop rbx
+    ret
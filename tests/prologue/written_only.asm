@@ -0,0 +1,20 @@
+section .data
+section .bss
+section .text
+global pick
+pick:
+    push rbx
+    mov rbx, rdi
+    push r12
+    mov r12, rsi
+    cmp rbx, r12
+    jge .L0
+    pop r12
+    mov rax, rbx
+    pop rbx
+    ret
+.L0:
+    mov rax, r12
+    pop r12
+    pop rbx
+    ret
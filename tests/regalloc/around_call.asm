@@ -0,0 +1,14 @@
+section .data
+section .bss
+section .text
+clobber:
+    mov rax, rdi
+    mov ecx, 5
+    mul rcx
+    ret
+global keep
+keep:
+    lea rsi, [rdi + 3]
+    call clobber
+    add rax, rsi
+    ret
@@ -0,0 +1,13 @@
+section .data
+section .bss
+section .text
+global dot
+dot:
+    mov rcx, [rdi]
+    mov rdx, [rsi]
+    imul rcx, rdx
+    mov rdx, [rdi + 8]
+    imul rdx, [rsi + 8]
+    add rcx, rdx
+    mov rax, rcx
+    ret
@@ -0,0 +1,16 @@
+section .data
+section .bss
+section .text
+extern ext
+global twice
+twice:
+    push rbx
+    mov rbx, rdi
+    lea rsp, [rsp - 8]
+    sub rsp, 8
+    call ext
+    add rsp, 8
+    add rax, rbx
+    lea rsp, [rsp + 8]
+    pop rbx
+    ret
@@ -0,0 +1,36 @@
+# Compiles INPUT with ASMPP and compares the assembly with the .asm file next to it.
+#
+#     cmake -DASMPP=<asmpp> -DINPUT=<test.asmpp> -DOUTPUT_DIR=<dir> -P run_test.cmake
+#
+# A first line `; asmpp: <options>` passes options to asmpp, which runs from the directory of the test.
+# With -DUPDATE=ON the .asm file is rewritten with what asmpp emitted instead.
+
+get_filename_component(test_dir ${INPUT} DIRECTORY)
+get_filename_component(test_name ${INPUT} NAME)
+string(REGEX REPLACE "\\.asmpp$" ".asm" expected_path ${INPUT})
+
+set(options "")
+file(READ ${INPUT} source)
+if (source MATCHES "^; asmpp: ([^\n]*)")
+    separate_arguments(options UNIX_COMMAND "${CMAKE_MATCH_1}")
+endif ()
+
+file(REMOVE_RECURSE ${OUTPUT_DIR})
+file(MAKE_DIRECTORY ${OUTPUT_DIR})
+execute_process(COMMAND ${ASMPP} ${options} -O ${OUTPUT_DIR} ${test_name}
+                WORKING_DIRECTORY ${test_dir}
+                RESULT_VARIABLE result
+                ERROR_VARIABLE errors)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "asmpp failed on ${INPUT}:\n${errors}")
+endif ()
+
+file(READ ${OUTPUT_DIR}/${test_name}.asm actual)
+if (UPDATE)
+    file(WRITE ${expected_path} "${actual}")
+    return()
+endif ()
+file(READ ${expected_path} expected)
+if (NOT actual STREQUAL expected)
+    message(FATAL_ERROR "${INPUT} compiled to:\n${actual}\nexpected:\n${expected}")
+endif ()
@@ -0,0 +1,14 @@
+section .data
+section .bss
+section .text
+global abs
+abs:
+    mov rax, rdi
+.P7928cba07a0b0e6e_0:
+    test rdi, rdi
+    jge .L1
+.Pdb71416bfbd58a51_2:
+    neg rax
+.L1:
+.Pe71fb2190541727b_3:
+    ret
@@ -0,0 +1,21 @@
+section .data
+section .bss
+section .text
+section .text.hot progbits alloc exec nowrite align=16
+global abs
+abs:
+    mov rax, rdi
+    test rdi, rdi
+    jl .L0
+.L1:
+    ret
+    section .text.unlikely progbits alloc exec nowrite align=16
+.L0:
+    neg rax
+    jmp .L1
+    section .text.hot progbits alloc exec nowrite align=16
+section .text.unlikely progbits alloc exec nowrite align=16
+global unused
+unused:
+    mov rax, rdi
+    ret
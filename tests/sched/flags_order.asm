@@ -0,0 +1,13 @@
+section .data
+section .bss
+section .text
+global carry
+carry:
+    mov rax, [rdx]
+    mov rcx, [rdx + 8]
+    add rdi, rsi
+    adc rax, 0
+    cmp rdi, rsi
+    sbb rcx, 0
+    add rax, rcx
+    ret
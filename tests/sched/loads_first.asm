@@ -0,0 +1,11 @@
+section .data
+section .bss
+section .text
+global mix
+mix:
+    mov rax, [rdi]
+    add rsi, rdx
+    imul rsi, rsi
+    add rax, 1
+    add rax, rsi
+    ret
@@ -0,0 +1,23 @@
+section .data
+section .bss
+section .text
+slow:
+    add rdi, 1
+after:
+    lea rax, [rdi + 2]
+    ret
+global main
+main:
+    call slow
+    call err
+    lea rax, [rdi + 3]
+    ret
+section .text.hot progbits alloc exec nowrite align=16
+global fast
+fast:
+    lea rax, [rdi + 3]
+    ret
+section .text.unlikely progbits alloc exec nowrite align=16
+err:
+    mov eax, 1
+    ret
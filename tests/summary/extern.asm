@@ -0,0 +1,10 @@
+section .data
+section .bss
+section .text
+extern first
+global twice
+twice:
+    lea rdx, [rdi + 1]
+    call first
+    add rax, rdx
+    ret
@@ -0,0 +1,15 @@
+section .data
+section .bss
+section .text
+square:
+    mov rax, rdi
+    imul rax, rdi
+    ret
+global sum_squares
+sum_squares:
+    call square
+    mov rcx, rax
+    mov rdi, rsi
+    call square
+    add rax, rcx
+    ret
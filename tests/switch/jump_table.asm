@@ -0,0 +1,28 @@
+section .data
+section .rodata
+    classify.table6 dq classify.L0, classify.L1, classify.L2, classify.L3
+section .bss
+section .text
+global classify
+classify:
+    cmp rdi, 1
+    jl .L5
+    cmp rdi, 4
+    jg .L5
+    jmp [classify.table6 + rdi*8 - 8]
+.L0:
+    mov eax, 10
+    ret
+.L1:
+    mov eax, 20
+    ret
+.L2:
+    mov eax, 30
+    ret
+.L3:
+    mov eax, 40
+    ret
+.L5:
+    mov eax, 0
+    ret
+.L4:
@@ -0,0 +1,18 @@
+section .data
+section .bss
+section .text
+global sparse
+sparse:
+    xor eax, eax
+    cmp rdi, 1
+    je .L0
+    cmp rdi, 1000
+    je .L1
+    jmp .L2
+.L0:
+    mov eax, 1
+    jmp .L2
+.L1:
+    mov eax, 2
+.L2:
+    ret
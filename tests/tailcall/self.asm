@@ -0,0 +1,17 @@
+section .data
+section .bss
+section .text
+global gcd
+gcd:
+.L0:
+    test rsi, rsi
+    jne .L1
+    mov rax, rdi
+    ret
+.L1:
+    mov rax, rdi
+    cqo
+    idiv rsi
+    mov rdi, rsi
+    mov rsi, rdx
+    jmp .L0
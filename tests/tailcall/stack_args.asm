@@ -0,0 +1,16 @@
+section .data
+section .bss
+section .text
+sum:
+    mov rax, [rsp + 8]
+    add rax, rdi
+    ret 8
+other:
+    lea rax, [rdi + 1]
+    ret
+global both
+both:
+    push rsi
+    call sum
+    mov rdi, rax
+    jmp other
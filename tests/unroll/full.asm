@@ -0,0 +1,14 @@
+section .data
+section .bss
+section .text
+global sum3
+sum3:
+    xor eax, eax
+    add rax, [rdi]
+    add rdi, 8
+    add rax, [rdi]
+    add rdi, 8
+    add rax, [rdi]
+    add rdi, 8
+    mov ecx, 0
+    ret
@@ -0,0 +1,31 @@
+section .data
+section .bss
+section .text
+global sum
+sum:
+    xor eax, eax
+    mov rcx, rsi
+    jmp .L2
+.L1:
+    add rax, [rdi]
+    add rdi, 8
+    dec rcx
+.L2:
+    test rcx, 3
+    jnz .L1
+    test rcx, rcx
+    jz .L3
+    align 16
+.L0:
+    add rax, [rdi]
+    add rdi, 8
+    add rax, [rdi]
+    add rdi, 8
+    add rax, [rdi]
+    add rdi, 8
+    add rax, [rdi]
+    add rdi, 8
+    sub rcx, 4
+    jnz .L0
+.L3:
+    ret